@@ -7,39 +7,71 @@ using std::ostream;
 using std::istream;
 
 namespace MtmMath {
+    /*
+     * The arithmetic is inline and constexpr where C++11 allows it, so the
+     * element-wise loops and the multiplication kernels see through it and
+     * can vectorize it. The layout is exactly {re, im}, MtmKernels relies on
+     * it to run additions on the two parts as one array of doubles.
+     */
     class Complex {
     private:
         double re,im;
     public:
-        Complex(double re=0, double im=0);
+        constexpr Complex(double re=0, double im=0) : re(re), im(im) {}
         Complex(const Complex&) = default;
         Complex& operator=(const Complex&) = default;
+        constexpr double real() const { return re; }
+        constexpr double imag() const { return im; }
         Complex& operator+=(const Complex& c);
         Complex& operator-=(const Complex& c);
         Complex& operator*=(const Complex& c);
-        Complex operator-() const;
-        friend bool operator==(const Complex& a, const Complex& b);
-        friend bool operator!=(const Complex& a, const Complex& b);
+        constexpr Complex operator-() const { return Complex(-re, -im); }
         friend ostream& operator<<(ostream& os, const Complex& c);
         friend istream& operator>>(istream& is, Complex& c);
     };
 
-    bool operator==(const Complex &a, const Complex &b);
-    bool operator!=(const Complex& a, const Complex& b);
     istream& operator>>(istream& is, Complex& c);
     ostream& operator<<(ostream& os, const Complex& c);
-    Complex operator+(const Complex& a, const Complex& b);
-    Complex operator-(const Complex& a, const Complex& b);
-    Complex operator*(const Complex& a, const Complex& b);
-
-}
-#endif //EX3_COMPLEX_H
 
+    inline Complex& Complex::operator+=(const Complex &c) {
+        re += c.re;
+        im += c.im;
+        return *this;
+    }
 
+    inline Complex& Complex::operator-=(const Complex &c) {
+        re -= c.re;
+        im -= c.im;
+        return *this;
+    }
 
+    inline Complex& Complex::operator*=(const Complex& c){
+        double tmp_re = re*c.re-im*c.im;
+        im = re*c.im+im*c.re;
+        re = tmp_re;
+        return *this;
+    }
 
+    constexpr bool operator==(const Complex &a, const Complex &b) {
+        return a.real() == b.real() && a.imag() == b.imag();
+    }
 
+    constexpr bool operator!=(const Complex& a, const Complex& b) {
+        return !(a == b);
+    }
 
+    constexpr Complex operator+(const Complex& a, const Complex& b) {
+        return Complex(a.real()+b.real(), a.imag()+b.imag());
+    }
 
+    constexpr Complex operator-(const Complex& a, const Complex& b) {
+        return Complex(a.real()-b.real(), a.imag()-b.imag());
+    }
 
+    constexpr Complex operator*(const Complex& a, const Complex& b) {
+        return Complex(a.real()*b.real()-a.imag()*b.imag(),
+                       a.real()*b.imag()+a.imag()*b.real());
+    }
 
+}
+#endif //EX3_COMPLEX_H
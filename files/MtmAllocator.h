@@ -0,0 +1,118 @@
+#ifndef EX3_MTMALLOCATOR_H
+#define EX3_MTMALLOCATOR_H
+
+#include <new>
+#include <limits>
+#include <cstdint>
+#include <utility>
+#include "MtmStats.h"
+#include "MtmArena.h"
+
+using std::size_t;
+
+namespace MtmMath {
+
+    /*
+     * Allocator returning memory aligned to Align bytes (a cache line by
+     * default), so contiguous matrix buffers start on a boundary that vector
+     * loads and the blocked kernels can rely on.
+     * Allocation failures are reported with std::bad_alloc, which the
+     * constructors translate to MtmExceptions::OutOfMemory.
+     * Elements created without a value are default initialized, so resizing
+     * a buffer that is about to be overwritten doesn't zero it first.
+     * Inside a ScopedArena the memory comes from its arena (see MtmArena.h).
+     * Every block records where it came from, so any allocator can free it.
+     */
+    template <typename T, size_t Align = 64>
+    class AlignedAllocator {
+    public:
+        typedef T value_type;
+        template <typename U>
+        struct rebind {
+            typedef AlignedAllocator<U, Align> other;
+        };
+
+        AlignedAllocator() {}
+        template <typename U>
+        AlignedAllocator(const AlignedAllocator<U, Align>&) {}
+
+        T* allocate(size_t n);
+        void deallocate(T* p, size_t n);
+        size_t max_size() const;
+
+    private:
+        static const size_t HEADER = 2*sizeof(void*);
+    public:
+
+        template <typename U>
+        void construct(U* p) {
+            ::new((void*)p) U;
+        }
+        template <typename U, typename... Args>
+        void construct(U* p, Args&&... args) {
+            ::new((void*)p) U(std::forward<Args>(args)...);
+        }
+    };
+
+    template <typename T, size_t Align>
+    size_t AlignedAllocator<T, Align>::max_size() const {
+        return (std::numeric_limits<size_t>::max() - Align - HEADER) /
+               sizeof(T);
+    }
+
+    /*
+     * Over-allocates by Align bytes plus a header right before the aligned
+     * block: the arena it came from (nullptr for the heap) and, for the
+     * heap, where the allocation really starts, so deallocate can find both.
+     */
+    template <typename T, size_t Align>
+    T* AlignedAllocator<T, Align>::allocate(size_t n) {
+        if (n > max_size()) {
+            throw std::bad_alloc();
+        }
+        Arena* arena = Arena::current();
+        void** header;
+        if (arena != nullptr) {
+            header = static_cast<void**>(
+                    arena->allocate(n * sizeof(T), Align, HEADER));
+        }
+        else {
+            void* raw = ::operator new(n * sizeof(T) + Align + HEADER);
+            uintptr_t start = reinterpret_cast<uintptr_t>(raw) + HEADER;
+            uintptr_t aligned = (start + Align - 1) & ~(uintptr_t)(Align - 1);
+            header = reinterpret_cast<void**>(aligned);
+            header[-1] = raw;
+        }
+        header[-2] = arena;
+        MTM_STATS_ALLOC(n * sizeof(T));
+        return reinterpret_cast<T*>(header);
+    }
+
+    template <typename T, size_t Align>
+    void AlignedAllocator<T, Align>::deallocate(T* p, size_t n) {
+        if (p == nullptr) return;
+        MTM_STATS_FREE(n * sizeof(T));
+        void** header = reinterpret_cast<void**>(p);
+        if (header[-2] != nullptr) {
+            static_cast<Arena*>(header[-2])->release(p, n * sizeof(T));
+        }
+        else {
+            ::operator delete(header[-1]);
+        }
+    }
+
+    template <typename T, typename U, size_t Align>
+    bool operator==(const AlignedAllocator<T, Align>&,
+                    const AlignedAllocator<U, Align>&) {
+        return true;
+    }
+
+    template <typename T, typename U, size_t Align>
+    bool operator!=(const AlignedAllocator<T, Align>&,
+                    const AlignedAllocator<U, Align>&) {
+        return false;
+    }
+
+}
+
+#endif //EX3_MTMALLOCATOR_H
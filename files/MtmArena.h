@@ -0,0 +1,174 @@
+#ifndef EX3_MTMARENA_H
+#define EX3_MTMARENA_H
+
+#include <new>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <cstdlib>
+#include <cstdint>
+
+using std::size_t;
+
+namespace MtmMath {
+
+    /*
+     * Bump allocator behind ScopedArena. Blocks are cut from chunks of at
+     * least CHUNK bytes, and freeing the most recent block of the chunk in
+     * use gives its memory back right away, which suits temporaries created
+     * and destroyed in stack order. Other blocks are only counted, the
+     * chunks are returned to the heap together once the scope has ended and
+     * every block from it was freed, so objects may outlive the scope and be
+     * freed on any thread.
+     */
+    class Arena {
+    public:
+        static const size_t CHUNK = 1024*1024;
+
+        /*
+         * The arena of the innermost ScopedArena on this thread, nullptr
+         * outside of one.
+         */
+        static Arena*& current() {
+            static thread_local Arena* arena = nullptr;
+            return arena;
+        }
+
+        explicit Arena(size_t chunk_size) : refs(OPEN), live(0),
+        chunk_size(chunk_size), owner(std::this_thread::get_id()),
+        closed(false), chunks(), chunk_begin(nullptr), top(nullptr),
+        end(nullptr) {}
+
+        /*
+         * A block of bytes starting at a multiple of align, preceded by
+         * header_size bytes. The last pointer of the header belongs to the
+         * arena, the caller may use the rest. Called only by the thread
+         * that owns the arena.
+         */
+        void* allocate(size_t bytes, size_t align, size_t header_size) {
+            char* start = top;
+            char* block = top == nullptr ? nullptr :
+                          alignUp(top + header_size, align);
+            if (block == nullptr || block > end ||
+                bytes > (size_t)(end - block)) {
+                size_t size = bytes + align + header_size;
+                size = size < chunk_size ? chunk_size : size;
+                char* chunk = static_cast<char*>(std::malloc(size));
+                if (chunk == nullptr) throw std::bad_alloc();
+                try {
+                    chunks.push_back(chunk);
+                }
+                catch (...) {
+                    std::free(chunk);
+                    throw;
+                }
+                chunk_begin = chunk;
+                end = chunk + size;
+                start = chunk;
+                block = alignUp(start + header_size, align);
+            }
+            live++;
+            reinterpret_cast<char**>(block)[-1] = start;
+            top = block + bytes;
+            return block;
+        }
+
+        /*
+         * Frees a block returned by allocate. The last block of the current
+         * chunk gives its memory back, header and padding included.
+         */
+        void release(void* block, size_t bytes) {
+            if (std::this_thread::get_id() == owner && !closed) {
+                char* start = reinterpret_cast<char**>(block)[-1];
+                if (static_cast<char*>(block) + bytes == top &&
+                    start >= chunk_begin) {
+                    top = start;
+                }
+                live--;
+                return;
+            }
+            unref(1);
+        }
+
+        /*
+         * Ends the scope. Called by the owner thread.
+         */
+        void close() {
+            closed = true;
+            unref(OPEN - live);
+        }
+
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+    private:
+        /*
+         * While the scope runs the owner thread counts its blocks in live,
+         * without atomics, and blocks freed by other threads are taken off
+         * OPEN in refs. close() moves live over, from then on refs counts
+         * the blocks still in use.
+         */
+        static const size_t OPEN = (size_t)-1/2;
+        std::atomic<size_t> refs;
+        size_t live;
+        size_t chunk_size;
+        std::thread::id owner;
+        bool closed;
+        std::vector<char*> chunks;
+        char* chunk_begin;
+        char* top;
+        char* end;
+
+        ~Arena() {
+            for (char* chunk : chunks) {
+                std::free(chunk);
+            }
+        }
+
+        static char* alignUp(char* p, size_t align) {
+            uintptr_t n = reinterpret_cast<uintptr_t>(p);
+            return reinterpret_cast<char*>((n + align - 1) &
+                                           ~(uintptr_t)(align - 1));
+        }
+
+        void unref(size_t n) {
+            if (refs.fetch_sub(n, std::memory_order_acq_rel) == n) {
+                delete this;
+            }
+        }
+    };
+
+    /*
+     * While a ScopedArena is alive, vectors and matrices created by its
+     * thread take their buffers from one arena instead of the global heap:
+     *
+     *     {
+     *         MtmMath::ScopedArena arena;
+     *         MtmMat<double> r=a*b*c;  //a*b comes from the arena
+     *         ...
+     *     } //the memory goes back to the heap here
+     *
+     * Scopes nest, the innermost one is used. Threads of the thread pool
+     * keep using the heap.
+     */
+    class ScopedArena {
+    public:
+        explicit ScopedArena(size_t chunk_size = Arena::CHUNK) :
+        arena(new Arena(chunk_size)), outer(Arena::current()) {
+            Arena::current() = arena;
+        }
+        ~ScopedArena() {
+            Arena::current() = outer;
+            arena->close();
+        }
+        ScopedArena(const ScopedArena&) = delete;
+        ScopedArena& operator=(const ScopedArena&) = delete;
+
+    private:
+        Arena* arena;
+        Arena* outer;
+    };
+
+}
+
+#endif //EX3_MTMARENA_H
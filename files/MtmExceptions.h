@@ -5,6 +5,7 @@
 #include <string>
 #include <iostream>
 #include "Auxilaries.h"
+#include "MtmStats.h"
 using std::string;
 using std::to_string;
 namespace MtmMath {
@@ -20,6 +21,9 @@ namespace MtmMath {
          */
         class IllegalInitialization : public MtmExceptions {
         public:
+            IllegalInitialization() {
+                MTM_STATS_EXCEPTION(ILLEGAL_INITIALIZATION);
+            }
             const char* what() const noexcept override {
                 return "MtmError: Illegal initialization values";
             }
@@ -31,6 +35,9 @@ namespace MtmMath {
          */
         class OutOfMemory : public MtmExceptions {
         public:
+            OutOfMemory() {
+                MTM_STATS_EXCEPTION(OUT_OF_MEMORY);
+            }
             const char* what() const noexcept override{
                 return "MtmError: Out of memory";
             }
@@ -49,6 +56,7 @@ namespace MtmMath {
         public:
             DimensionMismatch(Dimensions d1,Dimensions d2) :
             dim1(d1), dim2(d2) {
+                MTM_STATS_EXCEPTION(DIMENSION_MISMATCH);
                 error = "MtmError: Dimension mismatch: " + dim1.to_string()
                         + " " + dim2.to_string();
             }
@@ -70,6 +78,7 @@ namespace MtmMath {
         public:
             ChangeMatFail(Dimensions d1,Dimensions d2) :
                     dim1(d1), dim2(d2){
+                MTM_STATS_EXCEPTION(CHANGE_MAT_FAIL);
                 error="MtmError: Change matrix shape failed from " +
                       dim1.to_string() + " to " + dim2.to_string();
             }
@@ -85,10 +94,44 @@ namespace MtmMath {
          */
         class AccessIllegalElement : public MtmExceptions {
         public:
+            AccessIllegalElement() {
+                MTM_STATS_EXCEPTION(ACCESS_ILLEGAL_ELEMENT);
+            }
             const char* what() const noexcept override{
                 return "MtmError: Attempt access to illegal element";
             }
         };
+
+        /*
+         * Exception for a matrix file that can't be written or read, or
+         * isn't a valid file for the requested matrix, outputs "MtmError:
+         * File error: <path>: <reason>" in what() class function
+         */
+        class FileError : public MtmExceptions {
+            string error;
+        public:
+            FileError(const string& path, const string& reason) {
+                MTM_STATS_EXCEPTION(FILE_ERROR);
+                error = "MtmError: File error: " + path + ": " + reason;
+            }
+            const char* what() const noexcept override {
+                return error.data();
+            }
+        };
+
+        /*
+         * Exception for solving with or inverting a singular matrix, outputs
+         * "MtmError: Singular matrix" in what() class function
+         */
+        class SingularMatrix : public MtmExceptions {
+        public:
+            SingularMatrix() {
+                MTM_STATS_EXCEPTION(SINGULAR_MATRIX);
+            }
+            const char* what() const noexcept override {
+                return "MtmError: Singular matrix";
+            }
+        };
     }
 }
 
@@ -0,0 +1,404 @@
+#ifndef EX3_MTMEXPR_H
+#define EX3_MTMEXPR_H
+
+#include <algorithm>
+#include <type_traits>
+#include "MtmExceptions.h"
+#include "Auxilaries.h"
+#include "MtmSimd.h"
+
+using std::size_t;
+
+namespace MtmMath {
+    template <typename T> class MtmVec;
+    template <typename T> class MtmMat;
+
+    /*
+     * Base of everything that can take part in element-wise arithmetic:
+     * vectors, matrices and the lazy expression nodes built from them.
+     * Adding, subtracting, negating or scaling them returns a node instead
+     * of a new object; the whole expression is computed in a single pass
+     * once it is assigned to (or used to construct) an MtmVec or MtmMat.
+     *
+     * A node only refers to the vectors and matrices it was built from, so
+     * it must not outlive them.
+     */
+    template <typename E>
+    class MtmExpr {
+    public:
+        const E& self() const {
+            return static_cast<const E&>(*this);
+        }
+    };
+
+    /*
+     * How an expression is held inside a node: vectors and matrices by
+     * reference, nodes (small temporaries) by value. is_vec tells whether
+     * the expression evaluates to a vector or to a matrix.
+     */
+    template <typename E>
+    struct ExprTraits {
+        enum { is_leaf = false, is_vec = E::IS_VEC };
+        typedef E stored;
+    };
+
+    template <typename T>
+    struct ExprTraits<MtmVec<T> > {
+        enum { is_leaf = true, is_vec = true };
+        typedef const MtmVec<T>& stored;
+    };
+
+    template <typename T>
+    struct ExprTraits<MtmMat<T> > {
+        enum { is_leaf = true, is_vec = false };
+        typedef const MtmMat<T>& stored;
+    };
+
+    /*
+     * Type an expression evaluates to.
+     */
+    template <typename E, bool IsVec = ExprTraits<E>::is_vec>
+    struct ExprResult {
+        typedef MtmMat<typename E::value_type> type;
+    };
+
+    template <typename E>
+    struct ExprResult<E, true> {
+        typedef MtmVec<typename E::value_type> type;
+    };
+
+    /*
+     * Element (row,col) of a node. Vectors and matrices have their own
+     * overloads next to their classes.
+     */
+    template <typename E>
+    typename E::value_type exprAt(const E& expr, size_t row, size_t col) {
+        return expr.at(row, col);
+    }
+
+    struct ExprAdd {
+        template <typename T>
+        static T apply(const T& a, const T& b) { return a + b; }
+    };
+
+    struct ExprSub {
+        template <typename T>
+        static T apply(const T& a, const T& b) { return a - b; }
+    };
+
+    struct ExprMul {
+        template <typename T>
+        static T apply(const T& a, const T& b) { return a * b; }
+    };
+
+    /*
+     * 1x1 vectors have the same dimensions whichever way they stand, so
+     * vector operands must also agree on that, as += requires.
+     */
+    template <typename L, typename R>
+    bool sameOrientation(const L& l, const R& r, std::true_type) {
+        return l.isColVector()==r.isColVector();
+    }
+
+    template <typename L, typename R>
+    bool sameOrientation(const L&, const R&, std::false_type) {
+        return true;
+    }
+
+    /*
+     * Common part of the expression nodes: shape queries and evaluation.
+     */
+    template <typename Node, typename T>
+    class MtmExprNode : public MtmExpr<Node> {
+    public:
+        typedef T value_type;
+        int getRow() const {
+            return (int)this->self().getDim().getRow();
+        }
+        int getCol() const {
+            return (int)this->self().getDim().getCol();
+        }
+        /*
+         * Computes the expression into a new vector or matrix.
+         */
+        template <typename N = Node>
+        typename ExprResult<N>::type eval() const {
+            return typename ExprResult<N>::type(this->self());
+        }
+    };
+
+    /*
+     * Element-wise l op r. Both operands must have the same dimensions,
+     * otherwise DimensionMismatch is thrown when the node is built.
+     * isColVector() is only there for vector expressions.
+     */
+    template <typename Op, typename L, typename R>
+    class MtmBinaryExpr :
+            public MtmExprNode<MtmBinaryExpr<Op, L, R>,
+                               typename L::value_type> {
+        typename ExprTraits<L>::stored l;
+        typename ExprTraits<R>::stored r;
+    public:
+        enum { IS_VEC = ExprTraits<L>::is_vec && ExprTraits<R>::is_vec };
+        MtmBinaryExpr(const L& l_t, const R& r_t) : l(l_t), r(r_t) {
+            if (l.getDim()!=r.getDim()||!sameOrientation(l, r,
+                    std::integral_constant<bool, IS_VEC>())) {
+                throw MtmExceptions::DimensionMismatch(l.getDim(),
+                                                       r.getDim());
+            }
+        }
+        Dimensions getDim() const {
+            return l.getDim();
+        }
+        bool isColVector() const {
+            return l.isColVector();
+        }
+        const L& left() const { return l; }
+        const R& right() const { return r; }
+        typename L::value_type at(size_t row, size_t col) const {
+            return Op::apply(exprAt(l, row, col), exprAt(r, row, col));
+        }
+    };
+
+    /*
+     * Element-wise e op val, or val op e when ScalarFirst is set.
+     */
+    template <typename Op, typename E, bool ScalarFirst>
+    class MtmScalarExpr :
+            public MtmExprNode<MtmScalarExpr<Op, E, ScalarFirst>,
+                               typename E::value_type> {
+        typedef typename E::value_type T;
+        typename ExprTraits<E>::stored e;
+        T val;
+    public:
+        enum { IS_VEC = ExprTraits<E>::is_vec };
+        MtmScalarExpr(const E& e_t, const T& val_t) : e(e_t), val(val_t) {}
+        const E& operand() const { return e; }
+        const T& scalar() const { return val; }
+        Dimensions getDim() const {
+            return e.getDim();
+        }
+        bool isColVector() const {
+            return e.isColVector();
+        }
+        T at(size_t row, size_t col) const {
+            return ScalarFirst ? Op::apply(val, exprAt(e, row, col)) :
+                   Op::apply(exprAt(e, row, col), val);
+        }
+    };
+
+    /*
+     * Element-wise -e.
+     */
+    template <typename E>
+    class MtmNegateExpr :
+            public MtmExprNode<MtmNegateExpr<E>, typename E::value_type> {
+        typename ExprTraits<E>::stored e;
+    public:
+        enum { IS_VEC = ExprTraits<E>::is_vec };
+        explicit MtmNegateExpr(const E& e_t) : e(e_t) {}
+        const E& operand() const { return e; }
+        Dimensions getDim() const {
+            return e.getDim();
+        }
+        bool isColVector() const {
+            return e.isColVector();
+        }
+        typename E::value_type at(size_t row, size_t col) const {
+            return -exprAt(e, row, col);
+        }
+    };
+
+                        ////////Kernel evaluation////////
+
+    /*
+     * The elements of an operand as one contiguous array in row major
+     * order, or nullptr if they aren't stored that way. Vectors and
+     * matrices have their own overloads next to their classes.
+     */
+    template <typename E>
+    const typename E::value_type* exprData(const E&) {
+        return nullptr;
+    }
+
+    /*
+     * A single +, - or scalar operation, or a negation, of operands stored
+     * contiguously is computed by the element-wise kernels of MtmSimd.h
+     * into the n elements at dst, instead of element by element. These
+     * return false without touching dst when the expression isn't one.
+     */
+    template <typename T, typename E>
+    bool exprKernel(T*, size_t, const E&) {
+        return false;
+    }
+
+    template <typename T>
+    void copyOperand(T* dst, const T* src, size_t n) {
+        if (dst != src) std::copy(src, src + n, dst);
+    }
+
+    template <typename T, typename ScalarFirst>
+    void scalarKernel(ExprAdd, ScalarFirst, T* dst, const T& val, size_t n) {
+        MtmKernels::addScalar(dst, val, n);
+    }
+
+    template <typename T>
+    void scalarKernel(ExprSub, std::false_type, T* dst, const T& val,
+                      size_t n) {
+        MtmKernels::subScalar(dst, val, n);
+    }
+
+    template <typename T>
+    void scalarKernel(ExprSub, std::true_type, T* dst, const T& val,
+                      size_t n) { //val-e is -e+val
+        MtmKernels::negateArray(dst, dst, n);
+        MtmKernels::addScalar(dst, val, n);
+    }
+
+    template <typename T, typename ScalarFirst>
+    void scalarKernel(ExprMul, ScalarFirst, T* dst, const T& val, size_t n) {
+        MtmKernels::mulScalar(dst, val, n);
+    }
+
+    template <typename T, typename Op, typename E, bool ScalarFirst>
+    bool exprKernel(T* dst, size_t n,
+                    const MtmScalarExpr<Op, E, ScalarFirst>& node) {
+        const T* src = exprData(node.operand());
+        if (src == nullptr) return false;
+        copyOperand(dst, src, n);
+        scalarKernel(Op(), std::integral_constant<bool, ScalarFirst>(), dst,
+                     node.scalar(), n);
+        return true;
+    }
+
+    template <typename T, typename E>
+    bool exprKernel(T* dst, size_t n, const MtmNegateExpr<E>& node) {
+        const T* src = exprData(node.operand());
+        if (src == nullptr) return false;
+        MtmKernels::negateArray(dst, src, n);
+        return true;
+    }
+
+    /*
+     * When dst is the right operand only (e+mat written into mat), copying
+     * the left one in would overwrite it, so the left one is added instead:
+     * l-r is computed as -r+l, which rounds the same.
+     */
+    template <typename T, typename L, typename R>
+    bool exprKernel(T* dst, size_t n,
+                    const MtmBinaryExpr<ExprAdd, L, R>& node) {
+        const T* l = exprData(node.left());
+        const T* r = exprData(node.right());
+        if (l == nullptr || r == nullptr) return false;
+        if (r == dst && l != dst) std::swap(l, r);
+        copyOperand(dst, l, n);
+        MtmKernels::addArray(dst, r, n);
+        return true;
+    }
+
+    template <typename T, typename L, typename R>
+    bool exprKernel(T* dst, size_t n,
+                    const MtmBinaryExpr<ExprSub, L, R>& node) {
+        const T* l = exprData(node.left());
+        const T* r = exprData(node.right());
+        if (l == nullptr || r == nullptr) return false;
+        if (r == dst && l != dst) {
+            MtmKernels::negateArray(dst, dst, n);
+            MtmKernels::addArray(dst, l, n);
+            return true;
+        }
+        copyOperand(dst, l, n);
+        MtmKernels::subArray(dst, r, n);
+        return true;
+    }
+
+                        ////////Operators////////
+
+    template <typename L, typename R>
+    MtmBinaryExpr<ExprAdd, L, R> operator+(const MtmExpr<L>& l,
+                                           const MtmExpr<R>& r) {
+        static_assert(std::is_same<typename L::value_type,
+                      typename R::value_type>::value, "element type mismatch");
+        return MtmBinaryExpr<ExprAdd, L, R>(l.self(), r.self());
+    }
+
+    template <typename L, typename R>
+    MtmBinaryExpr<ExprSub, L, R> operator-(const MtmExpr<L>& l,
+                                           const MtmExpr<R>& r) {
+        static_assert(std::is_same<typename L::value_type,
+                      typename R::value_type>::value, "element type mismatch");
+        return MtmBinaryExpr<ExprSub, L, R>(l.self(), r.self());
+    }
+
+    template <typename E>
+    MtmNegateExpr<E> operator-(const MtmExpr<E>& e) {
+        return MtmNegateExpr<E>(e.self());
+    }
+
+    template <typename E>
+    MtmScalarExpr<ExprAdd, E, false> operator+(const MtmExpr<E>& e,
+                                       const typename E::value_type& val) {
+        return MtmScalarExpr<ExprAdd, E, false>(e.self(), val);
+    }
+
+    template <typename E>
+    MtmScalarExpr<ExprAdd, E, true> operator+(
+            const typename E::value_type& val, const MtmExpr<E>& e) {
+        return MtmScalarExpr<ExprAdd, E, true>(e.self(), val);
+    }
+
+    template <typename E>
+    MtmScalarExpr<ExprSub, E, false> operator-(const MtmExpr<E>& e,
+                                       const typename E::value_type& val) {
+        return MtmScalarExpr<ExprSub, E, false>(e.self(), val);
+    }
+
+    template <typename E>
+    MtmScalarExpr<ExprSub, E, true> operator-(
+            const typename E::value_type& val, const MtmExpr<E>& e) {
+        return MtmScalarExpr<ExprSub, E, true>(e.self(), val);
+    }
+
+    template <typename E>
+    MtmScalarExpr<ExprMul, E, false> operator*(const MtmExpr<E>& e,
+                                       const typename E::value_type& val) {
+        return MtmScalarExpr<ExprMul, E, false>(e.self(), val);
+    }
+
+    template <typename E>
+    MtmScalarExpr<ExprMul, E, true> operator*(
+            const typename E::value_type& val, const MtmExpr<E>& e) {
+        return MtmScalarExpr<ExprMul, E, true>(e.self(), val);
+    }
+
+    /*
+     * Operands of a matrix product: matrices are used as they are, vectors
+     * and nodes are turned into matrices first.
+     */
+    template <typename T>
+    const MtmMat<T>& toMatrix(const MtmMat<T>& mat) {
+        return mat;
+    }
+
+    template <typename E>
+    MtmMat<typename E::value_type> toMatrix(const E& expr) {
+        return MtmMat<typename E::value_type>(expr);
+    }
+
+    /*
+     * Matrix product of any two expressions. It is not element-wise, so it
+     * is computed right away (see multiply in MtmMat.h).
+     */
+    template <typename L, typename R>
+    MtmMat<typename L::value_type> operator*(const MtmExpr<L>& l,
+                                             const MtmExpr<R>& r) {
+        static_assert(std::is_same<typename L::value_type,
+                      typename R::value_type>::value, "element type mismatch");
+        const MtmMat<typename L::value_type>& mat1 = toMatrix(l.self());
+        const MtmMat<typename R::value_type>& mat2 = toMatrix(r.self());
+        return multiply(mat1, mat2);
+    }
+
+}
+
+#endif //EX3_MTMEXPR_H
@@ -0,0 +1,810 @@
+#ifndef EX3_MTMGEMM_H
+#define EX3_MTMGEMM_H
+
+#include <vector>
+#include <algorithm>
+#include "MtmAllocator.h"
+#include "Complex.h"
+#include "MtmThreadPool.h"
+#include "MtmSimd.h"
+
+using std::size_t;
+using std::vector;
+
+namespace MtmMath {
+    namespace MtmKernels {
+        /*
+         * Blocking parameters of the portable matrix multiplication kernel
+         * (GemmKernel has the vector ones):
+         * MR x NR is the register tile computed by the micro kernel, an
+         * MC x KC block of the left operand is packed to stay in L2 and a
+         * KC x NR sliver of the right operand to stay in L1. NC bounds the
+         * packed right operand panel.
+         */
+        template <typename T>
+        struct GemmBlocking {
+            enum { MR = 4, NR = 4, MC = 64, KC = 256, NC = 1024 };
+        };
+
+        template <>
+        struct GemmBlocking<double> {
+            enum { MR = 4, NR = 8, MC = 128, KC = 256, NC = 2048 };
+        };
+
+        template <>
+        struct GemmBlocking<float> {
+            enum { MR = 4, NR = 16, MC = 128, KC = 256, NC = 2048 };
+        };
+
+        template <>
+        struct GemmBlocking<int> {
+            enum { MR = 4, NR = 16, MC = 128, KC = 256, NC = 2048 };
+        };
+
+        template <>
+        struct GemmBlocking<Complex> {
+            enum { MR = 2, NR = 8, MC = 64, KC = 128, NC = 1024 };
+        };
+
+        /*
+         * Products smaller than this many multiply-adds skip packing, the
+         * copies would cost more than they save.
+         */
+        const size_t GEMM_PACK_THRESHOLD = 32*32*32;
+
+        /*
+         * Products smaller than this many multiply-adds run on the calling
+         * thread only, dispatching them would cost more than it saves.
+         */
+        const size_t GEMM_PARALLEL_THRESHOLD = 128*128*128;
+
+        /*
+         * Start of row i of a packed n x n triangle, shifted so that element
+         * (i,j) is at index origin+j. Rows are stored one after the other,
+         * an upper triangle keeps columns i..n-1 of row i and a lower one
+         * columns 0..i, n(n+1)/2 elements in all.
+         */
+        inline size_t packedRowOrigin(size_t n, size_t i, bool upper) {
+            return upper ? i*n - i*(i - 1)/2 - i : i*(i + 1)/2;
+        }
+
+        /*
+         * Operands of the kernels below. Element (i,j) of an operand is
+         * row(i)[j*colStride()] for j in [colBegin(i),colEnd(i)) and a
+         * structural zero elsewhere, and the nonzeros of column j are all in rows
+         * [rowBegin(j),rowEnd(j)). The kernels skip everything outside these
+         * ranges.
+         */
+        template <typename T>
+        class DenseOperand {
+            const T* data;
+            size_t ld;
+            size_t rows;
+            size_t cols;
+        public:
+            DenseOperand(const T* data_t, size_t ld_t, size_t rows_t,
+                         size_t cols_t) :
+            data(data_t), ld(ld_t), rows(rows_t), cols(cols_t) {}
+            const T* row(size_t i) const { return data + i*ld; }
+            size_t colStride() const { return 1; }
+            size_t colBegin(size_t) const { return 0; }
+            size_t colEnd(size_t) const { return cols; }
+            size_t rowBegin(size_t) const { return 0; }
+            size_t rowEnd(size_t) const { return rows; }
+            T at(size_t i, size_t j) const { return data[i*ld + j]; }
+        };
+
+        /*
+         * A rows x cols matrix stored column by column, ld apart, e.g. the
+         * transpose of a row major buffer read without copying it.
+         */
+        template <typename T>
+        class TransposedOperand {
+            const T* data;
+            size_t ld;
+            size_t rows;
+            size_t cols;
+        public:
+            TransposedOperand(const T* data_t, size_t ld_t, size_t rows_t,
+                              size_t cols_t) :
+            data(data_t), ld(ld_t), rows(rows_t), cols(cols_t) {}
+            const T* row(size_t i) const { return data + i; }
+            size_t colStride() const { return ld; }
+            size_t colBegin(size_t) const { return 0; }
+            size_t colEnd(size_t) const { return cols; }
+            size_t rowBegin(size_t) const { return 0; }
+            size_t rowEnd(size_t) const { return rows; }
+            T at(size_t i, size_t j) const { return data[j*ld + i]; }
+        };
+
+        /*
+         * An n x n triangle stored packed (see packedRowOrigin).
+         */
+        template <typename T>
+        class TriangleOperand {
+            const T* data;
+            size_t n;
+            bool upper;
+        public:
+            TriangleOperand(const T* data_t, size_t n_t, bool upper_t) :
+            data(data_t), n(n_t), upper(upper_t) {}
+            const T* row(size_t i) const {
+                return data + packedRowOrigin(n, i, upper);
+            }
+            size_t colStride() const { return 1; }
+            size_t colBegin(size_t i) const { return upper ? i : 0; }
+            size_t colEnd(size_t i) const { return upper ? n : i + 1; }
+            size_t rowBegin(size_t j) const { return upper ? 0 : j; }
+            size_t rowEnd(size_t j) const { return upper ? j + 1 : n; }
+            T at(size_t i, size_t j) const {
+                return (j >= colBegin(i) && j < colEnd(i)) ? row(i)[j] : T();
+            }
+        };
+
+        /*
+         * Copies the mc x kc block of a starting at (i0,p0) into MR row
+         * slivers, each stored k-major so the micro kernel reads it
+         * sequentially. Rows past mc are padded with zeros.
+         */
+        template <size_t MR, typename T, typename A>
+        void packA(const A& a, size_t i0, size_t p0, size_t mc, size_t kc,
+                   T* dest) {
+            for (size_t i = 0; i < mc; i += MR) {
+                for (size_t p = 0; p < kc; p++) {
+                    for (size_t r = 0; r < MR; r++) {
+                        *dest++ = (i + r < mc) ? a.at(i0 + i + r, p0 + p) :
+                                  T();
+                    }
+                }
+            }
+        }
+
+        /*
+         * Copies the kc x nc block of b starting at (p0,j0) into NR column
+         * slivers, each stored k-major. Columns past nc are padded with
+         * zeros.
+         */
+        template <size_t NR, typename T, typename B>
+        void packB(const B& b, size_t p0, size_t j0, size_t kc, size_t nc,
+                   T* dest) {
+            for (size_t j = 0; j < nc; j += NR) {
+                for (size_t p = 0; p < kc; p++) {
+                    for (size_t r = 0; r < NR; r++) {
+                        *dest++ = (j + r < nc) ? b.at(p0 + p, j0 + j + r) :
+                                  T();
+                    }
+                }
+            }
+        }
+
+        /*
+         * Register micro kernel: accumulates a packed MR sliver of a times a
+         * packed NR sliver of b into an MR x NR tile, then adds the valid
+         * mr x nr part of it to c.
+         */
+        template <typename T>
+        void microKernel(size_t kc, const T* a, const T* b, T* c, size_t ldc,
+                         size_t mr, size_t nr) {
+            const size_t MR = GemmBlocking<T>::MR;
+            const size_t NR = GemmBlocking<T>::NR;
+            T acc[GemmBlocking<T>::MR * GemmBlocking<T>::NR];
+            for (size_t i = 0; i < MR*NR; i++) {
+                acc[i] = T();
+            }
+            for (size_t p = 0; p < kc; p++) {
+                for (size_t i = 0; i < MR; i++) {
+                    const T a_ip = a[i];
+                    for (size_t j = 0; j < NR; j++) {
+                        acc[i*NR + j] += a_ip * b[j];
+                    }
+                }
+                a += MR;
+                b += NR;
+            }
+            for (size_t i = 0; i < mr; i++) {
+                for (size_t j = 0; j < nr; j++) {
+                    c[i*ldc + j] += acc[i*NR + j];
+                }
+            }
+        }
+
+        /*
+         * Complex slivers are packed split: for every k the MR (or NR) real
+         * parts, then the imaginary parts, so the micro kernel below works on
+         * plain arrays of doubles the compiler vectorizes, with no shuffling
+         * of {re, im} pairs.
+         */
+        template <size_t MR, typename A>
+        void packA(const A& a, size_t i0, size_t p0, size_t mc, size_t kc,
+                   Complex* dest_t) {
+            double* dest = reinterpret_cast<double*>(dest_t);
+            for (size_t i = 0; i < mc; i += MR) {
+                for (size_t p = 0; p < kc; p++) {
+                    for (size_t r = 0; r < MR; r++) {
+                        Complex x = (i + r < mc) ? a.at(i0 + i + r, p0 + p) :
+                                    Complex();
+                        dest[r] = x.real();
+                        dest[MR + r] = x.imag();
+                    }
+                    dest += 2*MR;
+                }
+            }
+        }
+
+        template <size_t NR, typename B>
+        void packB(const B& b, size_t p0, size_t j0, size_t kc, size_t nc,
+                   Complex* dest_t) {
+            double* dest = reinterpret_cast<double*>(dest_t);
+            for (size_t j = 0; j < nc; j += NR) {
+                for (size_t p = 0; p < kc; p++) {
+                    for (size_t r = 0; r < NR; r++) {
+                        Complex x = (j + r < nc) ? b.at(p0 + p, j0 + j + r) :
+                                    Complex();
+                        dest[r] = x.real();
+                        dest[NR + r] = x.imag();
+                    }
+                    dest += 2*NR;
+                }
+            }
+        }
+
+        inline void microKernel(size_t kc, const Complex* a_t,
+                                const Complex* b_t, Complex* c, size_t ldc,
+                                size_t mr, size_t nr) {
+            const size_t MR = GemmBlocking<Complex>::MR;
+            const size_t NR = GemmBlocking<Complex>::NR;
+            const double* a = reinterpret_cast<const double*>(a_t);
+            const double* b = reinterpret_cast<const double*>(b_t);
+            double acc_re[MR*NR] = {};
+            double acc_im[MR*NR] = {};
+            for (size_t p = 0; p < kc; p++) {
+                for (size_t i = 0; i < MR; i++) {
+                    const double a_re = a[i];
+                    const double a_im = a[MR + i];
+                    for (size_t j = 0; j < NR; j++) {
+                        acc_re[i*NR + j] += a_re*b[j] - a_im*b[NR + j];
+                        acc_im[i*NR + j] += a_re*b[NR + j] + a_im*b[j];
+                    }
+                }
+                a += 2*MR;
+                b += 2*NR;
+            }
+            for (size_t i = 0; i < mr; i++) {
+                for (size_t j = 0; j < nr; j++) {
+                    c[i*ldc + j] += Complex(acc_re[i*NR + j],
+                                            acc_im[i*NR + j]);
+                }
+            }
+        }
+
+#ifdef MTM_SIMD_X86
+/*
+ * Vector micro kernels shared by the instruction sets, expanded inside each
+ * target region like the element-wise kernels of MtmSimd.h. R is a register
+ * traits type of the region. The MR x NV*R::WIDTH tile is held in MR*NV
+ * accumulator registers; every step loads NV vectors of the b sliver,
+ * broadcasts MR elements of the a sliver and issues MR*NV fused
+ * multiply-adds. The loops over the tile are unrolled so the accumulators
+ * stay in registers.
+ */
+#define MTM_GEMM_KERNELS                                                      \
+        template <typename R, size_t MR, size_t NV>                           \
+        void microKernel(size_t kc, const typename R::scalar* a,              \
+                         const typename R::scalar* b,                         \
+                         typename R::scalar* c, size_t ldc, size_t mr,        \
+                         size_t nr) {                                         \
+            typedef typename R::scalar S;                                     \
+            typedef typename R::reg Reg;                                      \
+            const size_t NR = NV*R::WIDTH;                                    \
+            Reg acc[MR][NV];                                                  \
+            _Pragma("GCC unroll 16")                                          \
+            for (size_t i = 0; i < MR; i++) {                                 \
+                _Pragma("GCC unroll 4")                                       \
+                for (size_t j = 0; j < NV; j++) {                             \
+                    acc[i][j] = R::zero();                                    \
+                }                                                             \
+            }                                                                 \
+            for (size_t p = 0; p < kc; p++) {                                 \
+                Reg bv[NV];                                                   \
+                _Pragma("GCC unroll 4")                                       \
+                for (size_t j = 0; j < NV; j++) {                             \
+                    bv[j] = R::load(b + j*R::WIDTH);                          \
+                }                                                             \
+                _Pragma("GCC unroll 16")                                      \
+                for (size_t i = 0; i < MR; i++) {                             \
+                    Reg av = R::set1(a[i]);                                   \
+                    _Pragma("GCC unroll 4")                                   \
+                    for (size_t j = 0; j < NV; j++) {                         \
+                        acc[i][j] = R::fmadd(av, bv[j], acc[i][j]);           \
+                    }                                                         \
+                }                                                             \
+                a += MR;                                                      \
+                b += NR;                                                      \
+            }                                                                 \
+            S tile[MR*NR];                                                    \
+            _Pragma("GCC unroll 16")                                          \
+            for (size_t i = 0; i < MR; i++) {                                 \
+                _Pragma("GCC unroll 4")                                       \
+                for (size_t j = 0; j < NV; j++) {                             \
+                    R::store(tile + i*NR + j*R::WIDTH, acc[i][j]);            \
+                }                                                             \
+            }                                                                 \
+            for (size_t i = 0; i < mr; i++) {                                 \
+                for (size_t j = 0; j < nr; j++) {                             \
+                    c[i*ldc + j] += tile[i*NR + j];                           \
+                }                                                             \
+            }                                                                 \
+        }                                                                     \
+                                                                              \
+        /*                                                                    \
+         * Complex slivers packed split (see packA): the real and imaginary  \
+         * parts of the tile are accumulated separately, four multiply-adds  \
+         * per pair of vectors.                                               \
+         */                                                                   \
+        template <typename R, size_t MR, size_t NV>                           \
+        void microKernelSplit(size_t kc, const double* a, const double* b,    \
+                              Complex* c, size_t ldc, size_t mr, size_t nr) { \
+            typedef typename R::reg Reg;                                      \
+            const size_t NR = NV*R::WIDTH;                                    \
+            Reg re[MR][NV];                                                   \
+            Reg im[MR][NV];                                                   \
+            _Pragma("GCC unroll 16")                                          \
+            for (size_t i = 0; i < MR; i++) {                                 \
+                _Pragma("GCC unroll 4")                                       \
+                for (size_t j = 0; j < NV; j++) {                             \
+                    re[i][j] = R::zero();                                     \
+                    im[i][j] = R::zero();                                     \
+                }                                                             \
+            }                                                                 \
+            for (size_t p = 0; p < kc; p++) {                                 \
+                Reg b_re[NV];                                                 \
+                Reg b_im[NV];                                                 \
+                _Pragma("GCC unroll 4")                                       \
+                for (size_t j = 0; j < NV; j++) {                             \
+                    b_re[j] = R::load(b + j*R::WIDTH);                        \
+                    b_im[j] = R::load(b + NR + j*R::WIDTH);                   \
+                }                                                             \
+                _Pragma("GCC unroll 16")                                      \
+                for (size_t i = 0; i < MR; i++) {                             \
+                    Reg a_re = R::set1(a[i]);                                 \
+                    Reg a_im = R::set1(a[MR + i]);                            \
+                    _Pragma("GCC unroll 4")                                   \
+                    for (size_t j = 0; j < NV; j++) {                         \
+                        re[i][j] = R::fmadd(a_re, b_re[j], re[i][j]);         \
+                        re[i][j] = R::fnmadd(a_im, b_im[j], re[i][j]);        \
+                        im[i][j] = R::fmadd(a_re, b_im[j], im[i][j]);         \
+                        im[i][j] = R::fmadd(a_im, b_re[j], im[i][j]);         \
+                    }                                                         \
+                }                                                             \
+                a += 2*MR;                                                    \
+                b += 2*NR;                                                    \
+            }                                                                 \
+            double tile_re[MR*NR];                                            \
+            double tile_im[MR*NR];                                            \
+            _Pragma("GCC unroll 16")                                          \
+            for (size_t i = 0; i < MR; i++) {                                 \
+                _Pragma("GCC unroll 4")                                       \
+                for (size_t j = 0; j < NV; j++) {                             \
+                    R::store(tile_re + i*NR + j*R::WIDTH, re[i][j]);          \
+                    R::store(tile_im + i*NR + j*R::WIDTH, im[i][j]);          \
+                }                                                             \
+            }                                                                 \
+            for (size_t i = 0; i < mr; i++) {                                 \
+                for (size_t j = 0; j < nr; j++) {                             \
+                    c[i*ldc + j] += Complex(tile_re[i*NR + j],                \
+                                            tile_im[i*NR + j]);               \
+                }                                                             \
+            }                                                                 \
+        }
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+        namespace Avx2Fma {
+            template <typename T> struct FmaReg;
+
+            template <> struct FmaReg<double> {
+                typedef double scalar;
+                typedef __m256d reg;
+                enum { WIDTH = 4 };
+                static reg zero() { return _mm256_setzero_pd(); }
+                static reg load(const double* p) { return _mm256_loadu_pd(p); }
+                static void store(double* p, reg a) { _mm256_storeu_pd(p, a); }
+                static reg set1(double v) { return _mm256_set1_pd(v); }
+                static reg fmadd(reg a, reg b, reg c) {       //c+a*b
+                    return _mm256_fmadd_pd(a, b, c);
+                }
+                static reg fnmadd(reg a, reg b, reg c) {      //c-a*b
+                    return _mm256_fnmadd_pd(a, b, c);
+                }
+            };
+
+            template <> struct FmaReg<float> {
+                typedef float scalar;
+                typedef __m256 reg;
+                enum { WIDTH = 8 };
+                static reg zero() { return _mm256_setzero_ps(); }
+                static reg load(const float* p) { return _mm256_loadu_ps(p); }
+                static void store(float* p, reg a) { _mm256_storeu_ps(p, a); }
+                static reg set1(float v) { return _mm256_set1_ps(v); }
+                static reg fmadd(reg a, reg b, reg c) {
+                    return _mm256_fmadd_ps(a, b, c);
+                }
+                static reg fnmadd(reg a, reg b, reg c) {
+                    return _mm256_fnmadd_ps(a, b, c);
+                }
+            };
+
+            MTM_GEMM_KERNELS
+        }
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+        namespace Avx512 {
+            template <typename T> struct FmaReg;
+
+            template <> struct FmaReg<double> {
+                typedef double scalar;
+                typedef __m512d reg;
+                enum { WIDTH = 8 };
+                static reg zero() { return _mm512_setzero_pd(); }
+                static reg load(const double* p) { return _mm512_loadu_pd(p); }
+                static void store(double* p, reg a) { _mm512_storeu_pd(p, a); }
+                static reg set1(double v) { return _mm512_set1_pd(v); }
+                static reg fmadd(reg a, reg b, reg c) {
+                    return _mm512_fmadd_pd(a, b, c);
+                }
+                static reg fnmadd(reg a, reg b, reg c) {
+                    return _mm512_fnmadd_pd(a, b, c);
+                }
+            };
+
+            template <> struct FmaReg<float> {
+                typedef float scalar;
+                typedef __m512 reg;
+                enum { WIDTH = 16 };
+                static reg zero() { return _mm512_setzero_ps(); }
+                static reg load(const float* p) { return _mm512_loadu_ps(p); }
+                static void store(float* p, reg a) { _mm512_storeu_ps(p, a); }
+                static reg set1(float v) { return _mm512_set1_ps(v); }
+                static reg fmadd(reg a, reg b, reg c) {
+                    return _mm512_fmadd_ps(a, b, c);
+                }
+                static reg fnmadd(reg a, reg b, reg c) {
+                    return _mm512_fnmadd_ps(a, b, c);
+                }
+            };
+
+            MTM_GEMM_KERNELS
+        }
+#pragma GCC pop_options
+
+#undef MTM_GEMM_KERNELS
+#endif
+
+        /*
+         * Instruction set the matrix multiplication kernels run on: the one
+         * of the element-wise kernels (simdLevel), except that the AVX2
+         * kernels also need FMA. SSE2 has no kernels of its own.
+         */
+        inline SimdLevel gemmLevel() {
+            SimdLevel level = simdLevel();
+#ifdef MTM_SIMD_X86
+            static const bool fma = __builtin_cpu_supports("fma");
+            if (level == SIMD_AVX2 && !fma) return SIMD_SCALAR;
+#endif
+            return level < SIMD_AVX2 ? SIMD_SCALAR : level;
+        }
+
+        /*
+         * Micro kernel of the products of T on instruction set L, with its
+         * blocking: MR..NC as in GemmBlocking and run() called like
+         * microKernel. MR x NR is sized to the register file: NR is a whole
+         * number of vectors, and the accumulators plus the b vectors and a
+         * broadcast fill it without spilling. The primary template is the
+         * portable kernel.
+         */
+        template <typename T, SimdLevel L>
+        struct GemmKernel : GemmBlocking<T> {
+            static void run(size_t kc, const T* a, const T* b, T* c,
+                            size_t ldc, size_t mr, size_t nr) {
+                microKernel(kc, a, b, c, ldc, mr, nr);
+            }
+        };
+
+#ifdef MTM_SIMD_X86
+        template <>
+        struct GemmKernel<double, SIMD_AVX2> {       //12 of 16 registers
+            enum { MR = 6, NR = 8, MC = 96, KC = 256, NC = 2048 };
+            static void run(size_t kc, const double* a, const double* b,
+                            double* c, size_t ldc, size_t mr, size_t nr) {
+                Avx2Fma::microKernel<Avx2Fma::FmaReg<double>, MR, 2>(kc, a,
+                                     b, c, ldc, mr, nr);
+            }
+        };
+
+        template <>
+        struct GemmKernel<float, SIMD_AVX2> {
+            enum { MR = 6, NR = 16, MC = 96, KC = 256, NC = 2048 };
+            static void run(size_t kc, const float* a, const float* b,
+                            float* c, size_t ldc, size_t mr, size_t nr) {
+                Avx2Fma::microKernel<Avx2Fma::FmaReg<float>, MR, 2>(kc, a, b,
+                                     c, ldc, mr, nr);
+            }
+        };
+
+        template <>
+        struct GemmKernel<Complex, SIMD_AVX2> {      //12 of 16 registers
+            enum { MR = 6, NR = 4, MC = 48, KC = 128, NC = 1024 };
+            static void run(size_t kc, const Complex* a, const Complex* b,
+                            Complex* c, size_t ldc, size_t mr, size_t nr) {
+                Avx2Fma::microKernelSplit<Avx2Fma::FmaReg<double>, MR, 1>(kc,
+                        reinterpret_cast<const double*>(a),
+                        reinterpret_cast<const double*>(b), c, ldc, mr, nr);
+            }
+        };
+
+        template <>
+        struct GemmKernel<double, SIMD_AVX512> {     //24 of 32 registers
+            enum { MR = 12, NR = 16, MC = 144, KC = 256, NC = 2048 };
+            static void run(size_t kc, const double* a, const double* b,
+                            double* c, size_t ldc, size_t mr, size_t nr) {
+                Avx512::microKernel<Avx512::FmaReg<double>, MR, 2>(kc, a, b,
+                                    c, ldc, mr, nr);
+            }
+        };
+
+        template <>
+        struct GemmKernel<float, SIMD_AVX512> {
+            enum { MR = 12, NR = 32, MC = 144, KC = 256, NC = 2048 };
+            static void run(size_t kc, const float* a, const float* b,
+                            float* c, size_t ldc, size_t mr, size_t nr) {
+                Avx512::microKernel<Avx512::FmaReg<float>, MR, 2>(kc, a, b, c,
+                                    ldc, mr, nr);
+            }
+        };
+
+        template <>
+        struct GemmKernel<Complex, SIMD_AVX512> {    //24 of 32 registers
+            enum { MR = 6, NR = 16, MC = 96, KC = 128, NC = 1024 };
+            static void run(size_t kc, const Complex* a, const Complex* b,
+                            Complex* c, size_t ldc, size_t mr, size_t nr) {
+                Avx512::microKernelSplit<Avx512::FmaReg<double>, MR, 2>(kc,
+                        reinterpret_cast<const double*>(a),
+                        reinterpret_cast<const double*>(b), c, ldc, mr, nr);
+            }
+        };
+#endif
+
+        /*
+         * Element types with vector micro kernels.
+         */
+        template <typename T> struct HasGemmKernels { enum { value = false }; };
+        template <> struct HasGemmKernels<double> { enum { value = true }; };
+        template <> struct HasGemmKernels<float> { enum { value = true }; };
+        template <> struct HasGemmKernels<Complex> { enum { value = true }; };
+
+        /*
+         * Unblocked version of gemm used for small products.
+         */
+        template <typename T, typename A, typename B>
+        void gemmSmall(const A& a, const B& b, T* c, size_t ldc, size_t i0,
+                       size_t m, size_t j0, size_t n) {
+            const size_t a_stride = a.colStride();
+            const size_t b_stride = b.colStride();
+            for (size_t i = i0; i < i0 + m; i++) {
+                const T* a_row = a.row(i);
+                T* c_row = c + i*ldc;
+                for (size_t p = a.colBegin(i); p < a.colEnd(i); p++) {
+                    const T a_ip = a_row[p*a_stride];
+                    const T* b_row = b.row(p);
+                    size_t j_end = std::min(b.colEnd(p), j0 + n);
+                    for (size_t j = std::max(b.colBegin(p), j0); j < j_end;
+                         j++) {
+                        c_row[j] += a_ip * b_row[j*b_stride];
+                    }
+                }
+            }
+        }
+
+        /*
+         * Matrix multiplication on operands: adds rows [i0,i0+m) times
+         * columns [j0,j0+n) of a*b to the same part of the row major c,
+         * where a has k columns. Blocks of a and b that hold only
+         * structural zeros are skipped, and the depth of every micro kernel
+         * call is cut down to where both slivers can be nonzero, so products
+         * with a triangle do about half the work. K is the micro kernel
+         * (GemmKernel).
+         */
+        template <typename K, typename T, typename A, typename B>
+        void gemmWith(const A& a, const B& b, T* c, size_t ldc, size_t i0,
+                      size_t m, size_t j0, size_t n, size_t k) {
+            typedef K Bl;
+            if (m*n*k <= GEMM_PACK_THRESHOLD) {
+                gemmSmall(a, b, c, ldc, i0, m, j0, n);
+                return;
+            }
+            vector<T, AlignedAllocator<T> > a_pack((size_t)Bl::KC*
+                                (((size_t)Bl::MC + Bl::MR - 1)/Bl::MR)*Bl::MR);
+            vector<T, AlignedAllocator<T> > b_pack((size_t)Bl::KC*
+                                (((size_t)Bl::NC + Bl::NR - 1)/Bl::NR)*Bl::NR);
+            for (size_t jc = j0; jc < j0 + n; jc += Bl::NC) {
+                size_t nc = j0 + n - jc < (size_t)Bl::NC ? j0 + n - jc :
+                            (size_t)Bl::NC;
+                for (size_t pc = 0; pc < k; pc += Bl::KC) {
+                    size_t kc = k - pc < (size_t)Bl::KC ? k - pc :
+                                (size_t)Bl::KC;
+                    if (pc + kc <= b.rowBegin(jc) ||
+                        pc >= b.rowEnd(jc + nc - 1)) {
+                        continue;
+                    }
+                    packB<Bl::NR>(b, pc, jc, kc, nc, b_pack.data());
+                    for (size_t ic = i0; ic < i0 + m; ic += Bl::MC) {
+                        size_t mc = i0 + m - ic < (size_t)Bl::MC ?
+                                    i0 + m - ic : (size_t)Bl::MC;
+                        if (pc + kc <= a.colBegin(ic) ||
+                            pc >= a.colEnd(ic + mc - 1)) {
+                            continue;
+                        }
+                        packA<Bl::MR>(a, ic, pc, mc, kc, a_pack.data());
+                        for (size_t jr = 0; jr < nc; jr += Bl::NR) {
+                            size_t nr = nc - jr < (size_t)Bl::NR ? nc - jr :
+                                        (size_t)Bl::NR;
+                            size_t b_lo = std::max(pc, b.rowBegin(jc + jr));
+                            size_t b_hi = std::min(pc + kc,
+                                                   b.rowEnd(jc + jr + nr - 1));
+                            for (size_t ir = 0; ir < mc; ir += Bl::MR) {
+                                size_t mr = mc - ir < (size_t)Bl::MR ?
+                                            mc - ir : (size_t)Bl::MR;
+                                size_t lo = std::max(b_lo,
+                                                     a.colBegin(ic + ir));
+                                size_t hi = std::min(b_hi,
+                                                a.colEnd(ic + ir + mr - 1));
+                                if (lo >= hi) continue;
+                                K::run(hi - lo, a_pack.data() + ir*kc +
+                                            (lo - pc)*Bl::MR,
+                                            b_pack.data() + jr*kc +
+                                            (lo - pc)*Bl::NR,
+                                            c + (ic + ir)*ldc + jc + jr, ldc,
+                                            mr, nr);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        template <typename T, typename A, typename B>
+        void gemm(const A& a, const B& b, T* c, size_t ldc, size_t i0,
+                  size_t m, size_t j0, size_t n, size_t k, SimdTag<false>) {
+            gemmWith<GemmKernel<T, SIMD_SCALAR> >(a, b, c, ldc, i0, m, j0, n,
+                                                  k);
+        }
+
+        template <typename T, typename A, typename B>
+        void gemm(const A& a, const B& b, T* c, size_t ldc, size_t i0,
+                  size_t m, size_t j0, size_t n, size_t k, SimdTag<true>) {
+            switch (gemmLevel()) {
+#ifdef MTM_SIMD_X86
+                case SIMD_AVX512:
+                    gemmWith<GemmKernel<T, SIMD_AVX512> >(a, b, c, ldc, i0, m,
+                                                          j0, n, k);
+                    return;
+                case SIMD_AVX2:
+                    gemmWith<GemmKernel<T, SIMD_AVX2> >(a, b, c, ldc, i0, m,
+                                                        j0, n, k);
+                    return;
+#endif
+                default:
+                    gemmWith<GemmKernel<T, SIMD_SCALAR> >(a, b, c, ldc, i0, m,
+                                                          j0, n, k);
+            }
+        }
+
+        /*
+         * Adds rows [i0,i0+m) times columns [j0,j0+n) of a*b to c (see
+         * gemmWith), on the strongest micro kernel the CPU supports.
+         */
+        template <typename T, typename A, typename B>
+        void gemm(const A& a, const B& b, T* c, size_t ldc, size_t i0,
+                  size_t m, size_t j0, size_t n, size_t k) {
+            gemm(a, b, c, ldc, i0, m, j0, n, k,
+                 SimdTag<HasGemmKernels<T>::value>());
+        }
+
+        /*
+         * General matrix multiplication c += a*b on row major buffers, where
+         * a is m x k, b is k x n and c is m x n, and lda/ldb/ldc are their
+         * leading dimensions.
+         */
+        template <typename T>
+        void gemm(size_t m, size_t n, size_t k, const T* a, size_t lda,
+                  const T* b, size_t ldb, T* c, size_t ldc) {
+            gemm(DenseOperand<T>(a, lda, m, k), DenseOperand<T>(b, ldb, k, n),
+                 c, ldc, 0, m, 0, n, k);
+        }
+
+        /*
+         * Parallel version of gemm, c = a*b is m x n and a has k columns.
+         * c is split into tiles of whole MC row blocks and NR aligned column
+         * ranges, enough of them to keep every thread of the pool busy, and
+         * each tile is computed by gemmWith with its own packing buffers.
+         * Small products run serially.
+         */
+        template <typename K, typename T, typename A, typename B>
+        void parallelGemmWith(const A& a, const B& b, T* c, size_t ldc,
+                              size_t m, size_t n, size_t k) {
+            typedef K Bl;
+            ThreadPool& pool = threadPool();
+            if (pool.size() == 1 || m*n*k < GEMM_PARALLEL_THRESHOLD) {
+                gemmWith<K>(a, b, c, ldc, 0, m, 0, n, k);
+                return;
+            }
+            size_t tile_rows = Bl::MC;
+            size_t row_tiles = (m + tile_rows - 1)/tile_rows;
+            size_t wanted = 4*pool.size();
+            size_t col_tiles = row_tiles >= wanted ? 1 :
+                               (wanted + row_tiles - 1)/row_tiles;
+            size_t tile_cols = (n + col_tiles - 1)/col_tiles;
+            tile_cols = (tile_cols + Bl::NR - 1)/Bl::NR*Bl::NR;
+            if (tile_cols < 4*(size_t)Bl::NR) tile_cols = 4*Bl::NR;
+            if (tile_cols > (size_t)Bl::NC) tile_cols = Bl::NC;
+            col_tiles = (n + tile_cols - 1)/tile_cols;
+            pool.parallelFor(0, row_tiles*col_tiles, [&](size_t tile) {
+                size_t i = tile/col_tiles*tile_rows;
+                size_t j = tile%col_tiles*tile_cols;
+                size_t mt = m - i < tile_rows ? m - i : tile_rows;
+                size_t nt = n - j < tile_cols ? n - j : tile_cols;
+                gemmWith<K>(a, b, c, ldc, i, mt, j, nt, k);
+            });
+        }
+
+        template <typename T, typename A, typename B>
+        void parallelGemm(const A& a, const B& b, T* c, size_t ldc, size_t m,
+                          size_t n, size_t k, SimdTag<false>) {
+            parallelGemmWith<GemmKernel<T, SIMD_SCALAR> >(a, b, c, ldc, m, n,
+                                                          k);
+        }
+
+        template <typename T, typename A, typename B>
+        void parallelGemm(const A& a, const B& b, T* c, size_t ldc, size_t m,
+                          size_t n, size_t k, SimdTag<true>) {
+            switch (gemmLevel()) {
+#ifdef MTM_SIMD_X86
+                case SIMD_AVX512:
+                    parallelGemmWith<GemmKernel<T, SIMD_AVX512> >(a, b, c, ldc,
+                                                                  m, n, k);
+                    return;
+                case SIMD_AVX2:
+                    parallelGemmWith<GemmKernel<T, SIMD_AVX2> >(a, b, c, ldc,
+                                                                m, n, k);
+                    return;
+#endif
+                default:
+                    parallelGemmWith<GemmKernel<T, SIMD_SCALAR> >(a, b, c, ldc,
+                                                                  m, n, k);
+            }
+        }
+
+        /*
+         * c = a*b (see parallelGemmWith) on the strongest micro kernel the
+         * CPU supports.
+         */
+        template <typename T, typename A, typename B>
+        void parallelGemm(const A& a, const B& b, T* c, size_t ldc, size_t m,
+                          size_t n, size_t k) {
+            parallelGemm(a, b, c, ldc, m, n, k,
+                         SimdTag<HasGemmKernels<T>::value>());
+        }
+
+        template <typename T>
+        void parallelGemm(size_t m, size_t n, size_t k, const T* a,
+                          size_t lda, const T* b, size_t ldb, T* c,
+                          size_t ldc) {
+            parallelGemm(DenseOperand<T>(a, lda, m, k),
+                         DenseOperand<T>(b, ldb, k, n), c, ldc, m, n, k);
+        }
+    }
+}
+
+#endif //EX3_MTMGEMM_H
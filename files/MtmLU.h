@@ -0,0 +1,383 @@
+#ifndef EX3_MTMLU_H
+#define EX3_MTMLU_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+#include "MtmExceptions.h"
+#include "Auxilaries.h"
+#include "MtmAllocator.h"
+#include "MtmThreadPool.h"
+#include "MtmGemm.h"
+#include "MtmMat.h"
+#include "MtmMatSq.h"
+#include "MtmVec.h"
+#include "Complex.h"
+
+using std::size_t;
+using std::vector;
+
+namespace MtmMath {
+
+    namespace MtmKernels {
+        /*
+         * Columns factored at a time by MtmLU, the depth of the products
+         * that update the rest of the matrix.
+         */
+        const size_t LU_BLOCK = 64;
+
+        /*
+         * Width of the column ranges triangular solves are split into
+         * across the thread pool.
+         */
+        const size_t SOLVE_CHUNK = 256;
+
+        /*
+         * Size of an element compared when picking a pivot, only its order
+         * matters.
+         */
+        inline double magnitude(float x) { return std::fabs(x); }
+        inline double magnitude(double x) { return std::fabs(x); }
+        inline double magnitude(const Complex& x) {
+            return x.real()*x.real() + x.imag()*x.imag();
+        }
+
+        inline float reciprocal(float x) { return 1/x; }
+        inline double reciprocal(double x) { return 1/x; }
+        inline Complex reciprocal(const Complex& x) {
+            double norm = x.real()*x.real() + x.imag()*x.imag();
+            return Complex(x.real()/norm, -x.imag()/norm);
+        }
+
+        /*
+         * Solves L*y = x in place for the rows x rows unit lower triangle of
+         * the row major l (its diagonal isn't read), where x is rows x cols.
+         * Column ranges are independent and solved in parallel.
+         */
+        template <typename T>
+        void lowerSolve(const T* l, size_t ldl, size_t rows, T* x,
+                        size_t ldx, size_t cols) {
+            size_t chunks = (cols + SOLVE_CHUNK - 1)/SOLVE_CHUNK;
+            threadPool().parallelFor(0, chunks, [&](size_t chunk) {
+                size_t c0 = chunk*SOLVE_CHUNK;
+                size_t c1 = std::min(cols, c0 + SOLVE_CHUNK);
+                for (size_t i = 1; i < rows; i++) {
+                    T* x_i = x + i*ldx;
+                    for (size_t r = 0; r < i; r++) {
+                        const T l_ir = l[i*ldl + r];
+                        const T* x_r = x + r*ldx;
+                        for (size_t c = c0; c < c1; c++) {
+                            x_i[c] -= l_ir*x_r[c];
+                        }
+                    }
+                }
+            });
+        }
+
+        /*
+         * Solves U*y = x in place for the rows x rows upper triangle of the
+         * row major u, like lowerSolve. The diagonal must have no zeros.
+         */
+        template <typename T>
+        void upperSolve(const T* u, size_t ldu, size_t rows, T* x,
+                        size_t ldx, size_t cols) {
+            size_t chunks = (cols + SOLVE_CHUNK - 1)/SOLVE_CHUNK;
+            threadPool().parallelFor(0, chunks, [&](size_t chunk) {
+                size_t c0 = chunk*SOLVE_CHUNK;
+                size_t c1 = std::min(cols, c0 + SOLVE_CHUNK);
+                for (size_t i = rows; i-- > 0;) {
+                    T* x_i = x + i*ldx;
+                    for (size_t r = i + 1; r < rows; r++) {
+                        const T u_ir = u[i*ldu + r];
+                        const T* x_r = x + r*ldx;
+                        for (size_t c = c0; c < c1; c++) {
+                            x_i[c] -= u_ir*x_r[c];
+                        }
+                    }
+                    const T inv = reciprocal(u[i*ldu + i]);
+                    for (size_t c = c0; c < c1; c++) {
+                        x_i[c] *= inv;
+                    }
+                }
+            });
+        }
+
+        /*
+         * Writes -a into dest, for the rows x cols block of the row major a,
+         * so that gemm, which adds, subtracts a product.
+         */
+        template <typename T>
+        void negateBlock(const T* a, size_t lda, size_t rows, size_t cols,
+                         T* dest) {
+            for (size_t i = 0; i < rows; i++) {
+                for (size_t j = 0; j < cols; j++) {
+                    dest[i*cols + j] = -a[i*lda + j];
+                }
+            }
+        }
+    }
+
+    /*
+     * LU factorization with partial pivoting of a square matrix, P*A = L*U,
+     * computed once and reused for any number of right hand sides:
+     *
+     *     MtmLU<double> lu(a);
+     *     MtmVec<double> x=lu.solve(b);
+     *     MtmMat<double> y=lu.solve(c);    //every column of c
+     *     MtmMatSq<double> a_inv=lu.inverse();
+     *
+     * The factorization is blocked: LU_BLOCK columns are factored at a time
+     * and the rest of the matrix is updated by one product with the cache
+     * blocked gemm, split across the MtmMath thread pool, which is where
+     * nearly all the time goes. Only floating point and Complex elements are
+     * supported. A matrix with an exactly zero pivot is singular: det() is
+     * zero, and solve() and inverse() throw MtmExceptions::SingularMatrix.
+     */
+    template <typename T>
+    class MtmLU {
+        static_assert(!std::is_integral<T>::value,
+                      "LU factorization divides, T must not be integral");
+    public:
+        explicit MtmLU(const MtmMatSq<T>& mat);
+
+        size_t size() const { return n; }
+        bool isSingular() const { return singular; }
+        /*
+         * Determinant of the factored matrix, the product of the pivots.
+         */
+        T det() const;
+        /*
+         * Solution x of A*x = b, shaped like b. MtmExceptions::
+         * DimensionMismatch is thrown if b doesn't have size() elements.
+         */
+        MtmVec<T> solve(const MtmVec<T>& b) const;
+        /*
+         * Solution X of A*X = b, solving for all the columns of b at once.
+         * b must have size() rows.
+         */
+        MtmMat<T> solve(const MtmMat<T>& b) const;
+        MtmMatSq<T> inverse() const;
+
+    private:
+        typedef vector<T, AlignedAllocator<T> > Buffer;
+        size_t n;
+        Buffer lu;              //L below the diagonal, U on and above it
+        vector<size_t> pivot;   //row i was swapped with row pivot[i]
+        bool odd_swaps;
+        bool singular;
+
+        void factorPanel(size_t k0, size_t k1);
+        void solveInPlace(T* x, size_t cols) const;
+    };
+
+                        ////////Factorization////////
+
+    template <typename T>
+    MtmLU<T>::MtmLU(const MtmMatSq<T>& mat) : n((size_t)mat.getRow()),
+    lu(), pivot(), odd_swaps(false), singular(false) {
+        MTM_STATS_OP(FACTORIZE);
+        try {
+            lu.resize(n*n);
+            pivot.resize(n);
+        }
+        catch (std::bad_alloc& e) {throw MtmExceptions::OutOfMemory();}
+        for (size_t i = 0; i < n; i++) {
+            for (size_t j = 0; j < n; j++) {
+                lu[i*n + j] = mat.atUnchecked(i,j);
+            }
+        }
+        Buffer neg;
+        try {
+            neg.resize(n*MtmKernels::LU_BLOCK);
+        }
+        catch (std::bad_alloc& e) {throw MtmExceptions::OutOfMemory();}
+        for (size_t k0 = 0; k0 < n; k0 += MtmKernels::LU_BLOCK) {
+            size_t k1 = std::min(n, k0 + MtmKernels::LU_BLOCK);
+            factorPanel(k0, k1);
+            if (k1 == n) break;
+            //the block row of U right of the panel
+            MtmKernels::lowerSolve(&lu[k0*n + k0], n, k1 - k0,
+                                   &lu[k0*n + k1], n, n - k1);
+            //and what is left: A22 -= L21*U12
+            MtmKernels::negateBlock(&lu[k1*n + k0], n, n - k1, k1 - k0,
+                                    neg.data());
+            MtmKernels::parallelGemm(n - k1, n - k1, k1 - k0, neg.data(),
+                                     k1 - k0, &lu[k0*n + k1], n,
+                                     &lu[k1*n + k1], n);
+        }
+    }
+
+    /*
+     * Factors columns [k0,k1) of rows [k0,n), one column at a time. Pivot
+     * rows are swapped whole, so the columns of L already factored and the
+     * columns not reached yet follow them.
+     */
+    template <typename T>
+    void MtmLU<T>::factorPanel(size_t k0, size_t k1) {
+        for (size_t j = k0; j < k1; j++) {
+            size_t p = j;
+            double best = MtmKernels::magnitude(lu[j*n + j]);
+            for (size_t i = j + 1; i < n; i++) {
+                double size = MtmKernels::magnitude(lu[i*n + j]);
+                if (size > best) {
+                    best = size;
+                    p = i;
+                }
+            }
+            pivot[j] = p;
+            if (p != j) {
+                std::swap_ranges(&lu[j*n], &lu[j*n] + n, &lu[p*n]);
+                odd_swaps = !odd_swaps;
+            }
+            if (best == 0) { //nothing to eliminate in this column
+                singular = true;
+                continue;
+            }
+            const T inv = MtmKernels::reciprocal(lu[j*n + j]);
+            const T* row_j = &lu[j*n];
+            for (size_t i = j + 1; i < n; i++) {
+                T* row_i = &lu[i*n];
+                row_i[j] *= inv;
+                const T l_ij = row_i[j];
+                for (size_t c = j + 1; c < k1; c++) {
+                    row_i[c] -= l_ij*row_j[c];
+                }
+            }
+        }
+    }
+
+                        ////////Using the factorization////////
+
+    template <typename T>
+    T MtmLU<T>::det() const {
+        if (singular) return T();
+        T res = lu[0];
+        for (size_t i = 1; i < n; i++) {
+            res *= lu[i*n + i];
+        }
+        return odd_swaps ? -res : res;
+    }
+
+    /*
+     * Replaces the n x cols row major x by the solution of A*y = x: the
+     * row swaps, then L and U. Wide right hand sides are solved a block of
+     * rows at a time, the part already solved being taken out by gemm.
+     */
+    template <typename T>
+    void MtmLU<T>::solveInPlace(T* x, size_t cols) const {
+        MTM_STATS_OP(SOLVE);
+        for (size_t i = 0; i < n; i++) {
+            if (pivot[i] != i) {
+                std::swap_ranges(x + i*cols, x + (i + 1)*cols,
+                                 x + pivot[i]*cols);
+            }
+        }
+        const size_t block = cols < MtmKernels::LU_BLOCK ? n :
+                             MtmKernels::LU_BLOCK;
+        Buffer neg;
+        try {
+            if (block < n) neg.resize(block*n);
+        }
+        catch (std::bad_alloc& e) {throw MtmExceptions::OutOfMemory();}
+        for (size_t i0 = 0; i0 < n; i0 += block) {
+            size_t i1 = std::min(n, i0 + block);
+            if (i0 > 0) {
+                MtmKernels::negateBlock(&lu[i0*n], n, i1 - i0, i0,
+                                        neg.data());
+                MtmKernels::parallelGemm(i1 - i0, cols, i0, neg.data(), i0,
+                                         x, cols, x + i0*cols, cols);
+            }
+            MtmKernels::lowerSolve(&lu[i0*n + i0], n, i1 - i0,
+                                   x + i0*cols, cols, cols);
+        }
+        for (size_t i1 = n; i1 > 0;) {
+            size_t i0 = i1 > block ? i1 - block : 0;
+            if (i1 < n) {
+                MtmKernels::negateBlock(&lu[i0*n + i1], n, i1 - i0, n - i1,
+                                        neg.data());
+                MtmKernels::parallelGemm(i1 - i0, cols, n - i1, neg.data(),
+                                         n - i1, x + i1*cols, cols,
+                                         x + i0*cols, cols);
+            }
+            MtmKernels::upperSolve(&lu[i0*n + i0], n, i1 - i0,
+                                   x + i0*cols, cols, cols);
+            i1 = i0;
+        }
+    }
+
+    template <typename T>
+    MtmVec<T> MtmLU<T>::solve(const MtmVec<T>& b) const {
+        if ((size_t)b.size() != n) {
+            throw MtmExceptions::DimensionMismatch(Dimensions(n,n),
+                                                   b.getDim());
+        }
+        if (singular) throw MtmExceptions::SingularMatrix();
+        MtmVec<T> x(n);
+        for (size_t i = 0; i < n; i++) {
+            x.atUnchecked(i) = b.atUnchecked(i);
+        }
+        solveInPlace(x.dataPtr(), 1);
+        if (!b.isColVector()) x.transpose();
+        return x;
+    }
+
+    template <typename T>
+    MtmMat<T> MtmLU<T>::solve(const MtmMat<T>& b) const {
+        if ((size_t)b.getRow() != n) {
+            throw MtmExceptions::DimensionMismatch(Dimensions(n,n),
+                                                   b.getDim());
+        }
+        if (singular) throw MtmExceptions::SingularMatrix();
+        size_t cols = (size_t)b.getCol();
+        MtmMat<T> x(Dimensions(n,cols));
+        for (size_t i = 0; i < n; i++) {
+            T* row = x.rowPtr(i);
+            for (size_t j = 0; j < cols; j++) {
+                row[j] = b.atUnchecked(i,j);
+            }
+        }
+        solveInPlace(x.rowPtr(0), cols);
+        return x;
+    }
+
+    template <typename T>
+    MtmMatSq<T> MtmLU<T>::inverse() const {
+        if (singular) throw MtmExceptions::SingularMatrix();
+        MtmMatSq<T> inv(n);
+        for (size_t i = 0; i < n; i++) {
+            inv.rowPtr(i)[i] = T(1);
+        }
+        solveInPlace(inv.rowPtr(0), n);
+        return inv;
+    }
+
+                        ////////Shortcuts////////
+
+    /*
+     * Each of these factors mat once, use MtmLU directly to reuse the
+     * factorization.
+     */
+    template <typename T>
+    T det(const MtmMatSq<T>& mat) {
+        return MtmLU<T>(mat).det();
+    }
+
+    template <typename T>
+    MtmMatSq<T> inverse(const MtmMatSq<T>& mat) {
+        return MtmLU<T>(mat).inverse();
+    }
+
+    template <typename T>
+    MtmVec<T> solve(const MtmMatSq<T>& mat, const MtmVec<T>& b) {
+        return MtmLU<T>(mat).solve(b);
+    }
+
+    template <typename T>
+    MtmMat<T> solve(const MtmMatSq<T>& mat, const MtmMat<T>& b) {
+        return MtmLU<T>(mat).solve(b);
+    }
+
+}
+
+#endif //EX3_MTMLU_H
@@ -3,37 +3,129 @@
 
 
 #include <vector>
+#include <cstdint>
+#include <algorithm>
 #include "MtmExceptions.h"
 #include "Auxilaries.h"
 #include "MtmVec.h"
+#include "MtmAllocator.h"
+#include "MtmMatBuffer.h"
+#include "MtmGemm.h"
+#include "MtmTranspose.h"
+#include "MtmReduce.h"
+#include "MtmExpr.h"
 
 using std::size_t;
 
 namespace MtmMath {
+    namespace MtmFile {
+        struct Access; //see MtmMatFile.h
+    }
 
     template <typename T>
-    class MtmMat {
+    class MtmMat : public MtmExpr<MtmMat<T> > {
     protected:
+        /*
+         * How the elements are stored. A square matrix that is zero below
+         * (above) the diagonal can keep only its upper (lower) triangle,
+         * row by row, the other cells are read as zero and locked.
+         */
+        enum Layout { FULL, PACKED_UPPER, PACKED_LOWER };
         Dimensions dim;
-        vector<MtmVec<T> > matrix;
+        size_t ld; //leading dimension, distance between consecutive rows
+        Layout layout;
+        /*
+         * A full matrix can be stored column by column instead, ld apart,
+         * after transpose() turned it into a view of its old rows. Element
+         * access, iterators and products read it in place, operations that
+         * work row by row call materialize() first.
+         */
+        bool trans;
+        MatBuffer<T> data; //one allocation, or a mapped file
+        vector<bool> lock; //true marks a locked cell, empty if none locked
+        /*
+         * Packed n x n triangle whose stored elements get the value val.
+         */
+        MtmMat(size_t n, const T& val, Layout layout_t);
+        /*
+         * Copy constructor that keeps a packed layout and its locks, for
+         * derived classes whose copies stay triangular.
+         */
+        MtmMat(const MtmMat& mat, bool keep_layout);
+        bool isStored(size_t row, size_t col) const;
+        size_t offset(size_t row, size_t col) const;
+        size_t colBegin(size_t row) const;
+        size_t colEnd(size_t row) const;
+        T* rowData(size_t row);
+        const T* rowData(size_t row) const;
+        bool isLocked(size_t row, size_t col) const;
+        void setLocked(size_t row, size_t col, bool locked);
+        void unpack();
+        void unpackInto(vector<T, AlignedAllocator<T> >& full) const;
+        void materialize();
+        template <typename E>
+        void assignExpr(const E& expr);
+        template <typename Func>
+        void reduceBlock(size_t row_begin, size_t row_end, size_t col_begin,
+                         size_t col_end, vector<Func>& funcs) const;
+        template <typename Func>
+        void reduceColumns(vector<Func>& funcs, std::false_type) const;
+        template <typename Func>
+        void reduceColumns(vector<Func>& funcs, std::true_type) const;
+        template <typename A>
+        static void multiplyInto(const A& a, const MtmMat& mat2,
+                                 MtmMat& res_mat);
+        static const T& zero();
+        static vector<T, AlignedAllocator<T> >& spareBuffer();
     public:
+        typedef T value_type;
+        class row_view;
+        class const_row_view;
         /*
          * Matrix constructor, dim_t is the dimension of the matrix and val
          * is the initial value for the matrix elements.
          */
         explicit MtmMat(Dimensions dim_t, const T& val=T());
         MtmMat(const MtmMat& mat);
+        MtmMat(MtmMat&& mat) noexcept;
         ~MtmMat() = default;
         explicit MtmMat(const MtmVec<T>& vec);
+        /*
+         * Evaluates an element-wise expression (see MtmExpr.h) in a single
+         * pass.
+         */
+        template <typename E>
+        MtmMat(const MtmExpr<E>& expr, typename std::enable_if<
+               !ExprTraits<E>::is_leaf>::type* = nullptr);
         /*
          * Matrix operators:
+         * +, - and * with scalars and element-wise +, - between matrices and
+         * vectors are expressions, declared in MtmExpr.h. The matrix product
+         * is computed by multiply.
          */
         MtmMat& operator=(const MtmMat&);
+        MtmMat& operator=(MtmMat&&) noexcept;
+        template <typename E>
+        typename std::enable_if<!ExprTraits<E>::is_leaf, MtmMat&>::type
+        operator=(const MtmExpr<E>& expr);
         MtmMat& operator+=(const MtmMat&);
         MtmMat& operator-=(const MtmMat&);
-        MtmMat operator-() const;
-        MtmVec<T>& operator[](int pos);
-        const MtmVec<T>& operator[](int pos) const;
+        row_view operator[](int pos);
+        const_row_view operator[](int pos) const;
+        /*
+         * Unchecked access for hot loops: row and col must be in range, and
+         * cell locks are ignored. Only stored cells may be written, the zero
+         * half of a triangle isn't.
+         */
+        T& atUnchecked(size_t row, size_t col);
+        const T& atUnchecked(size_t row, size_t col) const;
+        /*
+         * The getCol() elements of a row, contiguous, rows getCol() apart.
+         * A transposed matrix is rewritten row by row and a packed triangle
+         * expanded first, so the pointers stay valid until the next
+         * transpose(), resize() or reshape(). Writes skip the cell locks.
+         */
+        T* rowPtr(size_t row);
         /*
          * Helper functions for MtmMat
          */
@@ -46,6 +138,8 @@ namespace MtmMath {
          * each element in the matrix columns. It outputs a vector in the
          * size of the matrix columns where each element is the final output
          * by the function object's * operator
+         * Columns are reduced in parallel, and the rows of tall matrices too
+         * when Func is mergeable (see MtmReduce.h).
          */
         template <typename Func>
         MtmVec<T> matFunc(Func& f) const;
@@ -62,6 +156,50 @@ namespace MtmMath {
          * Performs transpose operation on matrix
          */
         virtual void transpose();
+        template <typename U>
+        friend MtmMat<U> multiply(const MtmMat<U>& mat1,
+                                  const MtmMat<U>& mat2);
+        template <typename U>
+        friend const U& exprAt(const MtmMat<U>& mat, size_t row, size_t col);
+        template <typename U>
+        friend const U* exprData(const MtmMat<U>& mat);
+        template <typename U>
+        friend class MtmMatSparse;
+        friend struct MtmFile::Access;
+        /*
+         * row_view class- A lightweight handle to a single matrix row,
+         * returned by operator[] so m[i][j] keeps working on the contiguous
+         * buffer. Accessing a column out of range, or writing to a locked
+         * cell, throws AccessIllegalElement.
+         */
+        class row_view
+        {
+        public:
+            row_view(MtmMat<T>* mat, size_t row);
+            T& operator[](int pos);
+            int size() const;
+            bool isCellLocked(int pos) const;
+            void lockCell(int pos);       //lock a cell and prevent writing to it
+            void unlockCell(int pos);     //unlock a cell
+        private:
+            MtmMat<T>* mat_ptr;
+            size_t row;
+        };
+        /*
+         * const_row_view class- Read only version of row_view. Locked cells
+         * can be read through it.
+         */
+        class const_row_view
+        {
+        public:
+            const_row_view(const MtmMat<T>* mat, size_t row);
+            const T& operator[](int pos) const;
+            int size() const;
+            bool isCellLocked(int pos) const;
+        private:
+            const MtmMat<T>* mat_ptr;
+            size_t row;
+        };
      /*
       * iterator class- An iterator including operator++ for iterating
       * through the matrix, and operator* for accessing elements in the
@@ -75,6 +213,8 @@ namespace MtmMath {
         T& operator*();
         bool operator!=(const iterator& j) const;
         bool operator==(const iterator& j) const;
+        int getRow() const; //position of the current element
+        int getCol() const;
     protected:
         MtmMat<T>* mat_ptr;
         int row;
@@ -86,12 +226,29 @@ namespace MtmMath {
         * iterating through all non zero elements in the matrix, and
         * operator* for accessing elements in the matrix.
         * Derived from iterator.
+        * Columns are scanned BLOCK at a time, row by row in memory order
+        * with a vectorized zero test, when the iterator reaches them, so
+        * writes ahead of it are seen. Cells that became zero or locked are
+        * still skipped, but a cell of the block being walked that becomes
+        * nonzero after the iterator reached the block is not visited.
      */
         class nonzero_iterator : public iterator
         {
         public:
             nonzero_iterator(MtmMat<T>* mat, int row, int col,Dimensions d);
             void operator++() override;
+        private:
+            friend class MtmMat<T>;
+            static const size_t WORDS = 4;
+            static const size_t BLOCK = 64*WORDS;
+            void seek(size_t row, size_t col, size_t next_row);
+            void scanBlock(size_t first_col);
+            size_t block; //first column of the scanned block, or npos
+            //rows of the block holding nonzeros, and a bit per column of
+            //the block for each of them, in WORDS words
+            vector<size_t> rows;
+            vector<uint64_t> masks;
+            size_t next; //index in rows of the current element
         };
      /*
      * functions for iterators of MtmMat:
@@ -106,9 +263,13 @@ namespace MtmMath {
 
     template <typename T>
     MtmMat<T>::MtmMat(Dimensions dim_t, const T &val) try: dim(dim_t),
-    matrix(dim_t.getRow(),MtmVec<T>(dim_t.getCol(),val)) {
+    ld(dim_t.getCol()), layout(FULL), trans(false), data(), lock() {
         if (dim_t.getCol()==0||dim_t.getRow()==0) throw
         MtmExceptions::IllegalInitialization();
+        if (dim_t.getRow()>data.max_size()/dim_t.getCol()) throw
+        MtmExceptions::OutOfMemory();
+        MTM_STATS_OP(CONSTRUCT);
+        data.assign(dim_t.getRow()*ld,val);
     }
     catch (std::bad_alloc& e){
         throw MtmExceptions::OutOfMemory();
@@ -116,19 +277,71 @@ namespace MtmMath {
 
     /*
      * Conversion constructor from a vector to a regular matrix.
+     * Copy construction doesn't copy the cell locks, a copy is writable.
      */
     template <typename T>
     MtmMat<T>::MtmMat(const MtmVec<T>& vec): MtmMat(vec.getDim(),T()){
-        int i=0;
-        for (iterator it=this->begin();it!=this->end();++it){
-            *it=vec[i];
-            i++;
+        std::copy(vec.dataPtr(),vec.dataPtr()+vec.size(),data.begin());
+    }
+
+    template <typename T>
+    MtmMat<T>::MtmMat(const MtmMat& mat) : MtmMat(mat,false) {}
+
+    /*
+     * A packed triangle is copied as it is when keep_layout is set, and
+     * expanded to a full writable matrix otherwise.
+     */
+    template <typename T>
+    MtmMat<T>::MtmMat(const MtmMat& mat, bool keep_layout) try:
+    dim(mat.dim), ld(mat.ld), layout(FULL), trans(mat.trans), data(),
+    lock() {
+        MTM_STATS_OP(COPY);
+        if (mat.layout==FULL){
+            data=mat.data;
+        }
+        else if (keep_layout){
+            layout=mat.layout;
+            data=mat.data;
+            lock=mat.lock;
+        }
+        else {
+            vector<T, AlignedAllocator<T> > full;
+            mat.unpackInto(full);
+            data.swap(full);
         }
     }
+    catch (std::bad_alloc& e) {throw MtmExceptions::OutOfMemory();}
 
     template <typename T>
-    MtmMat<T>::MtmMat(const MtmMat& mat) try: dim(mat.dim) , matrix(mat
-    .matrix){}
+    MtmMat<T>::MtmMat(size_t n, const T& val, Layout layout_t) try:
+    dim(n,n), ld(n), layout(layout_t), trans(false), data(), lock() {
+        if (n==0) throw MtmExceptions::IllegalInitialization();
+        if (n>(data.max_size()-1)/n) throw MtmExceptions::OutOfMemory();
+        MTM_STATS_OP(CONSTRUCT);
+        data.assign(layout==FULL ? n*n : n*(n+1)/2,val);
+    }
+    catch (std::bad_alloc& e){
+        throw MtmExceptions::OutOfMemory();
+    }
+
+    /*
+     * Move constructor, takes over the buffer (and the cell locks) of mat.
+     */
+    template <typename T>
+    MtmMat<T>::MtmMat(MtmMat&& mat) noexcept : dim(mat.dim), ld(mat.ld),
+    layout(mat.layout), trans(mat.trans), data(std::move(mat.data)),
+    lock(std::move(mat.lock)) {}
+
+    template <typename T>
+    template <typename E>
+    MtmMat<T>::MtmMat(const MtmExpr<E>& expr, typename std::enable_if<
+                      !ExprTraits<E>::is_leaf>::type*) try:
+    dim(expr.self().getDim()), ld(dim.getCol()), layout(FULL),
+    trans(false), data(), lock() {
+        MTM_STATS_OP(EVALUATE);
+        data.resize(dim.getRow()*ld);
+        assignExpr(expr.self());
+    }
     catch (std::bad_alloc& e) {throw MtmExceptions::OutOfMemory();}
 
                         ////////Operators////////
@@ -137,264 +350,559 @@ namespace MtmMath {
     MtmMat<T>& MtmMat<T>::operator=(const MtmMat& mat){
         if (this==&mat)
             return *this;
+        MTM_STATS_OP(COPY);
         try {
-            matrix = mat.matrix;
+            data = mat.data;
+            lock = mat.lock;
         }
         catch (std::bad_alloc& e) {throw MtmExceptions::OutOfMemory();}
         dim=mat.dim;
+        ld=mat.ld;
+        layout=mat.layout;
+        trans=mat.trans;
+        return *this;
+    }
+
+    template <typename T>
+    MtmMat<T>& MtmMat<T>::operator=(MtmMat&& mat) noexcept{
+        if (this==&mat)
+            return *this;
+        data=std::move(mat.data);
+        lock=std::move(mat.lock);
+        dim=mat.dim;
+        ld=mat.ld;
+        layout=mat.layout;
+        trans=mat.trans;
         return *this;
     }
 
+    /*
+     * Assigning an expression of the same dimensions writes it in place,
+     * which is safe even if the expression reads this matrix: every element
+     * only depends on the elements at the same position. Like assigning a
+     * new matrix, it leaves no cell locked, so a packed triangle (or a
+     * transposed view) is replaced by a plain full matrix.
+     */
+    template <typename T>
+    template <typename E>
+    typename std::enable_if<!ExprTraits<E>::is_leaf, MtmMat<T>&>::type
+    MtmMat<T>::operator=(const MtmExpr<E>& expr){
+        const E& e=expr.self();
+        if (e.getDim()!=dim||layout!=FULL||trans){
+            return *this=MtmMat<T>(expr);
+        }
+        MTM_STATS_OP(EVALUATE);
+        assignExpr(e);
+        lock.clear();
+        return *this;
+    }
+
+    /*
+     * Writes every element of an expression with this matrix's dimensions,
+     * one row at a time, unless the element-wise kernels can compute it
+     * (see exprKernel).
+     */
+    template <typename T>
+    template <typename E>
+    void MtmMat<T>::assignExpr(const E& expr){
+        if (ld==dim.getCol()&&
+            exprKernel(data.data(),dim.getRow()*ld,expr)) return;
+        for (size_t i=0;i<dim.getRow();i++){
+            T* row=data.data()+i*ld;
+            for (size_t j=0;j<dim.getCol();j++){
+                row[j]=expr.at(i,j);
+            }
+        }
+    }
+
+    /*
+     * operator [] gives a view of the row stored in pos. if the pos is out of
+     * the matrix's range an AccessIllegalElement() exception will be thrown.
+     * A negative pos wraps around to a huge pos_unsigned, so a single
+     * comparison checks the range.
+     */
     template <typename T>
-    MtmVec<T>& MtmMat<T>::operator[](int pos){
+    typename MtmMat<T>::row_view MtmMat<T>::operator[](int pos){
         size_t pos_unsigned=(size_t)pos;
-        if (pos<0||pos_unsigned>=matrix.size()){
+        if (pos_unsigned>=dim.getRow()){
             throw MtmExceptions::AccessIllegalElement();
         }
-        return matrix[pos_unsigned];
+        return row_view(this,pos_unsigned);
     }
 
     template <typename T>
-    const MtmVec<T>& MtmMat<T>::operator[](int pos) const{
+    typename MtmMat<T>::const_row_view MtmMat<T>::operator[](int pos) const{
         size_t pos_unsigned=(size_t)pos;
-        if (pos<0||pos_unsigned>=matrix.size()){
+        if (pos_unsigned>=dim.getRow()){
             throw MtmExceptions::AccessIllegalElement();
         }
-        return matrix[pos_unsigned];
+        return const_row_view(this,pos_unsigned);
     }
 
     template <typename T>
     MtmMat<T>& MtmMat<T>::operator+=(const MtmMat& mat){
+        MTM_STATS_OP(ADD_ASSIGN);
         if (dim!=mat.dim){
             throw MtmExceptions::DimensionMismatch(dim,mat.dim);
         }
-        for(int i=0; i<getRow(); i++){
-            for(int j=0; j<getCol(); j++)
-                matrix[i][j]+=mat[i][j];
+        if (trans&&mat.trans&&lock.empty()){ //same storage order
+            MtmKernels::addArray(data.data(),mat.data.data(),data.size());
+            return *this;
+        }
+        materialize();
+        if (mat.trans){
+            MtmMat<T> by_rows(mat);
+            by_rows.materialize();
+            return *this+=by_rows;
+        }
+        if (!lock.empty()||(layout!=FULL&&layout!=mat.layout)){
+            //locked cells must not be written to
+            for(size_t i=0; i<dim.getRow(); i++){
+                for(size_t j=0; j<dim.getCol(); j++){
+                    if (isLocked(i,j)) throw
+                    MtmExceptions::AccessIllegalElement();
+                    atUnchecked(i,j)+=mat.atUnchecked(i,j);
+                }
+            }
+            return *this;
+        }
+        for(size_t i=0; i<dim.getRow(); i++){ //only the cells mat stores
+            size_t begin=mat.colBegin(i);
+            MtmKernels::addArray(rowData(i)+begin,mat.rowData(i)+begin,
+                                 mat.colEnd(i)-begin);
         }
         return *this;
     }
 
     template <typename T>
-    MtmMat<T> operator+(const MtmMat<T>& mat1,const MtmMat<T>& mat2){
-        MtmMat<T> temp(mat2);
-        return MtmMat<T>(mat1)+=temp;
-    }
-
-    template <typename T>
-    MtmMat<T> operator+(const MtmMat<T>& mat,const MtmVec<T>& vec){
-        if (mat.getDim()!=vec.getDim()){
-            throw MtmExceptions::DimensionMismatch(mat.getDim(),vec.getDim());
+    MtmMat<T>& MtmMat<T>::operator-=(const MtmMat<T>& mat){
+        MTM_STATS_OP(SUB_ASSIGN);
+        if (dim!=mat.dim){
+            throw MtmExceptions::DimensionMismatch(dim,mat.dim);
+        }
+        if (trans&&mat.trans&&lock.empty()){ //same storage order
+            MtmKernels::subArray(data.data(),mat.data.data(),data.size());
+            return *this;
+        }
+        materialize();
+        if (mat.trans){
+            MtmMat<T> by_rows(mat);
+            by_rows.materialize();
+            return *this-=by_rows;
         }
-        MtmMat<T> temp_mat(vec);
-        return temp_mat+mat;
+        if (!lock.empty()||(layout!=FULL&&layout!=mat.layout)){
+            //locked cells must not be written to
+            for(size_t i=0; i<dim.getRow(); i++){
+                for(size_t j=0; j<dim.getCol(); j++){
+                    if (isLocked(i,j)) throw
+                    MtmExceptions::AccessIllegalElement();
+                    atUnchecked(i,j)-=mat.atUnchecked(i,j);
+                }
+            }
+            return *this;
+        }
+        for(size_t i=0; i<dim.getRow(); i++){ //only the cells mat stores
+            size_t begin=mat.colBegin(i);
+            MtmKernels::subArray(rowData(i)+begin,mat.rowData(i)+begin,
+                                 mat.colEnd(i)-begin);
+        }
+        return *this;
     }
 
+    /*
+     * Matrix multiplication, computed straight on the operands' buffers by
+     * the cache blocked kernel in MtmGemm.h. Large products are split
+     * across the MtmMath thread pool, and the zero half of packed triangles
+     * is skipped. operator* between any two vectors, matrices or
+     * expressions ends up here. A transposed view is multiplied straight
+     * from its storage, A^T is never built.
+     */
     template <typename T>
-    MtmMat<T> operator+(const MtmVec<T>& vec,const MtmMat<T>& mat){
-        return mat+vec;
+    MtmMat<T> multiply(const MtmMat<T>& mat1, const MtmMat<T>& mat2){
+        MTM_STATS_OP(MULTIPLY);
+        if (mat1.getCol()!=mat2.getRow()){
+            throw MtmExceptions::DimensionMismatch
+            (mat1.getDim(),mat2.getDim());
+        }
+        Dimensions dim((size_t)mat1.getRow(),(size_t)mat2.getCol());
+        MtmMat<T> res_mat(dim,T());
+        if (mat1.trans){ //A^T*B reads A as it is stored
+            MtmMat<T>::multiplyInto(MtmKernels::TransposedOperand<T>(
+                    mat1.data.data(),mat1.ld,mat1.dim.getRow(),
+                    mat1.dim.getCol()),mat2,res_mat);
+        }
+        else if (mat1.layout==MtmMat<T>::FULL){
+            MtmMat<T>::multiplyInto(MtmKernels::DenseOperand<T>(
+                    mat1.data.data(),mat1.ld,mat1.dim.getRow(),
+                    mat1.dim.getCol()),mat2,res_mat);
+        }
+        else {
+            MtmMat<T>::multiplyInto(MtmKernels::TriangleOperand<T>(
+                    mat1.data.data(),mat1.dim.getRow(),
+                    mat1.layout==MtmMat<T>::PACKED_UPPER),mat2,res_mat);
+        }
+        return res_mat;
     }
 
+    /*
+     * res_mat += a*mat2, where a is the left operand already wrapped for
+     * the kernel.
+     */
     template <typename T>
-    MtmMat<T> operator+(const MtmMat<T>& mat,const T &val){
-        MtmMat<T> temp(mat);
-        for(int i=0; i<temp.getRow(); i++){
-            for(int j=0; j<temp.getCol(); j++)
-                temp[i][j]+=val;
+    template <typename A>
+    void MtmMat<T>::multiplyInto(const A& a, const MtmMat& mat2,
+                                 MtmMat& res_mat){
+        const Dimensions& dim=res_mat.dim;
+        if (mat2.trans){
+            MtmKernels::parallelGemm(a,MtmKernels::TransposedOperand<T>(
+                    mat2.data.data(),mat2.ld,mat2.dim.getRow(),
+                    mat2.dim.getCol()),res_mat.data.data(),res_mat.ld,
+                    dim.getRow(),dim.getCol(),mat2.dim.getRow());
+        }
+        else if (mat2.layout==FULL){
+            MtmKernels::parallelGemm(a,MtmKernels::DenseOperand<T>(
+                    mat2.data.data(),mat2.ld,mat2.dim.getRow(),
+                    mat2.dim.getCol()),res_mat.data.data(),res_mat.ld,
+                    dim.getRow(),dim.getCol(),mat2.dim.getRow());
+        }
+        else {
+            MtmKernels::parallelGemm(a,MtmKernels::TriangleOperand<T>(
+                    mat2.data.data(),mat2.dim.getRow(),
+                    mat2.layout==PACKED_UPPER),res_mat.data.data(),
+                    res_mat.ld,dim.getRow(),dim.getCol(),mat2.dim.getRow());
         }
-        return temp;
     }
 
-    template <typename T>
-    MtmMat<T> operator+(const T &val,const MtmMat<T>& mat){
-        return mat+val;
-    }
+                ////////Operators on expiring matrices////////
 
-    template <typename T>
-    MtmMat<T>& MtmMat<T>::operator-=(const MtmMat<T>& mat){
-        if (dim!=mat.dim){
-            throw MtmExceptions::DimensionMismatch(dim,mat.dim);
-        }
-        for(int i=0; i<getRow(); i++){
-            for(int j=0; j<getCol(); j++)
-                matrix[i][j]-=mat[i][j];
-        }
-        return *this;
+    /*
+     * When a matrix operand of an element-wise operator is about to be
+     * destroyed, the result is computed into its buffer and returned instead
+     * of building a new matrix, so (a*b)+c allocates only once. Like any
+     * other result, it is a plain matrix with no locked cells.
+     */
+    template <typename T, typename R>
+    MtmMat<T> operator+(MtmMat<T>&& mat, const MtmExpr<R>& expr){
+        mat=mat+expr;
+        return std::move(mat);
     }
 
-    template <typename T>
-    MtmMat<T> operator-(const MtmMat<T>& mat1,const MtmMat<T>& mat2){
-        MtmMat<T> temp(mat2);
-        return MtmMat<T>(mat1)-=temp;
+    template <typename T, typename L>
+    MtmMat<T> operator+(const MtmExpr<L>& expr, MtmMat<T>&& mat){
+        mat=expr+mat;
+        return std::move(mat);
     }
 
     template <typename T>
-    MtmMat<T> operator-(const MtmMat<T>& mat,const MtmVec<T>& vec){
-        return mat+(-vec);
+    MtmMat<T> operator+(MtmMat<T>&& mat1, MtmMat<T>&& mat2){
+        mat1=mat1+mat2;
+        return std::move(mat1);
     }
 
     template <typename T>
-    MtmMat<T> operator-(const MtmVec<T>& vec, const MtmMat<T>& mat){
-        return -(mat)+vec;
+    MtmMat<T> operator+(MtmMat<T>&& mat,
+                        const typename MtmMat<T>::value_type& val){
+        mat=mat+val;
+        return std::move(mat);
     }
 
     template <typename T>
-    MtmMat<T> operator-(const MtmMat<T>& mat,const T &val){
-        MtmMat<T> temp(mat);
-        for(int i=0; i<temp.getRow(); i++){
-            for(int j=0; j<temp.getCol(); j++)
-                temp[i][j]-=val;
-        }
-        return temp;
+    MtmMat<T> operator+(const typename MtmMat<T>::value_type& val,
+                        MtmMat<T>&& mat){
+        mat=val+mat;
+        return std::move(mat);
     }
 
-    template <typename T>
-    MtmMat<T> operator-(const T &val,const MtmMat<T>& mat){
-        return (-mat)+val;
+    template <typename T, typename R>
+    MtmMat<T> operator-(MtmMat<T>&& mat, const MtmExpr<R>& expr){
+        mat=mat-expr;
+        return std::move(mat);
     }
 
-    template <typename T>
-    MtmMat<T> MtmMat<T>::operator-() const{
-        MtmMat<T> res_mat(dim,T());
-        for(int i=0; i<getRow(); i++){
-            for(int j=0; j<getCol(); j++)
-                res_mat[i][j]=-matrix[i][j];
-        }
-        res_mat.dim=dim;
-        return res_mat;
+    template <typename T, typename L>
+    MtmMat<T> operator-(const MtmExpr<L>& expr, MtmMat<T>&& mat){
+        mat=expr-mat;
+        return std::move(mat);
     }
 
     template <typename T>
-    MtmMat<T> operator*(MtmMat<T>& mat, const T &val){
-        MtmMat<T> res(mat);
-        for(int i=0; i<res.getRow(); i++){
-            for(int j=0; j<res.getCol(); j++)
-                res[i][j]*=val;
-        }
-        return res;
+    MtmMat<T> operator-(MtmMat<T>&& mat1, MtmMat<T>&& mat2){
+        mat1=mat1-mat2;
+        return std::move(mat1);
     }
 
     template <typename T>
-    MtmMat<T> operator*(const T &val, MtmMat<T>& mat){
-        return mat*val;
+    MtmMat<T> operator-(MtmMat<T>&& mat,
+                        const typename MtmMat<T>::value_type& val){
+        mat=mat-val;
+        return std::move(mat);
     }
 
     template <typename T>
-    MtmMat<T> operator*(const MtmMat<T>& mat1, const MtmMat<T>& mat2){
-        MtmMat<T> temp1(mat1);
-        MtmMat<T> temp2(mat2);
-        if (mat1.getCol()!=mat2.getRow()){
-            throw MtmExceptions::DimensionMismatch
-            (mat1.getDim(),mat2.getDim());
-        }
-        Dimensions dim((size_t)mat1.getRow(),(size_t)mat2.getCol());
-        MtmMat<T> res_mat(dim,T());
-        int row_m1=0, row_m2=0, col_m1=0, col_m2=0;
-        for(typename MtmMat<T>::iterator it=res_mat.begin(); it!=res_mat.end();
-        ++it) {
-            while(row_m2 < mat2.getRow()) {
-                *it += temp1[row_m1][col_m1] * temp2[row_m2][col_m2];
-                col_m1++;
-                row_m2++;
-            }
-            col_m1=0;
-            row_m2=0;
-            row_m1++;
-            if(row_m1==mat1.getRow()) {
-                row_m1=0;
-                col_m2++;
-            }
-        }
-        return res_mat;
+    MtmMat<T> operator-(const typename MtmMat<T>::value_type& val,
+                        MtmMat<T>&& mat){
+        mat=val-mat;
+        return std::move(mat);
     }
 
     template <typename T>
-    MtmMat<T> operator*(const MtmMat<T>& mat, const MtmVec<T>& vec){
-        MtmMat<T> temp_mat(vec);
-        return mat*temp_mat;
+    MtmMat<T> operator-(MtmMat<T>&& mat){
+        mat=-mat;
+        return std::move(mat);
     }
 
     template <typename T>
-    MtmMat<T> operator*(const MtmVec<T>& vec, const MtmMat<T>& mat){
-        MtmMat<T> temp_mat(vec);
-        return temp_mat*mat;
+    MtmMat<T> operator*(MtmMat<T>&& mat,
+                        const typename MtmMat<T>::value_type& val){
+        mat=mat*val;
+        return std::move(mat);
     }
 
-
     template <typename T>
-    MtmMat<T> operator*(const MtmVec<T>& vec1, const MtmVec<T>& vec2){
-        MtmMat<T> mat1(vec1);
-        MtmMat<T> mat2(vec2);
-        return mat1*mat2;
+    MtmMat<T> operator*(const typename MtmMat<T>::value_type& val,
+                        MtmMat<T>&& mat){
+        mat=val*mat;
+        return std::move(mat);
     }
 
                             ////////Matrix Functions////////
 
+    /*
+     * A packed triangle turns into the opposite packed triangle, only the
+     * stored half is moved. A full matrix only changes the order it is read
+     * in, O(1). Cell locks are dropped.
+     */
     template <typename T>
     void MtmMat<T>::transpose() {
-        Dimensions new_dim=dim;
-        new_dim.transpose();
-        MtmMat<T> new_mat(new_dim,T());
-        unlockMatrix(); // for handling triangle matrices
-        for (int i=0;i<new_mat.getCol();i++){
-            for(int j=0;j<new_mat.getRow();j++){
-                new_mat[j][i]=matrix[i][j];
+        MTM_STATS_OP(TRANSPOSE);
+        if (layout!=FULL){
+            size_t n=dim.getRow();
+            bool upper=layout==PACKED_UPPER;
+            MtmMat<T> new_mat(n,T(),upper ? PACKED_LOWER : PACKED_UPPER);
+            for (size_t i=0;i<n;i++){
+                for (size_t j=colBegin(i);j<colEnd(i);j++){
+                    new_mat.rowData(j)[i]=rowData(i)[j];
+                }
             }
+            data.swap(new_mat.data);
+            layout=new_mat.layout;
+            lock.clear();
+            return;
         }
-        matrix=new_mat.matrix;
-        dim=new_dim;
+        trans=!trans; //the rows become the columns, ld stays
+        dim.transpose();
+        lock.clear();
+    }
+
+    /*
+     * Rewrites a transposed view row by row: a square one in place, a
+     * rectangular one into a recycled buffer. Cell locks move along.
+     */
+    template <typename T>
+    void MtmMat<T>::materialize(){
+        if (!trans) return;
+        MTM_STATS_OP(MATERIALIZE);
+        size_t rows=dim.getRow(), cols=dim.getCol();
+        vector<bool> new_lock;
+        try {
+            if (!lock.empty()){
+                new_lock.resize(lock.size());
+                for (size_t j=0;j<cols;j++){
+                    for (size_t i=0;i<rows;i++){
+                        new_lock[i*cols+j]=lock[j*ld+i];
+                    }
+                }
+            }
+            if (rows==cols){
+                MtmKernels::transposeInPlace(data.data(),ld,rows);
+            }
+            else {
+                vector<T, AlignedAllocator<T> >& spare=spareBuffer();
+                spare.resize(rows*cols);
+                MtmKernels::transposeCopy(data.data(),ld,spare.data(),cols,
+                                          cols,rows);
+                data.swap(spare); //the old buffer is kept for the next one
+            }
+        }
+        catch (std::bad_alloc& e) {throw MtmExceptions::OutOfMemory();}
+        lock.swap(new_lock);
+        ld=cols;
+        trans=false;
     }
 
 
+    /*
+     * A packed triangle stays packed (derived classes only allow square
+     * sizes for it); cells of the stored half keep their value and locks.
+     */
     template <typename T>
     void MtmMat<T>::resize(Dimensions new_dim, const T& val){
+        MTM_STATS_OP(RESIZE);
         if (new_dim.getCol()==0||new_dim.getRow()==0){
             throw MtmExceptions::ChangeMatFail(dim,new_dim);
         }
-        MtmMat<T> new_mat(new_dim,val);
-        unlockMatrix(); //for handling triangle matrices
-        for(int i=0; i<new_mat.getRow(); i++) {
-            for (int j = 0; j < new_mat.getCol(); j++){
-                if (i<getRow()&&j<getCol()){
-                    new_mat[i][j]=matrix[i][j];
+        if (layout!=FULL&&new_dim.getRow()==new_dim.getCol()){
+            size_t n=new_dim.getRow();
+            size_t old_n=dim.getRow();
+            MtmMat<T> new_mat(n,val,layout);
+            for (size_t i=0;i<n&&i<old_n;i++){
+                size_t end=std::min(colEnd(i),n);
+                for (size_t j=colBegin(i);j<end;j++){
+                    new_mat.rowData(i)[j]=rowData(i)[j];
+                    if (isLocked(i,j)) new_mat.setLocked(i,j,true);
                 }
             }
+            *this=std::move(new_mat);
+            return;
+        }
+        MtmMat<T> new_mat(new_dim,val);
+        unlockMatrix(); //for handling triangle matrices
+        materialize();
+        size_t cols=std::min(dim.getCol(),new_dim.getCol());
+        for(size_t i=0; i<dim.getRow()&&i<new_dim.getRow(); i++) {
+            std::copy(rowData(i),rowData(i)+cols,new_mat.rowData(i));
         }
-        matrix=new_mat.matrix;
+        data.swap(new_mat.data);
+        ld=new_mat.ld;
+        trans=false;
         dim=new_dim;
     }
 
+    /*
+     * The elements keep their column major order, the order the iterators
+     * visit them in. It is the order of a transposed view, so the result is
+     * one and reshaping it again costs O(1).
+     */
     template <typename T>
     void MtmMat<T>::reshape(Dimensions newDim) {
+        MTM_STATS_OP(RESHAPE);
         if (dim.getRow()*dim.getCol()!=newDim.getCol()*newDim.getRow()){
             throw MtmExceptions::ChangeMatFail(dim,newDim);
         }
-        MtmMat<T> new_mat(newDim,T());
-        MtmMat<T>::iterator old_mat_it=this->begin();
-        MtmMat<T>::iterator new_mat_it=new_mat.begin();
-        while(new_mat_it!=new_mat.end()){
-            *new_mat_it=*old_mat_it;
-            ++old_mat_it;
-            ++new_mat_it;
+        //locked cells, the zero half of a packed triangle included, can't
+        //be moved
+        if (layout!=FULL||
+            std::find(lock.begin(),lock.end(),true)!=lock.end()){
+            throw MtmExceptions::AccessIllegalElement();
+        }
+        if (!trans){
+            try {
+                vector<T, AlignedAllocator<T> >& spare=spareBuffer();
+                spare.resize(data.size());
+                MtmKernels::transposeCopy(data.data(),ld,spare.data(),
+                                          dim.getRow(),dim.getRow(),
+                                          dim.getCol());
+                data.swap(spare);
+            }
+            catch (std::bad_alloc& e) {throw MtmExceptions::OutOfMemory();}
         }
-        matrix=new_mat.matrix;
+        //data now holds the elements column by column, which is also the
+        //order of the reshaped matrix, read as a transposed view
+        lock.clear();
+        trans=true;
+        ld=newDim.getRow();
         dim=newDim;
     }
 
+    /*
+     * Every column is reduced by its own Func, fed from top to bottom. The
+     * matrix is read once in memory order, keeping one Func per column,
+     * without copying it.
+     */
     template <typename T>
     template <typename Func>
     MtmVec<T> MtmMat<T>::matFunc(Func& f) const{
-        MtmVec<T> res((size_t)getCol(),T());
-        MtmMat<T> temp = *this;
-        temp.transpose(); //work on columns instead of rows
+        MTM_STATS_OP(REDUCE);
+        size_t cols=dim.getCol();
+        MtmVec<T> res(cols,T());
         res.transpose(); //vector returned needs to be a row vector
-        for (int i = 0; i < getCol(); i++) {
-            Func g;
-            res[i] = temp[i].vecFunc(g);
+        vector<Func> funcs;
+        try {
+            funcs.resize(cols);
+            reduceColumns(funcs,MtmKernels::MergeTag<Func>());
+        }
+        catch (std::bad_alloc& e) {throw MtmExceptions::OutOfMemory();}
+        for (size_t j=0;j<cols;j++){
+            res[j]=*funcs[j];
         }
         return res;
     }
 
+    /*
+     * A Func without merge may share state with the others (a counter, a
+     * table), so the columns are reduced one by one on this thread.
+     */
+    template <typename T>
+    template <typename Func>
+    void MtmMat<T>::reduceColumns(vector<Func>& funcs, std::false_type) const{
+        reduceBlock(0,dim.getRow(),0,dim.getCol(),funcs);
+    }
+
+    /*
+     * A tall matrix is cut into blocks of rows, each reduced by new Funcs
+     * on the thread pool and merged into funcs in order. Wide matrices
+     * have enough columns to split them between the threads instead, each
+     * reducing all the rows of its own columns.
+     */
+    template <typename T>
+    template <typename Func>
+    void MtmMat<T>::reduceColumns(vector<Func>& funcs, std::true_type) const{
+        size_t rows=dim.getRow(), cols=dim.getCol();
+        size_t block_rows=std::max<size_t>(1,MtmKernels::REDUCE_BLOCK/cols);
+        size_t blocks=(rows+block_rows-1)/block_rows;
+        if (blocks<2||cols*cols>MtmKernels::REDUCE_BLOCK){
+            size_t threads=threadPool().size();
+            size_t parts=(threads==1||rows*cols<MtmKernels::REDUCE_BLOCK)
+                         ? 1 : std::min(cols,4*threads);
+            threadPool().parallelFor(0,parts,[&](size_t p){
+                reduceBlock(0,rows,cols*p/parts,cols*(p+1)/parts,funcs);
+            });
+            return;
+        }
+        vector<vector<Func> > parts(blocks);
+        threadPool().parallelFor(0,blocks,[&](size_t b){
+            parts[b].resize(cols);
+            reduceBlock(b*block_rows,std::min(rows,(b+1)*block_rows),0,cols,
+                        parts[b]);
+        });
+        for (size_t b=0;b<blocks;b++){
+            for (size_t j=0;j<cols;j++){
+                funcs[j].merge(parts[b][j]);
+            }
+        }
+    }
+
+    /*
+     * Feeds rows [row_begin,row_end) of columns [col_begin,col_end) to
+     * funcs, funcs[j] getting column j. The zero half of a packed triangle
+     * is fed as zeros.
+     */
+    template <typename T>
+    template <typename Func>
+    void MtmMat<T>::reduceBlock(size_t row_begin, size_t row_end,
+                                size_t col_begin, size_t col_end,
+                                vector<Func>& funcs) const{
+        if (trans){ //columns are contiguous
+            for (size_t j=col_begin;j<col_end;j++){
+                const T* line=data.data()+j*ld;
+                Func& g=funcs[j];
+                for (size_t i=row_begin;i<row_end;i++){
+                    g(line[i]);
+                }
+            }
+            return;
+        }
+        for (size_t i=row_begin;i<row_end;i++){
+            const T* row=rowData(i);
+            size_t lo=std::min(std::max(colBegin(i),col_begin),col_end);
+            size_t hi=std::max(std::min(colEnd(i),col_end),lo);
+            size_t j=col_begin;
+            for (;j<lo;j++) funcs[j](zero());
+            for (;j<hi;j++) funcs[j](row[j]);
+            for (;j<col_end;j++) funcs[j](zero());
+        }
+    }
+
                             ////////Helper functions////////
 
     template <typename T>
@@ -418,11 +926,236 @@ namespace MtmMath {
      */
     template <typename T>
     void MtmMat<T>::unlockMatrix(){
-        for (int i=0;i<getRow();i++){
-            for (int j=0;j<getCol();j++){
-                matrix[i].unlockCell(j);
+        unpack();
+        lock.clear();
+    }
+
+    /*
+     * false for the zero half of a packed triangle, which has no storage.
+     */
+    template <typename T>
+    bool MtmMat<T>::isStored(size_t row, size_t col) const{
+        return layout==FULL || (layout==PACKED_UPPER ? col>=row : col<=row);
+    }
+
+    /*
+     * Index of a stored cell in data.
+     */
+    template <typename T>
+    size_t MtmMat<T>::offset(size_t row, size_t col) const{
+        if (layout==FULL) return trans ? col*ld+row : row*ld+col;
+        return MtmKernels::packedRowOrigin(dim.getRow(),row,
+                                           layout==PACKED_UPPER)+col;
+    }
+
+    /*
+     * Columns [colBegin(row),colEnd(row)) of a row are stored, at
+     * rowData(row)[col]. Not for transposed views, whose rows are strided.
+     */
+    template <typename T>
+    size_t MtmMat<T>::colBegin(size_t row) const{
+        return layout==PACKED_UPPER ? row : 0;
+    }
+
+    template <typename T>
+    size_t MtmMat<T>::colEnd(size_t row) const{
+        return layout==PACKED_LOWER ? row+1 : dim.getCol();
+    }
+
+    template <typename T>
+    T* MtmMat<T>::rowData(size_t row){
+        return data.data()+offset(row,0);
+    }
+
+    template <typename T>
+    const T* MtmMat<T>::rowData(size_t row) const{
+        return data.data()+offset(row,0);
+    }
+
+    /*
+     * Expands a packed triangle to a full matrix whose other half is zero
+     * and locked, so that it can be unlocked and written to.
+     */
+    template <typename T>
+    void MtmMat<T>::unpack(){
+        if (layout==FULL) return;
+        size_t n=dim.getRow();
+        vector<T, AlignedAllocator<T> > full;
+        vector<bool> full_lock;
+        try {
+            unpackInto(full);
+            full_lock.assign(n*n,true);
+        }
+        catch (std::bad_alloc& e) {throw MtmExceptions::OutOfMemory();}
+        for (size_t i=0;i<n;i++){
+            for (size_t j=colBegin(i);j<colEnd(i);j++){
+                full_lock[i*n+j]=!lock.empty() && lock[offset(i,j)];
+            }
+        }
+        data.swap(full);
+        lock.swap(full_lock);
+        layout=FULL;
+        ld=n;
+    }
+
+    /*
+     * Writes all the elements, zeros included, row major into full.
+     */
+    template <typename T>
+    void MtmMat<T>::unpackInto(vector<T, AlignedAllocator<T> >& full) const{
+        size_t n=dim.getRow();
+        full.assign(n*n,T());
+        for (size_t i=0;i<n;i++){
+            for (size_t j=colBegin(i);j<colEnd(i);j++){
+                full[i*n+j]=rowData(i)[j];
+            }
+        }
+    }
+
+    /*
+     * The zero half of a packed triangle is always locked.
+     */
+    template <typename T>
+    bool MtmMat<T>::isLocked(size_t row, size_t col) const{
+        if (layout==FULL&&lock.empty()) return false; //the common case
+        return !isStored(row,col) ||
+               (!lock.empty() && lock[offset(row,col)]);
+    }
+
+    /*
+     * The lock map is only allocated once the first cell is locked, so
+     * matrices that never lock a cell don't pay for it.
+     */
+    template <typename T>
+    void MtmMat<T>::setLocked(size_t row, size_t col, bool locked){
+        assert(row<dim.getRow() && col<dim.getCol());
+        if (!isStored(row,col)){
+            if (locked) return;
+            unpack(); //unlocking a cell of the zero half needs storage for it
+        }
+        if (lock.empty()){
+            if (!locked) return;
+            try {
+                lock.assign(data.size(),false);
             }
+            catch (std::bad_alloc& e) {throw MtmExceptions::OutOfMemory();}
         }
+        lock[offset(row,col)]=locked;
+    }
+
+    /*
+     * What the zero half of a packed triangle reads as.
+     */
+    template <typename T>
+    const T& MtmMat<T>::zero(){
+        static const T zero_element=T();
+        return zero_element;
+    }
+
+    template <typename T>
+    T& MtmMat<T>::atUnchecked(size_t row, size_t col){
+        assert(row<dim.getRow() && col<dim.getCol() && isStored(row,col));
+        return data[offset(row,col)];
+    }
+
+    template <typename T>
+    const T& MtmMat<T>::atUnchecked(size_t row, size_t col) const{
+        assert(row<dim.getRow() && col<dim.getCol());
+        return exprAt(*this,row,col);
+    }
+
+    template <typename T>
+    T* MtmMat<T>::rowPtr(size_t row){
+        assert(row<dim.getRow());
+        materialize();
+        unpack();
+        return rowData(row);
+    }
+
+    /*
+     * Element access used by expression nodes.
+     */
+    template <typename T>
+    const T& exprAt(const MtmMat<T>& mat, size_t row, size_t col){
+        if (mat.layout==MtmMat<T>::FULL&&!mat.trans){
+            return mat.data[row*mat.ld+col];
+        }
+        return mat.isStored(row,col) ? mat.data[mat.offset(row,col)] :
+               MtmMat<T>::zero();
+    }
+
+    template <typename T>
+    const T* exprData(const MtmMat<T>& mat){
+        bool contiguous=mat.layout==MtmMat<T>::FULL&&!mat.trans&&
+                        mat.ld==mat.dim.getCol();
+        return contiguous ? mat.data.data() : nullptr;
+    }
+
+                        ////////Row views////////
+
+    template <typename T>
+    MtmMat<T>::row_view::row_view(MtmMat<T>* mat, size_t row) :
+    mat_ptr(mat), row(row) {}
+
+    /*
+     * Gives access to the element in column pos of the row. If pos is out of
+     * the row's range or the cell is locked, AccessIllegalElement() exception
+     * will be thrown.
+     */
+    template <typename T>
+    T& MtmMat<T>::row_view::operator[](int pos){
+        size_t pos_unsigned=(size_t)pos;
+        if (pos_unsigned>=mat_ptr->dim.getCol()||
+            mat_ptr->isLocked(row,pos_unsigned)){
+            throw MtmExceptions::AccessIllegalElement();
+        }
+        return mat_ptr->data[mat_ptr->offset(row,pos_unsigned)];
+    }
+
+    template <typename T>
+    int MtmMat<T>::row_view::size() const{
+        return (int)mat_ptr->dim.getCol();
+    }
+
+    template <typename T>
+    bool MtmMat<T>::row_view::isCellLocked(int pos) const{
+        return mat_ptr->isLocked(row,(size_t)pos);
+    }
+
+    template <typename T>
+    void MtmMat<T>::row_view::lockCell(int pos){
+        assert(pos>=0);
+        mat_ptr->setLocked(row,(size_t)pos,true);
+    }
+
+    template <typename T>
+    void MtmMat<T>::row_view::unlockCell(int pos){
+        assert(pos>=0);
+        mat_ptr->setLocked(row,(size_t)pos,false);
+    }
+
+    template <typename T>
+    MtmMat<T>::const_row_view::const_row_view(const MtmMat<T>* mat,
+                                              size_t row) :
+    mat_ptr(mat), row(row) {}
+
+    template <typename T>
+    const T& MtmMat<T>::const_row_view::operator[](int pos) const{
+        size_t pos_unsigned=(size_t)pos;
+        if (pos_unsigned>=mat_ptr->dim.getCol()){
+            throw MtmExceptions::AccessIllegalElement();
+        }
+        return exprAt(*mat_ptr,row,pos_unsigned);
+    }
+
+    template <typename T>
+    int MtmMat<T>::const_row_view::size() const{
+        return (int)mat_ptr->dim.getCol();
+    }
+
+    template <typename T>
+    bool MtmMat<T>::const_row_view::isCellLocked(int pos) const{
+        return mat_ptr->isLocked(row,(size_t)pos);
     }
 
                         ////////Iterators////////
@@ -450,6 +1183,16 @@ namespace MtmMath {
         return (*mat_ptr)[row][col];
     }
 
+    template <typename T>
+    int MtmMat<T>::iterator::getRow() const{
+        return row;
+    }
+
+    template <typename T>
+    int MtmMat<T>::iterator::getCol() const{
+        return col;
+    }
+
     template <typename T>
     bool MtmMat<T>::iterator::operator!=(const iterator &j)
     const {
@@ -472,39 +1215,125 @@ namespace MtmMath {
         return iterator(this,0,getCol(),dim);
     }
 
+    /*
+     * Buffer a rectangular materialize() writes into, one per thread. It gets
+     * the replaced buffer in exchange, so transposing matrices of the same
+     * size over and over allocates only once.
+     */
+    template <typename T>
+    vector<T, AlignedAllocator<T> >& MtmMat<T>::spareBuffer(){
+        static thread_local vector<T, AlignedAllocator<T> > spare;
+        return spare;
+    }
+
     template <typename T>
     MtmMat<T>::nonzero_iterator::nonzero_iterator(MtmMat<T>* mat, int row,
                                                   int col,Dimensions d):
-    MtmMat<T>::iterator(mat,row,col,d){}
+    MtmMat<T>::iterator(mat,row,col,d), block((size_t)-1), rows(), masks(),
+    next(0){}
 
+    /*
+     * Finds the stored nonzeros of columns [first_col,first_col+BLOCK) of
+     * every row. Memory is O(rows), whatever the number of nonzeros.
+     */
     template <typename T>
-    void MtmMat<T>::nonzero_iterator::operator++(){
-        if (*this==(*this->mat_ptr).nzend()){
-            return;
-        }
-        MtmMat<T>::iterator::operator++();
-        while (*this!=(*this->mat_ptr).nzend()) {
-            if ((*this->mat_ptr)[this->row].isCellLocked(this->col)){
-                MtmMat<T>::iterator::operator++(); //if cell is locked it is 0
+    void MtmMat<T>::nonzero_iterator::scanBlock(size_t first_col){
+        MTM_STATS_OP(NONZERO_SCAN);
+        const MtmMat<T>& m=*this->mat_ptr;
+        size_t end_col=std::min(first_col+BLOCK,m.dim.getCol());
+        rows.clear();
+        masks.clear();
+        block=(size_t)-1; //until the scan is complete
+        try {
+            for (size_t i=0;i<m.dim.getRow();i++){
+                size_t begin=std::max(first_col,m.colBegin(i));
+                size_t end=std::min(end_col,m.colEnd(i));
+                if (begin>=end) continue;
+                const T* line=m.rowData(i);
+                uint64_t mask[WORDS]={};
+                bool found=false;
+                for (size_t j=begin;
+                     (j+=MtmKernels::findNonzero(line+j,end-j))<end;j++){
+                    mask[(j-first_col)/64]|=(uint64_t)1<<(j-first_col)%64;
+                    found=true;
+                }
+                if (found){
+                    rows.push_back(i);
+                    masks.insert(masks.end(),mask,mask+WORDS);
+                }
             }
-            else{
-                if ((*this->mat_ptr)[this->row][this->col]==T()){
-                    MtmMat<T>::iterator::operator++(); //skip zero elements
+        }
+        catch (std::bad_alloc& e) {throw MtmExceptions::OutOfMemory();}
+        block=first_col;
+    }
+
+    /*
+     * Moves to the first nonzero, unlocked element at or after (row,col)
+     * in column major order, or to the end. next_row, if given, is the
+     * index in rows to start looking from. A transposed view stores
+     * columns contiguously and is scanned straight down each one.
+     */
+    template <typename T>
+    void MtmMat<T>::nonzero_iterator::seek(size_t row, size_t col,
+                                           size_t next_row){
+        const MtmMat<T>& m=*this->mat_ptr;
+        size_t n_rows=m.dim.getRow(), n_cols=m.dim.getCol();
+        for (;col<n_cols;col++,row=0,next_row=0){
+            if (m.trans){
+                const T* line=m.data.data()+col*m.ld;
+                for (;(row+=MtmKernels::findNonzero(line+row,n_rows-row))<
+                      n_rows;row++){
+                    if (!m.isLocked(row,col)) break;
                 }
-                else {
-                    return;
+                if (row<n_rows) break;
+                continue;
+            }
+            size_t first_col=col/BLOCK*BLOCK;
+            if (block!=first_col){
+                scanBlock(first_col);
+                next_row=(size_t)-1;
+            }
+            size_t word=(col-first_col)/64;
+            uint64_t bit=(uint64_t)1<<(col-first_col)%64;
+            size_t k=next_row!=(size_t)-1 ? next_row :
+                     std::lower_bound(rows.begin(),rows.end(),row)-
+                     rows.begin();
+            for (;k<rows.size();k++){
+                size_t i=rows[k];
+                if ((masks[k*WORDS+word]&bit)&&!m.isLocked(i,col)&&
+                    m.data[m.offset(i,col)]!=T()){
+                    break;
                 }
             }
+            if (k<rows.size()){
+                row=rows[k];
+                next=k;
+                break;
+            }
+        }
+        if (col<n_cols){
+            this->row=(int)row;
+            this->col=(int)col;
+        }
+        else {
+            this->row=0;
+            this->col=(int)n_cols;
         }
     }
 
+    template <typename T>
+    void MtmMat<T>::nonzero_iterator::operator++(){
+        if (this->col>=(int)this->dim.getCol()){
+            return;
+        }
+        seek((size_t)this->row+1,(size_t)this->col,
+             block!=(size_t)-1&&!this->mat_ptr->trans ? next+1 : (size_t)-1);
+    }
+
     template <typename T>
     typename MtmMat<T>::nonzero_iterator MtmMat<T>::nzbegin(){
         nonzero_iterator it(this,0,0,dim);
-        if (matrix[0][0]!=T()){
-            return it;
-        }
-        ++it;
+        it.seek(0,0,(size_t)-1);
         return it;
     }
 
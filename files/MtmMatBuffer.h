@@ -0,0 +1,140 @@
+#ifndef EX3_MTMMATBUFFER_H
+#define EX3_MTMMATBUFFER_H
+
+#include <vector>
+#include <memory>
+#include "MtmExceptions.h"
+#include "MtmAllocator.h"
+
+using std::size_t;
+using std::vector;
+
+namespace MtmMath {
+
+    /*
+     * The element buffer of a matrix: an AlignedAllocator vector, or a read
+     * only range of memory owned by someone else (a mapped file, see
+     * MtmMatFile.h) that is kept alive by a shared pointer. Copies of a
+     * borrowed buffer borrow the same range, and the first non-const access
+     * copies it into the vector, so reading never copies and a writable copy
+     * only pays when it is written to. The range stays alive as long as the
+     * buffer, so pointers read from it before that first write stay valid.
+     * Only the operations MtmMat needs are provided, with the same meaning
+     * as for vector.
+     */
+    template <typename T>
+    class MatBuffer {
+    public:
+        typedef vector<T, AlignedAllocator<T> > Vector;
+
+        MatBuffer() : owned(), owner(), borrowed(nullptr), elems(nullptr),
+        count(0) {}
+        MatBuffer(const MatBuffer& other) : MatBuffer() {
+            *this = other;
+        }
+        MatBuffer(MatBuffer&& other) noexcept : MatBuffer() {
+            *this = std::move(other);
+        }
+
+        MatBuffer& operator=(const MatBuffer& other) {
+            if (this == &other) return *this;
+            if (other.borrowed != nullptr) {
+                Vector().swap(owned);
+            }
+            else {
+                owned = other.owned;
+            }
+            owner = other.owner;
+            borrowed = other.borrowed;
+            count = other.count;
+            sync();
+            return *this;
+        }
+
+        MatBuffer& operator=(MatBuffer&& other) noexcept {
+            if (this == &other) return *this;
+            owned = std::move(other.owned);
+            owner = std::move(other.owner);
+            borrowed = other.borrowed;
+            count = other.count;
+            other.borrowed = nullptr;
+            other.count = 0;
+            other.sync();
+            sync();
+            return *this;
+        }
+
+        /*
+         * Reads the n elements at elems in place, owner keeps them alive.
+         */
+        void borrow(std::shared_ptr<const void> owner_t, const T* elems_t,
+                    size_t n) {
+            Vector().swap(owned);
+            owner = std::move(owner_t);
+            borrowed = elems_t;
+            count = n;
+            sync();
+        }
+        bool isBorrowed() const { return borrowed != nullptr; }
+
+        void assign(size_t n, const T& val) {
+            borrowed = nullptr;
+            owned.assign(n, val);
+            sync();
+        }
+        void resize(size_t n) {
+            own();
+            owned.resize(n);
+            sync();
+        }
+        void swap(MatBuffer& other) {
+            owned.swap(other.owned);
+            owner.swap(other.owner);
+            std::swap(borrowed, other.borrowed);
+            std::swap(count, other.count);
+            sync();
+            other.sync();
+        }
+        void swap(Vector& other) {
+            own();
+            owned.swap(other);
+            sync();
+        }
+
+        size_t size() const { return count; }
+        size_t max_size() const { return owned.max_size(); }
+        T* data() {
+            own();
+            return owned.data();
+        }
+        const T* data() const { return elems; }
+        T* begin() { return data(); }
+        const T* begin() const { return elems; }
+        T& operator[](size_t i) { return data()[i]; }
+        const T& operator[](size_t i) const { return elems[i]; }
+
+    private:
+        Vector owned;
+        std::shared_ptr<const void> owner;
+        const T* borrowed; //nullptr once the elements are owned
+        const T* elems; //the elements, wherever they are
+        size_t count;
+
+        void sync() {
+            if (borrowed == nullptr) count = owned.size();
+            elems = borrowed != nullptr ? borrowed : owned.data();
+        }
+        void own() {
+            if (borrowed == nullptr) return;
+            try {
+                owned.assign(borrowed, borrowed + count);
+            }
+            catch (std::bad_alloc& e) {throw MtmExceptions::OutOfMemory();}
+            borrowed = nullptr;
+            sync();
+        }
+    };
+
+}
+
+#endif //EX3_MTMMATBUFFER_H
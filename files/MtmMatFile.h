@@ -0,0 +1,358 @@
+#ifndef EX3_MTMMATFILE_H
+#define EX3_MTMMATFILE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "MtmExceptions.h"
+#include "MtmMat.h"
+#include "MtmMatSq.h"
+#include "MtmMatTriag.h"
+#include "Complex.h"
+
+using std::size_t;
+using std::string;
+using std::vector;
+
+namespace MtmMath {
+    /*
+     * Binary matrix files (POSIX). A file is a 64 byte Header followed by
+     * the stored elements exactly as they are in memory: row by row, column
+     * by column for a transposed view, or the packed triangle. Loading maps
+     * the file and reads the elements in place, a page is read from disk the
+     * first time it is touched:
+     *
+     *     MtmFile::save(a,"a.mtm");
+     *     auto b=MtmFile::load<MtmMatSq<double> >("a.mtm");
+     *     double x=(*b)[2][3];     //b is read only
+     *     MtmMatSq<double> c(*b);  //copies the elements on the first write
+     *
+     * Cell locks aren't saved. Files are written in the byte order of the
+     * machine and only read on machines with the same one. save replaces a
+     * file instead of writing over it, so saving to a file that is mapped is
+     * safe, but nothing else may truncate the file while it is mapped.
+     */
+    namespace MtmFile {
+        const uint32_t VERSION = 1;
+        const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+        enum Flags { TRANSPOSED = 1, TRIANGULAR = 2, UPPER = 4 };
+
+        struct Header {
+            char magic[8];          //"MTMMAT" and two zeros
+            uint32_t version;
+            uint32_t byte_order;    //BYTE_ORDER_MARK as written
+            uint32_t type;          //ElementType<T>::code
+            uint32_t element_size;
+            uint64_t rows;
+            uint64_t cols;
+            uint64_t ld;
+            uint32_t layout;        //MtmMat::Layout
+            uint32_t flags;
+            uint64_t count;         //elements following the header
+        };
+        static_assert(sizeof(Header) == 64,
+                      "the elements start on a cache line of the mapping");
+
+        /*
+         * Element types a file can hold.
+         */
+        template <typename T>
+        struct ElementType;
+
+        template <>
+        struct ElementType<int> { static const uint32_t code = 1; };
+
+        template <>
+        struct ElementType<float> { static const uint32_t code = 2; };
+
+        template <>
+        struct ElementType<double> { static const uint32_t code = 3; };
+
+        template <>
+        struct ElementType<Complex> { static const uint32_t code = 4; };
+
+        /*
+         * A whole file mapped read only, unmapped when destroyed.
+         */
+        class MappedFile {
+        public:
+            explicit MappedFile(const string& path);
+            ~MappedFile() {
+                munmap(addr, length);
+            }
+            const char* bytes() const { return static_cast<char*>(addr); }
+            size_t size() const { return length; }
+            MappedFile(const MappedFile&) = delete;
+            MappedFile& operator=(const MappedFile&) = delete;
+        private:
+            void* addr;
+            size_t length;
+        };
+
+        inline MappedFile::MappedFile(const string& path) : addr(nullptr),
+        length(0) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) throw MtmExceptions::FileError(path,
+                                                       std::strerror(errno));
+            struct stat st;
+            if (fstat(fd, &st) != 0) {
+                int err = errno;
+                ::close(fd);
+                throw MtmExceptions::FileError(path, std::strerror(err));
+            }
+            if ((size_t)st.st_size < sizeof(Header)) {
+                ::close(fd);
+                throw MtmExceptions::FileError(path, "not a matrix file");
+            }
+            length = (size_t)st.st_size;
+            addr = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+            int err = errno;
+            ::close(fd); //the mapping keeps the file open
+            if (addr == MAP_FAILED) {
+                throw MtmExceptions::FileError(path, std::strerror(err));
+            }
+        }
+
+        /*
+         * A matrix reading its elements from a mapped file, kept alive by
+         * it and its copies. Only const access is given, copies of the
+         * matrix are writable.
+         */
+        template <typename M>
+        class Mapped {
+        public:
+            const M& operator*() const { return mat; }
+            const M* operator->() const { return &mat; }
+        private:
+            M mat;
+            explicit Mapped(M&& mat_t) : mat(std::move(mat_t)) {}
+            friend struct Access;
+        };
+
+        /*
+         * The parts of the matrix classes a file is made of.
+         */
+        struct Access {
+            template <typename T>
+            static Header header(const MtmMat<T>& mat);
+            template <typename T>
+            static const T* elements(const MtmMat<T>& mat) {
+                return mat.data.data();
+            }
+            template <typename M>
+            static Mapped<M> load(const string& path);
+        private:
+            /*
+             * Number of elements a matrix with the layout stores.
+             */
+            static uint64_t storedCount(uint64_t rows, uint64_t cols,
+                                        uint32_t layout) {
+                return layout == MtmMat<int>::FULL ? rows*cols :
+                       rows*(rows + 1)/2;
+            }
+            static void check(const Header& h, size_t element_size,
+                              uint32_t type, size_t file_size,
+                              const string& path);
+            /*
+             * An object of type M to take over the file's elements, after
+             * checking that the file holds such a matrix, like the
+             * conversion constructors do.
+             */
+            template <typename T>
+            static MtmMat<T> shell(const MtmMat<T>*, const Header&) {
+                return MtmMat<T>(Dimensions(1, 1));
+            }
+            template <typename T>
+            static MtmMatSq<T> shell(const MtmMatSq<T>*, const Header& h) {
+                if (h.rows != h.cols) {
+                    throw MtmExceptions::IllegalInitialization();
+                }
+                return MtmMatSq<T>(1);
+            }
+            template <typename T>
+            static MtmMatTriag<T> shell(const MtmMatTriag<T>*,
+                                        const Header& h) {
+                if (!(h.flags & TRIANGULAR)) {
+                    throw MtmExceptions::IllegalInitialization();
+                }
+                return MtmMatTriag<T>(1, T(), (h.flags & UPPER) != 0);
+            }
+        };
+
+        template <typename T>
+        Header Access::header(const MtmMat<T>& mat) {
+            Header h = Header();
+            std::memcpy(h.magic, "MTMMAT\0", sizeof(h.magic));
+            h.version = VERSION;
+            h.byte_order = BYTE_ORDER_MARK;
+            h.type = ElementType<T>::code;
+            h.element_size = sizeof(T);
+            h.rows = mat.dim.getRow();
+            h.cols = mat.dim.getCol();
+            h.ld = mat.ld;
+            h.layout = mat.layout;
+            h.flags = mat.trans ? TRANSPOSED : 0;
+            const MtmMatTriag<T>* triag =
+                    dynamic_cast<const MtmMatTriag<T>*>(&mat);
+            if (triag != nullptr) {
+                h.flags |= TRIANGULAR | (triag->is_upper ? UPPER : 0);
+            }
+            h.count = storedCount(h.rows, h.cols, h.layout);
+            return h;
+        }
+
+        /*
+         * Rejects files this version can't read and headers that don't
+         * describe a matrix whose elements are all in the file.
+         */
+        inline void Access::check(const Header& h, size_t element_size,
+                                  uint32_t type, size_t file_size,
+                                  const string& path) {
+            if (std::memcmp(h.magic, "MTMMAT\0", sizeof(h.magic)) != 0) {
+                throw MtmExceptions::FileError(path, "not a matrix file");
+            }
+            if (h.version != VERSION || h.byte_order != BYTE_ORDER_MARK) {
+                throw MtmExceptions::FileError(path,
+                                               "unsupported file version");
+            }
+            if (h.type != type || h.element_size != element_size) {
+                throw MtmExceptions::FileError(path, "wrong element type");
+            }
+            uint64_t room = (file_size - sizeof(Header))/element_size;
+            bool packed = h.layout != MtmMat<int>::FULL;
+            bool valid = h.layout <= MtmMat<int>::PACKED_LOWER &&
+                         h.rows != 0 && h.cols != 0 && h.rows <= room &&
+                         h.cols <= room && h.count <= room &&
+                         h.count == storedCount(h.rows, h.cols, h.layout) &&
+                         (packed ? h.rows == h.cols && h.ld == h.rows &&
+                                   h.rows < ((uint64_t)1 << 32) &&
+                                   !(h.flags & TRANSPOSED) :
+                          h.rows <= h.count/h.cols &&
+                          h.ld == (h.flags & TRANSPOSED ? h.rows : h.cols));
+            if (!valid) {
+                throw MtmExceptions::FileError(path, "corrupted header");
+            }
+        }
+
+        template <typename M>
+        Mapped<M> Access::load(const string& path) {
+            typedef typename M::value_type T;
+            std::shared_ptr<const MappedFile> file;
+            try {
+                file = std::make_shared<const MappedFile>(path);
+            }
+            catch (std::bad_alloc& e) {throw MtmExceptions::OutOfMemory();}
+            Header h;
+            std::memcpy(&h, file->bytes(), sizeof(h));
+            check(h, sizeof(T), ElementType<T>::code, file->size(), path);
+            M mat = shell(static_cast<const M*>(nullptr), h);
+            MtmMat<T>& base = mat;
+            base.dim = Dimensions(h.rows, h.cols);
+            base.ld = h.ld;
+            base.layout = typename MtmMat<T>::Layout(h.layout);
+            base.trans = (h.flags & TRANSPOSED) != 0;
+            base.lock.clear();
+            base.data.borrow(file, reinterpret_cast<const T*>(
+                    file->bytes() + sizeof(Header)), h.count);
+            return Mapped<M>(std::move(mat));
+        }
+
+        /*
+         * Writes the whole of parts to fd, going on where a large or
+         * interrupted writev stopped short. Returns 0, or the errno of the
+         * failed call.
+         */
+        inline int writeAll(int fd, struct iovec* next, int left) {
+            while (left > 0) {
+                ssize_t n = ::writev(fd, next, left);
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0) return errno;
+                size_t written = (size_t)n;
+                while (left > 0 && written >= next->iov_len) {
+                    written -= next->iov_len;
+                    ++next;
+                    --left;
+                }
+                if (left > 0) {
+                    next->iov_base = static_cast<char*>(next->iov_base) +
+                                     written;
+                    next->iov_len -= written;
+                }
+            }
+            return 0;
+        }
+
+        /*
+         * Writes mat to path with a single writev of the header and the
+         * elements as they are stored. Triangular matrices are marked as
+         * such. The file is written next to path under a temporary name,
+         * flushed to disk and renamed over path, so path always holds a
+         * whole matrix, and matrices still mapped from the file it replaces
+         * (mat itself may be one) keep reading the old one.
+         */
+        template <typename T>
+        void save(const MtmMat<T>& mat, const string& path) {
+            Header h = Access::header(mat);
+            const char* elems =
+                    reinterpret_cast<const char*>(Access::elements(mat));
+            string temp_path = path + ".XXXXXX";
+            vector<char> name(temp_path.begin(), temp_path.end());
+            name.push_back('\0');
+            int fd = mkstemp(name.data());
+            if (fd < 0) throw MtmExceptions::FileError(path,
+                                                       std::strerror(errno));
+            temp_path = name.data();
+            struct iovec parts[2];
+            parts[0].iov_base = &h;
+            parts[0].iov_len = sizeof(h);
+            parts[1].iov_base = const_cast<char*>(elems);
+            parts[1].iov_len = h.count*sizeof(T);
+            int err = fchmod(fd, 0644) != 0 ? errno : 0;
+            if (err == 0) err = writeAll(fd, parts, 2);
+            if (err == 0 && fsync(fd) != 0) err = errno;
+            if (::close(fd) != 0 && err == 0) err = errno;
+            if (err == 0 && ::rename(temp_path.c_str(), path.c_str()) != 0) {
+                err = errno;
+            }
+            if (err != 0) {
+                ::unlink(temp_path.c_str());
+                throw MtmExceptions::FileError(path, std::strerror(err));
+            }
+            //make the rename itself durable
+            size_t slash = path.rfind('/');
+            string dir = slash == string::npos ? string(".") :
+                         path.substr(0, slash + 1);
+            int dir_fd = ::open(dir.c_str(), O_RDONLY);
+            if (dir_fd >= 0) {
+                fsync(dir_fd);
+                ::close(dir_fd);
+            }
+        }
+
+        /*
+         * Maps the matrix saved in path as an M, a MtmMat, MtmMatSq or
+         * MtmMatTriag of the saved element type, without copying it.
+         * MtmExceptions::FileError is thrown if the file can't be read or
+         * holds another element type, and MtmExceptions::
+         * IllegalInitialization if the matrix isn't square (triangular) when
+         * M is.
+         */
+        template <typename M>
+        Mapped<M> load(const string& path) {
+            return Access::load<M>(path);
+        }
+    }
+}
+
+#endif //EX3_MTMMATFILE_H
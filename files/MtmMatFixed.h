@@ -0,0 +1,304 @@
+#ifndef EX3_MTMMATFIXED_H
+#define EX3_MTMMATFIXED_H
+
+#include "MtmExceptions.h"
+#include "Auxilaries.h"
+#include "MtmMat.h"
+
+using std::size_t;
+
+namespace MtmMath {
+    namespace MtmKernels {
+        /*
+         * Compile time lists 0,1,...,N-1, expanded to unroll the element
+         * loops of the fixed size classes.
+         */
+        template <size_t... I>
+        struct IndexList {};
+
+        template <size_t N, size_t... I>
+        struct MakeIndexList : MakeIndexList<N - 1, N - 1, I...> {};
+
+        template <size_t... I>
+        struct MakeIndexList<0, I...> {
+            typedef IndexList<I...> type;
+        };
+    }
+
+    /*
+     * R x C matrix whose dimensions are part of its type, for the many small
+     * (2x2 to 4x4) transforms. The elements are stored row major inside the
+     * object, without any allocation, and operations between matrices of
+     * the wrong dimensions don't compile. Arithmetic is constexpr and every
+     * element loop is unrolled at compile time.
+     * Conversions to and from MtmMat (explicit, see below) give access to
+     * the rest of the library.
+     */
+    template <typename T, size_t R, size_t C>
+    class MtmMatFixed {
+        static_assert(R > 0 && C > 0, "a matrix has at least one element");
+    protected:
+        typedef typename MtmKernels::MakeIndexList<R*C>::type Indices;
+        struct ElementsTag {};
+        T elems[R*C];
+
+        template <typename... U>
+        constexpr MtmMatFixed(ElementsTag, const U&... values) :
+        elems{T(values)...} {}
+        template <size_t... I>
+        constexpr MtmMatFixed(MtmKernels::IndexList<I...>, const T& val) :
+        elems{pick(I, val)...} {}
+
+        static constexpr const T& pick(size_t, const T& val) { return val; }
+        template <size_t... I>
+        static constexpr MtmMatFixed add(const MtmMatFixed& a,
+                                         const MtmMatFixed& b,
+                                         MtmKernels::IndexList<I...>) {
+            return MtmMatFixed(ElementsTag(), (a.elems[I] + b.elems[I])...);
+        }
+        template <size_t... I>
+        static constexpr MtmMatFixed sub(const MtmMatFixed& a,
+                                         const MtmMatFixed& b,
+                                         MtmKernels::IndexList<I...>) {
+            return MtmMatFixed(ElementsTag(), (a.elems[I] - b.elems[I])...);
+        }
+        template <size_t... I>
+        static constexpr MtmMatFixed scale(const MtmMatFixed& a, const T& val,
+                                           MtmKernels::IndexList<I...>) {
+            return MtmMatFixed(ElementsTag(), (a.elems[I]*val)...);
+        }
+        template <size_t... I>
+        static constexpr MtmMatFixed negate(const MtmMatFixed& a,
+                                            MtmKernels::IndexList<I...>) {
+            return MtmMatFixed(ElementsTag(), (-a.elems[I])...);
+        }
+        template <size_t... I>
+        static constexpr MtmMatFixed<T, C, R> transposed(
+                const MtmMatFixed& a, MtmKernels::IndexList<I...>) {
+            return MtmMatFixed<T, C, R>(
+                    typename MtmMatFixed<T, C, R>::ElementsTag(),
+                    a.elems[(I % R)*C + I/R]...);
+        }
+        template <size_t K, size_t... I>
+        static constexpr MtmMatFixed product(const MtmMatFixed<T, R, K>& a,
+                                             const MtmMatFixed<T, K, C>& b,
+                                             MtmKernels::IndexList<I...>);
+        static constexpr bool equal(const MtmMatFixed& a,
+                                    const MtmMatFixed& b, size_t k) {
+            return k == R*C || (a.elems[k] == b.elems[k] &&
+                                equal(a, b, k + 1));
+        }
+
+        template <typename U, size_t R2, size_t C2>
+        friend class MtmMatFixed;
+    public:
+        typedef T value_type;
+        static constexpr size_t rows = R;
+        static constexpr size_t cols = C;
+        /*
+         * Every element gets the value val.
+         */
+        constexpr MtmMatFixed() : MtmMatFixed(Indices(), T()) {}
+        explicit constexpr MtmMatFixed(const T& val) :
+        MtmMatFixed(Indices(), val) {}
+        /*
+         * The R*C elements, row by row.
+         */
+        template <typename... U, typename = typename std::enable_if<
+                  sizeof...(U) == R*C && (R*C > 1)>::type>
+        constexpr MtmMatFixed(const U&... values) :
+        elems{T(values)...} {}
+        /*
+         * Copy of a MtmMat of the same dimensions, MtmExceptions::
+         * DimensionMismatch is thrown otherwise. Locked cells are copied.
+         */
+        explicit MtmMatFixed(const MtmMat<T>& mat);
+        /*
+         * MtmMat with the same elements.
+         */
+        explicit operator MtmMat<T>() const;
+
+        /*
+         * m[i][j] is element (i,j). No range checks, the dimensions are
+         * known at compile time. Temporaries are read only, so results can
+         * be indexed in constant expressions.
+         */
+        T* operator[](size_t row) & { return elems + row*C; }
+        constexpr const T* operator[](size_t row) const & {
+            return elems + row*C;
+        }
+        constexpr const T& operator()(size_t row, size_t col) const {
+            return elems[row*C + col];
+        }
+        T* dataPtr() { return elems; }
+        constexpr const T* dataPtr() const { return elems; }
+        Dimensions getDim() const { return Dimensions(R, C); }
+        constexpr int getRow() const { return (int)R; }
+        constexpr int getCol() const { return (int)C; }
+
+        MtmMatFixed& operator+=(const MtmMatFixed& mat) {
+            return *this = *this + mat;
+        }
+        MtmMatFixed& operator-=(const MtmMatFixed& mat) {
+            return *this = *this - mat;
+        }
+        MtmMatFixed& operator*=(const T& val) {
+            return *this = *this*val;
+        }
+        constexpr MtmMatFixed<T, C, R> transpose() const {
+            return transposed(*this, typename MtmKernels::MakeIndexList<
+                    R*C>::type());
+        }
+
+        friend constexpr MtmMatFixed operator+(const MtmMatFixed& a,
+                                               const MtmMatFixed& b) {
+            return add(a, b, Indices());
+        }
+        friend constexpr MtmMatFixed operator-(const MtmMatFixed& a,
+                                               const MtmMatFixed& b) {
+            return sub(a, b, Indices());
+        }
+        friend constexpr MtmMatFixed operator-(const MtmMatFixed& a) {
+            return negate(a, Indices());
+        }
+        friend constexpr MtmMatFixed operator*(const MtmMatFixed& a,
+                                               const T& val) {
+            return scale(a, val, Indices());
+        }
+        friend constexpr MtmMatFixed operator*(const T& val,
+                                               const MtmMatFixed& a) {
+            return scale(a, val, Indices());
+        }
+        friend constexpr bool operator==(const MtmMatFixed& a,
+                                         const MtmMatFixed& b) {
+            return equal(a, b, 0);
+        }
+        friend constexpr bool operator!=(const MtmMatFixed& a,
+                                         const MtmMatFixed& b) {
+            return !equal(a, b, 0);
+        }
+        template <typename U, size_t R2, size_t K, size_t C2>
+        friend constexpr MtmMatFixed<U, R2, C2> operator*(
+                const MtmMatFixed<U, R2, K>& a,
+                const MtmMatFixed<U, K, C2>& b);
+
+        /*
+         * iterator class- Iterates over the elements column by column, like
+         * MtmMat::iterator.
+         */
+        class iterator {
+        public:
+            iterator(MtmMatFixed* mat, size_t pos) : mat_ptr(mat), pos(pos) {}
+            virtual void operator++() { ++pos; }
+            T& operator*() { return (*mat_ptr)[pos % R][pos/R]; }
+            bool operator!=(const iterator& j) const { return pos != j.pos; }
+            bool operator==(const iterator& j) const { return pos == j.pos; }
+            int getRow() const { return (int)(pos % R); }
+            int getCol() const { return (int)(pos/R); }
+        protected:
+            MtmMatFixed* mat_ptr;
+            size_t pos; //column major
+        };
+        /*
+         * nonzero_iterator class- Visits only the elements that are not
+         * T(), in the same order.
+         */
+        class nonzero_iterator : public iterator {
+        public:
+            nonzero_iterator(MtmMatFixed* mat, size_t pos) :
+            iterator(mat, pos) {
+                skipZeros();
+            }
+            void operator++() override {
+                ++this->pos;
+                skipZeros();
+            }
+        private:
+            void skipZeros() {
+                while (this->pos < R*C && **this == T()) {
+                    ++this->pos;
+                }
+            }
+        };
+        iterator begin() { return iterator(this, 0); }
+        iterator end() { return iterator(this, R*C); }
+        nonzero_iterator nzbegin() { return nonzero_iterator(this, 0); }
+        nonzero_iterator nzend() { return nonzero_iterator(this, R*C); }
+    };
+
+    template <typename T, size_t R, size_t C>
+    constexpr size_t MtmMatFixed<T, R, C>::rows;
+
+    template <typename T, size_t R, size_t C>
+    constexpr size_t MtmMatFixed<T, R, C>::cols;
+
+    namespace MtmKernels {
+        /*
+         * Element (i,j) of a product of fixed size matrices, summed left to
+         * right like the dynamic kernels, unrolled by recursing on k.
+         */
+        template <typename T, size_t R, size_t K, size_t C, size_t k,
+                  bool done = (k == K)>
+        struct FixedDot {
+            static constexpr T sum(const MtmMatFixed<T, R, K>& a,
+                                   const MtmMatFixed<T, K, C>& b, size_t i,
+                                   size_t j, const T& acc) {
+                return FixedDot<T, R, K, C, k + 1>::sum(a, b, i, j,
+                                                        acc + a(i, k)*b(k, j));
+            }
+        };
+
+        template <typename T, size_t R, size_t K, size_t C, size_t k>
+        struct FixedDot<T, R, K, C, k, true> {
+            static constexpr T sum(const MtmMatFixed<T, R, K>&,
+                                   const MtmMatFixed<T, K, C>&, size_t,
+                                   size_t, const T& acc) {
+                return acc;
+            }
+        };
+    }
+
+    template <typename T, size_t R, size_t C>
+    template <size_t K, size_t... I>
+    constexpr MtmMatFixed<T, R, C> MtmMatFixed<T, R, C>::product(
+            const MtmMatFixed<T, R, K>& a, const MtmMatFixed<T, K, C>& b,
+            MtmKernels::IndexList<I...>) {
+        return MtmMatFixed(ElementsTag(),
+                           MtmKernels::FixedDot<T, R, K, C, 0>::sum(
+                                   a, b, I/C, I % C, T())...);
+    }
+
+    /*
+     * Matrix product, defined only when the inner dimensions agree.
+     */
+    template <typename T, size_t R, size_t K, size_t C>
+    constexpr MtmMatFixed<T, R, C> operator*(const MtmMatFixed<T, R, K>& a,
+                                             const MtmMatFixed<T, K, C>& b) {
+        return MtmMatFixed<T, R, C>::template product<K>(
+                a, b, typename MtmKernels::MakeIndexList<R*C>::type());
+    }
+
+    template <typename T, size_t R, size_t C>
+    MtmMatFixed<T, R, C>::MtmMatFixed(const MtmMat<T>& mat) : elems() {
+        if (mat.getDim() != Dimensions(R, C)) {
+            throw MtmExceptions::DimensionMismatch(Dimensions(R, C),
+                                                   mat.getDim());
+        }
+        for (size_t i = 0; i < R; i++) {
+            for (size_t j = 0; j < C; j++) {
+                elems[i*C + j] = mat.atUnchecked(i, j);
+            }
+        }
+    }
+
+    template <typename T, size_t R, size_t C>
+    MtmMatFixed<T, R, C>::operator MtmMat<T>() const {
+        MtmMat<T> mat(Dimensions(R, C));
+        for (size_t i = 0; i < R; i++) {
+            std::copy(elems + i*C, elems + (i + 1)*C, mat.rowPtr(i));
+        }
+        return mat;
+    }
+}
+
+#endif //EX3_MTMMATFIXED_H
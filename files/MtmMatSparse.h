@@ -0,0 +1,538 @@
+#ifndef EX3_MTMMATSPARSE_H
+#define EX3_MTMMATSPARSE_H
+
+#include <vector>
+#include <algorithm>
+#include "MtmExceptions.h"
+#include "Auxilaries.h"
+#include "MtmVec.h"
+#include "MtmMat.h"
+#include "MtmGemm.h"
+#include "MtmThreadPool.h"
+
+using std::size_t;
+using std::vector;
+
+namespace MtmMath {
+    namespace MtmKernels {
+        /*
+         * Sparse products with fewer multiply-adds than this run on the
+         * calling thread only.
+         */
+        const size_t SPARSE_PARALLEL_THRESHOLD = 64*1024;
+    }
+
+    /*
+     * Sparse matrix in compressed sparse row (CSR) form: for every row, the
+     * columns and values of its nonzero elements, in increasing column
+     * order. A compressed sparse column (CSC) copy can be built on demand.
+     * Memory and the cost of every operation grow with the number of
+     * nonzero elements, not with rows x cols.
+     */
+    template <typename T>
+    class MtmMatSparse {
+    private:
+        Dimensions dim;
+        vector<size_t> row_ptr; //row i is [row_ptr[i],row_ptr[i+1])
+        vector<size_t> col_idx;
+        vector<T> values;
+        vector<size_t> col_ptr; //CSC copy, empty unless built
+        vector<size_t> row_idx;
+        vector<T> col_values;
+        vector<size_t> rowRanges(size_t work) const;
+        MtmVec<T> timesVector(const MtmVec<T>& vec) const;
+        MtmMat<T> timesDense(const MtmMat<T>& mat) const;
+        MtmMat<T> denseTimes(const MtmMat<T>& mat) const;
+        template <typename B>
+        void multiplyRows(const B& b, MtmMat<T>& res_mat) const;
+        template <typename A>
+        void multiplyLeft(const A& a, MtmMat<T>& res_mat) const;
+    public:
+        typedef T value_type;
+        /*
+         * Sparse matrix of dimension dim_t, all elements zero.
+         */
+        explicit MtmMatSparse(Dimensions dim_t);
+        /*
+         * Conversion constructor, collects the elements visited by the
+         * matrix's nonzero_iterator (locked cells are taken to be zero).
+         */
+        explicit MtmMatSparse(MtmMat<T>& mat);
+        explicit MtmMatSparse(MtmMat<T>&& mat);
+        int getRow() const;
+        int getCol() const;
+        Dimensions getDim() const;
+        /*
+         * Number of stored (nonzero) elements.
+         */
+        size_t nonZeros() const;
+        /*
+         * Element (row,col), found by binary search in its row. If it is out
+         * of the matrix's range an AccessIllegalElement() exception will be
+         * thrown.
+         */
+        T at(int row, int col) const;
+        MtmMat<T> toDense() const;
+        /*
+         * Builds the CSC copy. It makes transpose a swap of the two forms.
+         */
+        void buildColumns();
+        bool hasColumns() const;
+        /*
+         * Performs transpose operation on matrix, builds the CSC copy first
+         * if needed. The CSC copy of the result is the old CSR form.
+         */
+        void transpose();
+        /*
+         * Sparse products, rows are split into ranges of about the same
+         * number of nonzeros and spread over the MtmMath thread pool.
+         */
+        template <typename U>
+        friend MtmVec<U> multiply(const MtmMatSparse<U>& mat,
+                                  const MtmVec<U>& vec);
+        template <typename U>
+        friend MtmMat<U> multiply(const MtmMatSparse<U>& mat1,
+                                  const MtmMat<U>& mat2);
+        template <typename U>
+        friend MtmMat<U> multiply(const MtmMat<U>& mat1,
+                                  const MtmMatSparse<U>& mat2);
+        template <typename U>
+        friend MtmMatSparse<U> multiply(const MtmMatSparse<U>& mat1,
+                                        const MtmMatSparse<U>& mat2);
+    };
+
+                        ////////Constructors////////
+
+    template <typename T>
+    MtmMatSparse<T>::MtmMatSparse(Dimensions dim_t) try: dim(dim_t),
+    row_ptr(), col_idx(), values(), col_ptr(), row_idx(), col_values() {
+        if (dim_t.getCol()==0||dim_t.getRow()==0) throw
+        MtmExceptions::IllegalInitialization();
+        row_ptr.assign(dim_t.getRow()+1,0);
+    }
+    catch (std::bad_alloc& e){
+        throw MtmExceptions::OutOfMemory();
+    }
+
+    /*
+     * The nonzero_iterator walks the matrix column by column, so sorting its
+     * elements by row (a stable counting sort) leaves the columns of every
+     * row in increasing order.
+     */
+    template <typename T>
+    MtmMatSparse<T>::MtmMatSparse(MtmMat<T>& mat) try:
+    MtmMatSparse(mat.getDim()) {
+        vector<size_t> rows_t;
+        vector<size_t> cols_t;
+        vector<T> values_t;
+        for (typename MtmMat<T>::nonzero_iterator it=mat.nzbegin();
+             it!=mat.nzend();++it){
+            rows_t.push_back((size_t)it.getRow());
+            cols_t.push_back((size_t)it.getCol());
+            values_t.push_back(*it);
+        }
+        for (size_t e=0;e<rows_t.size();e++){
+            row_ptr[rows_t[e]+1]++;
+        }
+        for (size_t i=0;i<dim.getRow();i++){
+            row_ptr[i+1]+=row_ptr[i];
+        }
+        col_idx.resize(values_t.size());
+        values.resize(values_t.size());
+        vector<size_t> next(row_ptr.begin(),row_ptr.end()-1);
+        for (size_t e=0;e<rows_t.size();e++){
+            size_t pos=next[rows_t[e]]++;
+            col_idx[pos]=cols_t[e];
+            values[pos]=values_t[e];
+        }
+    }
+    catch (std::bad_alloc& e){
+        throw MtmExceptions::OutOfMemory();
+    }
+
+    template <typename T>
+    MtmMatSparse<T>::MtmMatSparse(MtmMat<T>&& mat) : MtmMatSparse(mat) {}
+
+                        ////////Sparse matrix functions////////
+
+    template <typename T>
+    int MtmMatSparse<T>::getRow() const{
+        return (int)dim.getRow();
+    }
+
+    template <typename T>
+    int MtmMatSparse<T>::getCol() const{
+        return (int)dim.getCol();
+    }
+
+    template <typename T>
+    Dimensions MtmMatSparse<T>::getDim() const{
+        return dim;
+    }
+
+    template <typename T>
+    size_t MtmMatSparse<T>::nonZeros() const{
+        return values.size();
+    }
+
+    template <typename T>
+    T MtmMatSparse<T>::at(int row, int col) const{
+        size_t row_unsigned=(size_t)row;
+        size_t col_unsigned=(size_t)col;
+        if (row_unsigned>=dim.getRow()||col_unsigned>=dim.getCol()){
+            throw MtmExceptions::AccessIllegalElement();
+        }
+        vector<size_t>::const_iterator begin=col_idx.begin()+
+                                             row_ptr[row_unsigned];
+        vector<size_t>::const_iterator end=col_idx.begin()+
+                                           row_ptr[row_unsigned+1];
+        vector<size_t>::const_iterator it=std::lower_bound(begin,end,
+                                                           col_unsigned);
+        if (it==end||*it!=col_unsigned){
+            return T();
+        }
+        return values[it-col_idx.begin()];
+    }
+
+    template <typename T>
+    MtmMat<T> MtmMatSparse<T>::toDense() const{
+        MtmMat<T> res(dim,T());
+        T* res_data=res.data.data();
+        for (size_t i=0;i<dim.getRow();i++){
+            for (size_t p=row_ptr[i];p<row_ptr[i+1];p++){
+                res_data[i*res.ld+col_idx[p]]=values[p];
+            }
+        }
+        return res;
+    }
+
+    /*
+     * Counting sort of the elements by column. Rows are visited in order,
+     * so the rows of every column come out increasing.
+     */
+    template <typename T>
+    void MtmMatSparse<T>::buildColumns(){
+        if (hasColumns()){
+            return;
+        }
+        try {
+            col_ptr.assign(dim.getCol()+1,0);
+            row_idx.resize(values.size());
+            col_values.resize(values.size());
+        }
+        catch (std::bad_alloc& e) {throw MtmExceptions::OutOfMemory();}
+        for (size_t p=0;p<col_idx.size();p++){
+            col_ptr[col_idx[p]+1]++;
+        }
+        for (size_t j=0;j<dim.getCol();j++){
+            col_ptr[j+1]+=col_ptr[j];
+        }
+        vector<size_t> next(col_ptr.begin(),col_ptr.end()-1);
+        for (size_t i=0;i<dim.getRow();i++){
+            for (size_t p=row_ptr[i];p<row_ptr[i+1];p++){
+                size_t pos=next[col_idx[p]]++;
+                row_idx[pos]=i;
+                col_values[pos]=values[p];
+            }
+        }
+    }
+
+    template <typename T>
+    bool MtmMatSparse<T>::hasColumns() const{
+        return !col_ptr.empty();
+    }
+
+    template <typename T>
+    void MtmMatSparse<T>::transpose(){
+        buildColumns();
+        row_ptr.swap(col_ptr);
+        col_idx.swap(row_idx);
+        values.swap(col_values);
+        dim.transpose();
+    }
+
+                        ////////Products////////
+
+    /*
+     * Splits the rows into ranges of about the same number of nonzeros,
+     * range c being [bounds[c],bounds[c+1]). work is the number of
+     * multiply-adds the product will take, a single range is returned when
+     * it is too small to be worth spreading over the thread pool.
+     */
+    template <typename T>
+    vector<size_t> MtmMatSparse<T>::rowRanges(size_t work) const{
+        size_t threads=threadPool().size();
+        size_t parts=(threads==1||work<MtmKernels::SPARSE_PARALLEL_THRESHOLD)
+                     ? 1 : 4*threads;
+        size_t rows=dim.getRow();
+        size_t nnz=values.size();
+        vector<size_t> bounds(1,0);
+        for (size_t c=1;c<parts;c++){
+            size_t target=nnz*c/parts;
+            size_t row=std::upper_bound(row_ptr.begin(),row_ptr.end(),target)
+                       -row_ptr.begin()-1;
+            if (row>bounds.back()&&row<rows){
+                bounds.push_back(row);
+            }
+        }
+        bounds.push_back(rows);
+        return bounds;
+    }
+
+    template <typename T>
+    MtmVec<T> MtmMatSparse<T>::timesVector(const MtmVec<T>& vec) const{
+        if (vec.getDim()!=Dimensions(dim.getCol(),1)){
+            throw MtmExceptions::DimensionMismatch(dim,vec.getDim());
+        }
+        MtmVec<T> res(dim.getRow(),T());
+        const T* x=vec.data.data();
+        T* y=res.data.data();
+        vector<size_t> bounds=rowRanges(nonZeros());
+        threadPool().parallelFor(0,bounds.size()-1,[&](size_t r){
+            for (size_t i=bounds[r];i<bounds[r+1];i++){
+                T sum=T();
+                for (size_t p=row_ptr[i];p<row_ptr[i+1];p++){
+                    sum+=values[p]*x[col_idx[p]];
+                }
+                y[i]=sum;
+            }
+        });
+        return res;
+    }
+
+    template <typename T>
+    MtmVec<T> multiply(const MtmMatSparse<T>& mat, const MtmVec<T>& vec){
+        MTM_STATS_OP(MULTIPLY);
+        return mat.timesVector(vec);
+    }
+
+    /*
+     * res_mat += this*b, b being the dense operand wrapped for the kernels
+     * (see MtmGemm.h): every nonzero (i,k) adds a multiple of row k of b to
+     * row i of the result.
+     */
+    template <typename T>
+    template <typename B>
+    void MtmMatSparse<T>::multiplyRows(const B& b, MtmMat<T>& res_mat) const{
+        T* c=res_mat.data.data();
+        size_t ldc=res_mat.ld;
+        const size_t b_stride=b.colStride();
+        vector<size_t> bounds=rowRanges(nonZeros()*res_mat.dim.getCol());
+        threadPool().parallelFor(0,bounds.size()-1,[&](size_t r){
+            for (size_t i=bounds[r];i<bounds[r+1];i++){
+                T* c_row=c+i*ldc;
+                for (size_t p=row_ptr[i];p<row_ptr[i+1];p++){
+                    size_t k=col_idx[p];
+                    const T val=values[p];
+                    const T* b_row=b.row(k);
+                    for (size_t j=b.colBegin(k);j<b.colEnd(k);j++){
+                        c_row[j]+=val*b_row[j*b_stride];
+                    }
+                }
+            }
+        });
+    }
+
+    /*
+     * res_mat += a*this: every element (i,k) of a adds a multiple of row k
+     * of this matrix to row i of the result. Rows of a are split evenly.
+     */
+    template <typename T>
+    template <typename A>
+    void MtmMatSparse<T>::multiplyLeft(const A& a, MtmMat<T>& res_mat) const{
+        T* c=res_mat.data.data();
+        size_t ldc=res_mat.ld;
+        const size_t a_stride=a.colStride();
+        size_t rows=res_mat.dim.getRow();
+        size_t work=rows*nonZeros();
+        size_t threads=threadPool().size();
+        size_t parts=(threads==1||work<MtmKernels::SPARSE_PARALLEL_THRESHOLD)
+                     ? 1 : std::min(rows,4*threads);
+        threadPool().parallelFor(0,parts,[&](size_t r){
+            for (size_t i=rows*r/parts;i<rows*(r+1)/parts;i++){
+                T* c_row=c+i*ldc;
+                const T* a_row=a.row(i);
+                for (size_t k=a.colBegin(i);k<a.colEnd(i);k++){
+                    const T val=a_row[k*a_stride];
+                    if (val==T()) continue;
+                    for (size_t p=row_ptr[k];p<row_ptr[k+1];p++){
+                        c_row[col_idx[p]]+=val*values[p];
+                    }
+                }
+            }
+        });
+    }
+
+    /*
+     * this*mat, a packed triangular mat is read without its zero half.
+     */
+    template <typename T>
+    MtmMat<T> MtmMatSparse<T>::timesDense(const MtmMat<T>& mat) const{
+        if (dim.getCol()!=mat.dim.getRow()){
+            throw MtmExceptions::DimensionMismatch(dim,mat.dim);
+        }
+        MtmMat<T> res_mat(Dimensions(dim.getRow(),mat.dim.getCol()),T());
+        if (mat.trans){
+            multiplyRows(MtmKernels::TransposedOperand<T>(mat.data.data(),
+                         mat.ld,mat.dim.getRow(),mat.dim.getCol()),res_mat);
+        }
+        else if (mat.layout==MtmMat<T>::FULL){
+            multiplyRows(MtmKernels::DenseOperand<T>(mat.data.data(),mat.ld,
+                         mat.dim.getRow(),mat.dim.getCol()),res_mat);
+        }
+        else {
+            multiplyRows(MtmKernels::TriangleOperand<T>(mat.data.data(),
+                         mat.dim.getRow(),
+                         mat.layout==MtmMat<T>::PACKED_UPPER),res_mat);
+        }
+        return res_mat;
+    }
+
+    /*
+     * mat*this, a packed triangular mat is read without its zero half.
+     */
+    template <typename T>
+    MtmMat<T> MtmMatSparse<T>::denseTimes(const MtmMat<T>& mat) const{
+        if (mat.dim.getCol()!=dim.getRow()){
+            throw MtmExceptions::DimensionMismatch(mat.dim,dim);
+        }
+        MtmMat<T> res_mat(Dimensions(mat.dim.getRow(),dim.getCol()),T());
+        if (mat.trans){
+            multiplyLeft(MtmKernels::TransposedOperand<T>(mat.data.data(),
+                         mat.ld,mat.dim.getRow(),mat.dim.getCol()),res_mat);
+        }
+        else if (mat.layout==MtmMat<T>::FULL){
+            multiplyLeft(MtmKernels::DenseOperand<T>(mat.data.data(),mat.ld,
+                         mat.dim.getRow(),mat.dim.getCol()),res_mat);
+        }
+        else {
+            multiplyLeft(MtmKernels::TriangleOperand<T>(mat.data.data(),
+                         mat.dim.getRow(),
+                         mat.layout==MtmMat<T>::PACKED_UPPER),res_mat);
+        }
+        return res_mat;
+    }
+
+    template <typename T>
+    MtmMat<T> multiply(const MtmMatSparse<T>& mat1, const MtmMat<T>& mat2){
+        MTM_STATS_OP(MULTIPLY);
+        return mat1.timesDense(mat2);
+    }
+
+    template <typename T>
+    MtmMat<T> multiply(const MtmMat<T>& mat1, const MtmMatSparse<T>& mat2){
+        MTM_STATS_OP(MULTIPLY);
+        return mat2.denseTimes(mat1);
+    }
+
+    /*
+     * Row by row (Gustavson) product: row i of the result sums the rows of
+     * mat2 picked by the nonzeros of row i of mat1, in a dense accumulator
+     * of one row that every range of rows keeps for itself. Elements that
+     * cancel out to zero are not stored.
+     */
+    template <typename T>
+    MtmMatSparse<T> multiply(const MtmMatSparse<T>& mat1,
+                             const MtmMatSparse<T>& mat2){
+        MTM_STATS_OP(MULTIPLY);
+        if (mat1.dim.getCol()!=mat2.dim.getRow()){
+            throw MtmExceptions::DimensionMismatch(mat1.dim,mat2.dim);
+        }
+        size_t rows=mat1.dim.getRow();
+        size_t cols=mat2.dim.getCol();
+        MtmMatSparse<T> res(Dimensions(rows,cols));
+        size_t avg_row=mat2.nonZeros()/mat2.dim.getRow()+1;
+        vector<size_t> bounds=mat1.rowRanges(mat1.nonZeros()*avg_row);
+        size_t ranges=bounds.size()-1;
+        vector<vector<size_t> > range_cols(ranges);
+        vector<vector<T> > range_values(ranges);
+        try {
+            threadPool().parallelFor(0,ranges,[&](size_t r){
+                const size_t none=(size_t)-1;
+                vector<T> acc(cols);
+                vector<size_t> mark(cols,none);
+                vector<size_t> touched;
+                for (size_t i=bounds[r];i<bounds[r+1];i++){
+                    touched.clear();
+                    for (size_t p=mat1.row_ptr[i];p<mat1.row_ptr[i+1];p++){
+                        size_t k=mat1.col_idx[p];
+                        const T val=mat1.values[p];
+                        for (size_t q=mat2.row_ptr[k];q<mat2.row_ptr[k+1];
+                             q++){
+                            size_t j=mat2.col_idx[q];
+                            if (mark[j]!=i){
+                                mark[j]=i;
+                                acc[j]=val*mat2.values[q];
+                                touched.push_back(j);
+                            }
+                            else {
+                                acc[j]+=val*mat2.values[q];
+                            }
+                        }
+                    }
+                    if (touched.size()*16<cols){
+                        std::sort(touched.begin(),touched.end());
+                    }
+                    else { //a dense row is cheaper to collect by a scan
+                        touched.clear();
+                        for (size_t j=0;j<cols;j++){
+                            if (mark[j]==i) touched.push_back(j);
+                        }
+                    }
+                    for (size_t t=0;t<touched.size();t++){
+                        if (acc[touched[t]]==T()) continue;
+                        range_cols[r].push_back(touched[t]);
+                        range_values[r].push_back(acc[touched[t]]);
+                    }
+                    res.row_ptr[i+1]=range_cols[r].size();
+                }
+            });
+            for (size_t r=0;r<ranges;r++){
+                size_t start=res.col_idx.size();
+                for (size_t i=bounds[r];i<bounds[r+1];i++){
+                    res.row_ptr[i+1]+=start;
+                }
+                res.col_idx.insert(res.col_idx.end(),range_cols[r].begin(),
+                                   range_cols[r].end());
+                res.values.insert(res.values.end(),range_values[r].begin(),
+                                  range_values[r].end());
+            }
+        }
+        catch (std::bad_alloc& e) {throw MtmExceptions::OutOfMemory();}
+        return res;
+    }
+
+                        ////////Operators////////
+
+    template <typename T>
+    MtmVec<T> operator*(const MtmMatSparse<T>& mat, const MtmVec<T>& vec){
+        return multiply(mat,vec);
+    }
+
+    /*
+     * Products with any other dense expression, which is turned into a
+     * matrix first (see toMatrix in MtmExpr.h).
+     */
+    template <typename T, typename R>
+    MtmMat<T> operator*(const MtmMatSparse<T>& mat, const MtmExpr<R>& expr){
+        static_assert(std::is_same<T,typename R::value_type>::value,
+                      "element type mismatch");
+        return multiply(mat,toMatrix(expr.self()));
+    }
+
+    template <typename T, typename L>
+    MtmMat<T> operator*(const MtmExpr<L>& expr, const MtmMatSparse<T>& mat){
+        static_assert(std::is_same<T,typename L::value_type>::value,
+                      "element type mismatch");
+        return multiply(toMatrix(expr.self()),mat);
+    }
+
+    template <typename T>
+    MtmMatSparse<T> operator*(const MtmMatSparse<T>& mat1,
+                              const MtmMatSparse<T>& mat2){
+        return multiply(mat1,mat2);
+    }
+
+}
+
+#endif //EX3_MTMMATSPARSE_H
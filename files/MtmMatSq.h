@@ -22,6 +22,9 @@ namespace MtmMath {
 
         void resize(Dimensions new_dim, const T& val=T()) override;
         void reshape(Dimensions newDim) override;
+    protected:
+        MtmMatSq(size_t m, const T& val, typename MtmMat<T>::Layout layout);
+        MtmMatSq(const MtmMatSq& mat, bool keep_layout);
     };
 
                         ////////Constructors////////
@@ -30,6 +33,19 @@ namespace MtmMath {
     MtmMatSq<T>::MtmMatSq(size_t m, const T &val) :
     MtmMat<T>(Dimensions(m,m),val)  {}
 
+    /*
+     * Constructors for derived classes storing a packed triangle, see
+     * MtmMat.
+     */
+    template <typename T>
+    MtmMatSq<T>::MtmMatSq(size_t m, const T& val,
+                          typename MtmMat<T>::Layout layout) :
+    MtmMat<T>(m,val,layout) {}
+
+    template <typename T>
+    MtmMatSq<T>::MtmMatSq(const MtmMatSq& mat, bool keep_layout) :
+    MtmMat<T>(mat,keep_layout) {}
+
     /*
      * Conversion constructor from regular to squared matrix. If the matrix
      * is not a squared matrix, MtmExceptions::IllegalInitialization() will
@@ -42,10 +58,11 @@ namespace MtmMath {
         if (mat_to_sq.getRow()!=mat_to_sq.getCol()){
             throw MtmExceptions::IllegalInitialization();
         }
-        int mat_size=this->getCol();
-        for (int i=0;i<mat_size;i++){
-            for (int j=0;j<mat_size;j++){
-                this->matrix[i][j]=mat_to_sq[i][j];
+        size_t mat_size=(size_t)this->getCol();
+        for (size_t i=0;i<mat_size;i++){
+            T* row=this->rowData(i);
+            for (size_t j=0;j<mat_size;j++){
+                row[j]=mat_to_sq.atUnchecked(i,j);
             }
         }
     }
@@ -0,0 +1,548 @@
+#ifndef EX3_MTMMATTILED_H
+#define EX3_MTMMATTILED_H
+
+#include <string>
+#include <vector>
+#include <future>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "MtmExceptions.h"
+#include "Auxilaries.h"
+#include "MtmMat.h"
+#include "MtmMatFile.h"
+
+using std::size_t;
+using std::string;
+using std::vector;
+
+namespace MtmMath {
+    /*
+     * Matrix kept in a file instead of memory, for matrices larger than
+     * RAM. It is cut into tile x tile blocks (smaller at the last row and
+     * column), each stored row by row in its own slot of the file, and is
+     * only accessed a tile at a time through readTile and writeTile, as an
+     * ordinary MtmMat. multiply and add below stream the tiles of their
+     * operands with a bounded amount of memory.
+     *
+     *     MtmMatTiled<double> a("a.tiles",Dimensions(n,n),4096,1.0);
+     *     MtmMatTiled<double> b("b.tiles",Dimensions(n,n),4096,2.0);
+     *     MtmMatTiled<double> c("c.tiles",Dimensions(n,n),4096);
+     *     multiply(a,b,c);
+     *
+     * File errors throw MtmExceptions::FileError. The file is written in
+     * the byte order of the machine, like MtmFile.
+     */
+    template <typename T>
+    class MtmMatTiled {
+    public:
+        /*
+         * Creates the file at path, replacing it, for a matrix of dimension
+         * dim whose elements get the value val.
+         */
+        MtmMatTiled(const string& path, Dimensions dim, size_t tile,
+                    const T& val=T());
+        /*
+         * Creates the file at path holding the elements of mat.
+         */
+        MtmMatTiled(const string& path, const MtmMat<T>& mat, size_t tile);
+        /*
+         * Opens a file created by the constructors above.
+         */
+        static MtmMatTiled open(const string& path);
+        MtmMatTiled(MtmMatTiled&& mat) noexcept;
+        MtmMatTiled& operator=(MtmMatTiled&& mat) noexcept;
+        MtmMatTiled(const MtmMatTiled&) = delete;
+        MtmMatTiled& operator=(const MtmMatTiled&) = delete;
+        ~MtmMatTiled();
+
+        Dimensions getDim() const { return dim; }
+        const string& getPath() const { return path; }
+        size_t tileSize() const { return tile; }
+        size_t tileRows() const { return (dim.getRow() + tile - 1)/tile; }
+        size_t tileCols() const { return (dim.getCol() + tile - 1)/tile; }
+        /*
+         * Dimension of tile (ti,tj).
+         */
+        Dimensions tileDim(size_t ti, size_t tj) const;
+        /*
+         * Reads tile (ti,tj) from the file. Safe to call from several
+         * threads at once.
+         */
+        MtmMat<T> readTile(size_t ti, size_t tj) const;
+        /*
+         * Writes tile (ti,tj), which must have the dimension tileDim(ti,tj),
+         * MtmExceptions::DimensionMismatch is thrown otherwise. tile is
+         * taken by value so that a temporary is moved in and written from
+         * where it is.
+         */
+        void writeTile(size_t ti, size_t tj, MtmMat<T> tile);
+        /*
+         * The whole matrix in memory.
+         */
+        MtmMat<T> toMat() const;
+        /*
+         * Whether mat is stored in the same file, also when the file was
+         * opened twice or through another path.
+         */
+        bool sameFile(const MtmMatTiled& mat) const;
+
+    private:
+        string path;
+        int fd;
+        Dimensions dim;
+        size_t tile;
+
+        MtmMatTiled(const string& path_t, int fd_t, Dimensions dim_t,
+                    size_t tile_t);
+        MtmFile::Header header() const;
+        off_t tileOffset(size_t ti, size_t tj) const;
+        bool fitsInFile() const;
+        void create(const string& path_t);
+        void transfer(bool write, char* buf, size_t bytes, off_t pos) const;
+    };
+
+    namespace MtmKernels {
+        /*
+         * Memory multiply uses for the tiles it keeps, unless told
+         * otherwise.
+         */
+        const size_t TILED_MEMORY_BUDGET = (size_t)1024*1024*1024;
+    }
+
+                        ////////Constructors////////
+
+    template <typename T>
+    MtmMatTiled<T>::MtmMatTiled(const string& path_t, int fd_t,
+                                Dimensions dim_t, size_t tile_t) :
+    path(path_t), fd(fd_t), dim(dim_t), tile(tile_t) {}
+
+    /*
+     * A file of zeros costs nothing to create, the slots are holes that
+     * read as zero bytes, which is T() for the element types of MtmFile.
+     * Other values are written a tile at a time.
+     */
+    template <typename T>
+    MtmMatTiled<T>::MtmMatTiled(const string& path_t, Dimensions dim_t,
+                                size_t tile_t, const T& val) :
+    path(path_t), fd(-1), dim(dim_t), tile(tile_t) {
+        create(path_t);
+        if (val == T()) return;
+        try {
+            for (size_t ti = 0; ti < tileRows(); ti++) {
+                for (size_t tj = 0; tj < tileCols(); tj++) {
+                    writeTile(ti, tj, MtmMat<T>(tileDim(ti, tj), val));
+                }
+            }
+        }
+        catch (...) {
+            ::close(fd);
+            throw;
+        }
+    }
+
+    template <typename T>
+    MtmMatTiled<T>::MtmMatTiled(const string& path_t, const MtmMat<T>& mat,
+                                size_t tile_t) :
+    path(path_t), fd(-1), dim(mat.getDim()), tile(tile_t) {
+        create(path_t);
+        try {
+            for (size_t ti = 0; ti < tileRows(); ti++) {
+                for (size_t tj = 0; tj < tileCols(); tj++) {
+                    Dimensions d = tileDim(ti, tj);
+                    MtmMat<T> part(d);
+                    for (size_t i = 0; i < d.getRow(); i++) {
+                        T* row = part.rowPtr(i);
+                        for (size_t j = 0; j < d.getCol(); j++) {
+                            row[j] = mat.atUnchecked(ti*tile + i,
+                                                     tj*tile + j);
+                        }
+                    }
+                    writeTile(ti, tj, std::move(part));
+                }
+            }
+        }
+        catch (...) {
+            ::close(fd);
+            throw;
+        }
+    }
+
+    /*
+     * Opens path and writes the header, the file gets the size of all the
+     * tile slots.
+     */
+    template <typename T>
+    void MtmMatTiled<T>::create(const string& path_t) {
+        if (dim.getRow() == 0 || dim.getCol() == 0 || tile == 0) {
+            throw MtmExceptions::IllegalInitialization();
+        }
+        if (!fitsInFile()) throw MtmExceptions::OutOfMemory();
+        fd = ::open(path_t.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) throw MtmExceptions::FileError(path_t,
+                                                   std::strerror(errno));
+        MtmFile::Header h = header();
+        try {
+            transfer(true, reinterpret_cast<char*>(&h), sizeof(h), 0);
+            if (ftruncate(fd, tileOffset(tileRows(), 0)) != 0) {
+                throw MtmExceptions::FileError(path_t, std::strerror(errno));
+            }
+        }
+        catch (...) {
+            ::close(fd);
+            throw;
+        }
+    }
+
+    template <typename T>
+    MtmMatTiled<T> MtmMatTiled<T>::open(const string& path_t) {
+        int fd_t = ::open(path_t.c_str(), O_RDWR);
+        if (fd_t < 0) throw MtmExceptions::FileError(path_t,
+                                                     std::strerror(errno));
+        MtmMatTiled<T> mat(path_t, fd_t, Dimensions(1, 1), 1);
+        MtmFile::Header h;
+        mat.transfer(false, reinterpret_cast<char*>(&h), sizeof(h), 0);
+        MtmFile::Header expected = mat.header();
+        if (std::memcmp(h.magic, expected.magic, sizeof(h.magic)) != 0) {
+            throw MtmExceptions::FileError(path_t, "not a tiled matrix file");
+        }
+        if (h.version != expected.version ||
+            h.byte_order != expected.byte_order) {
+            throw MtmExceptions::FileError(path_t, "unsupported file version");
+        }
+        if (h.type != expected.type ||
+            h.element_size != expected.element_size) {
+            throw MtmExceptions::FileError(path_t, "wrong element type");
+        }
+        if (h.rows == 0 || h.cols == 0 || h.ld == 0) {
+            throw MtmExceptions::FileError(path_t, "corrupted header");
+        }
+        mat.dim = Dimensions(h.rows, h.cols);
+        mat.tile = h.ld;
+        if (!mat.fitsInFile()) {
+            throw MtmExceptions::FileError(path_t, "corrupted header");
+        }
+        struct stat st;
+        if (fstat(fd_t, &st) != 0 ||
+            st.st_size < mat.tileOffset(mat.tileRows(), 0)) {
+            throw MtmExceptions::FileError(path_t, "corrupted header");
+        }
+        return mat;
+    }
+
+    template <typename T>
+    MtmMatTiled<T>::MtmMatTiled(MtmMatTiled&& mat) noexcept :
+    path(std::move(mat.path)), fd(mat.fd), dim(mat.dim), tile(mat.tile) {
+        mat.fd = -1;
+    }
+
+    template <typename T>
+    MtmMatTiled<T>& MtmMatTiled<T>::operator=(MtmMatTiled&& mat) noexcept {
+        if (this == &mat)
+            return *this;
+        if (fd >= 0) ::close(fd);
+        path = std::move(mat.path);
+        fd = mat.fd;
+        dim = mat.dim;
+        tile = mat.tile;
+        mat.fd = -1;
+        return *this;
+    }
+
+    template <typename T>
+    MtmMatTiled<T>::~MtmMatTiled() {
+        if (fd >= 0) ::close(fd);
+    }
+
+                        ////////Tiles////////
+
+    /*
+     * The MtmFile header, with "MTMTILE" as magic and the tile size in ld.
+     */
+    template <typename T>
+    MtmFile::Header MtmMatTiled<T>::header() const {
+        MtmFile::Header h = MtmFile::Header();
+        std::memcpy(h.magic, "MTMTILE", sizeof(h.magic));
+        h.version = MtmFile::VERSION;
+        h.byte_order = MtmFile::BYTE_ORDER_MARK;
+        h.type = MtmFile::ElementType<T>::code;
+        h.element_size = sizeof(T);
+        h.rows = dim.getRow();
+        h.cols = dim.getCol();
+        h.ld = tile;
+        h.count = (uint64_t)tileRows()*tileCols()*tile*tile;
+        return h;
+    }
+
+    /*
+     * Every tile has a slot of tile*tile elements, row of tiles by row of
+     * tiles, after the header.
+     */
+    /*
+     * Whether a tile and the offsets of all the tile slots can be computed
+     * without overflow. tileOffset relies on it for dimensions read from a
+     * file as well as for new ones.
+     */
+    template <typename T>
+    bool MtmMatTiled<T>::fitsInFile() const {
+        if (tile > (size_t)-1/tile/sizeof(T)) return false;
+        uint64_t slots = ((uint64_t)INT64_MAX/tile/tile - 1)/sizeof(T);
+        uint64_t rows = dim.getRow()/tile + (dim.getRow() % tile != 0);
+        uint64_t cols = dim.getCol()/tile + (dim.getCol() % tile != 0);
+        return rows <= slots && cols <= slots/rows;
+    }
+
+    template <typename T>
+    off_t MtmMatTiled<T>::tileOffset(size_t ti, size_t tj) const {
+        return (off_t)(sizeof(MtmFile::Header) +
+                       ((uint64_t)ti*tileCols() + tj)*tile*tile*sizeof(T));
+    }
+
+    template <typename T>
+    Dimensions MtmMatTiled<T>::tileDim(size_t ti, size_t tj) const {
+        if (ti >= tileRows() || tj >= tileCols()) {
+            throw MtmExceptions::AccessIllegalElement();
+        }
+        return Dimensions(std::min(tile, dim.getRow() - ti*tile),
+                          std::min(tile, dim.getCol() - tj*tile));
+    }
+
+    /*
+     * pread or pwrite of all the bytes, going on after short transfers.
+     */
+    template <typename T>
+    void MtmMatTiled<T>::transfer(bool write, char* buf, size_t bytes,
+                                  off_t pos) const {
+        while (bytes > 0) {
+            ssize_t n = write ? ::pwrite(fd, buf, bytes, pos) :
+                        ::pread(fd, buf, bytes, pos);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) throw MtmExceptions::FileError(path,
+                                                      std::strerror(errno));
+            if (n == 0) throw MtmExceptions::FileError(path, "file too short");
+            buf += n;
+            bytes -= (size_t)n;
+            pos += n;
+        }
+    }
+
+    template <typename T>
+    MtmMat<T> MtmMatTiled<T>::readTile(size_t ti, size_t tj) const {
+        Dimensions d = tileDim(ti, tj);
+        MtmMat<T> res(d);
+        transfer(false, reinterpret_cast<char*>(res.rowPtr(0)),
+                 d.getRow()*d.getCol()*sizeof(T), tileOffset(ti, tj));
+        return res;
+    }
+
+    template <typename T>
+    void MtmMatTiled<T>::writeTile(size_t ti, size_t tj, MtmMat<T> tile_t) {
+        Dimensions d = tileDim(ti, tj);
+        if (tile_t.getDim() != d) {
+            throw MtmExceptions::DimensionMismatch(d, tile_t.getDim());
+        }
+        transfer(true, reinterpret_cast<char*>(tile_t.rowPtr(0)),
+                 d.getRow()*d.getCol()*sizeof(T), tileOffset(ti, tj));
+    }
+
+    template <typename T>
+    MtmMat<T> MtmMatTiled<T>::toMat() const {
+        MtmMat<T> res(dim);
+        for (size_t ti = 0; ti < tileRows(); ti++) {
+            for (size_t tj = 0; tj < tileCols(); tj++) {
+                MtmMat<T> part = readTile(ti, tj);
+                for (size_t i = 0; i < (size_t)part.getRow(); i++) {
+                    std::copy(part.rowPtr(i), part.rowPtr(i) + part.getCol(),
+                              res.rowPtr(ti*tile + i) + tj*tile);
+                }
+            }
+        }
+        return res;
+    }
+
+    template <typename T>
+    bool MtmMatTiled<T>::sameFile(const MtmMatTiled& mat) const {
+        struct stat st, mat_st;
+        if (fstat(fd, &st) != 0) {
+            throw MtmExceptions::FileError(path, std::strerror(errno));
+        }
+        if (fstat(mat.fd, &mat_st) != 0) {
+            throw MtmExceptions::FileError(mat.path, std::strerror(errno));
+        }
+        return st.st_dev == mat_st.st_dev && st.st_ino == mat_st.st_ino;
+    }
+
+                        ////////Operations////////
+
+    /*
+     * Tiled operands must have the same tile size.
+     */
+    template <typename T>
+    void checkTiles(const MtmMatTiled<T>& a, const MtmMatTiled<T>& b) {
+        if (a.tileSize() != b.tileSize()) {
+            throw MtmExceptions::DimensionMismatch(
+                    Dimensions(a.tileSize(), a.tileSize()),
+                    Dimensions(b.tileSize(), b.tileSize()));
+        }
+    }
+
+    /*
+     * res=mat1*mat2, tile by tile: tile (i,j) of res is the sum over k of
+     * mat1's (i,k) times mat2's (k,j), multiplied in memory on the thread
+     * pool. While a pair of tiles is multiplied the next pair is read on
+     * another thread, and the finished tile is written while the next one
+     * is computed, so the disk and the processors work at the same time.
+     * This holds up to seven tiles in memory: the pair being multiplied,
+     * the pair being read, the sum, the product being added to it and the
+     * tile being written. If memory_budget bytes also hold two rows of
+     * mat1's tiles, 2*tileCols()+5 tiles in all, a row is read once and
+     * kept for the whole row of res, and the next row is read while the
+     * last tile of this one is computed; otherwise every tile of mat1 is
+     * read once for every column of res. A budget of less than seven tiles
+     * throws MtmExceptions::OutOfMemory.
+     * res must have the dimensions of the product and the same tile size,
+     * MtmExceptions::DimensionMismatch is thrown otherwise, and must be
+     * another file than mat1 and mat2, MtmExceptions::FileError is thrown
+     * otherwise.
+     */
+    template <typename T>
+    void multiply(const MtmMatTiled<T>& mat1, const MtmMatTiled<T>& mat2,
+                  MtmMatTiled<T>& res,
+                  size_t memory_budget=MtmKernels::TILED_MEMORY_BUDGET) {
+        if (mat1.getDim().getCol() != mat2.getDim().getRow()) {
+            throw MtmExceptions::DimensionMismatch(mat1.getDim(),
+                                                   mat2.getDim());
+        }
+        Dimensions dim(mat1.getDim().getRow(), mat2.getDim().getCol());
+        if (res.getDim() != dim) {
+            throw MtmExceptions::DimensionMismatch(dim, res.getDim());
+        }
+        checkTiles(mat1, mat2);
+        checkTiles(mat1, res);
+        if (res.sameFile(mat1) || res.sameFile(mat2)) {
+            throw MtmExceptions::FileError(res.getPath(),
+                                           "the product is an operand's file");
+        }
+        size_t tile = mat1.tileSize();
+        size_t rows = res.tileRows(), cols = res.tileCols();
+        size_t inner = mat1.tileCols();
+        size_t tile_bytes = tile*tile*sizeof(T);
+        size_t budget_tiles = memory_budget/tile_bytes;
+        if (budget_tiles < 7) throw MtmExceptions::OutOfMemory();
+        bool keep_row = budget_tiles - 5 >= 2*inner;
+
+        struct Pair {
+            MtmMat<T> a;
+            MtmMat<T> b;
+        };
+        //the tiles multiplied at step s, s going over (i,j,k) in order
+        auto fetch = [&](size_t s) {
+            size_t k = s % inner, j = s/inner % cols, i = s/inner/cols;
+            return Pair{keep_row ? MtmMat<T>(Dimensions(1, 1)) :
+                        mat1.readTile(i, k), mat2.readTile(k, j)};
+        };
+        auto fetchRow = [&](size_t i) {
+            vector<MtmMat<T> > tiles;
+            for (size_t k = 0; k < inner; k++) {
+                tiles.push_back(mat1.readTile(i, k));
+            }
+            return tiles;
+        };
+        auto store = [&res](size_t i, size_t j, MtmMat<T>& tile_t) {
+            res.writeTile(i, j, std::move(tile_t));
+        };
+        size_t steps = rows*cols*inner;
+        vector<MtmMat<T> > row;
+        MtmMat<T> acc(Dimensions(1, 1));
+        MtmMat<T> done(Dimensions(1, 1));
+        //destroyed first, which waits for the tasks using the above
+        std::future<Pair> next = std::async(std::launch::async, fetch, 0);
+        std::future<vector<MtmMat<T> > > next_row;
+        if (keep_row) {
+            next_row = std::async(std::launch::async, fetchRow, 0);
+        }
+        std::future<void> written;
+        for (size_t s = 0; s < steps; s++) {
+            size_t k = s % inner, j = s/inner % cols, i = s/inner/cols;
+            if (keep_row && j == 0 && k == 0) {
+                row = next_row.get();
+            }
+            if (keep_row && j + 1 == cols && k == 0 && i + 1 < rows) {
+                next_row = std::async(std::launch::async, fetchRow, i + 1);
+            }
+            Pair pair = next.get();
+            if (s + 1 < steps) {
+                next = std::async(std::launch::async, fetch, s + 1);
+            }
+            if (k == 0) {
+                acc = multiply(keep_row ? row[k] : pair.a, pair.b);
+            }
+            else {
+                acc += multiply(keep_row ? row[k] : pair.a, pair.b);
+            }
+            if (k + 1 == inner) {
+                if (written.valid()) written.get();
+                done = std::move(acc);
+                written = std::async(std::launch::async, store, i, j,
+                                     std::ref(done));
+            }
+        }
+        written.get();
+    }
+
+    /*
+     * res=mat1+mat2, tile by tile, reading the next pair of tiles and
+     * writing the previous sum while the current one is added. res may be
+     * mat1 or mat2. The three matrices must have the same dimensions and
+     * tile size, MtmExceptions::DimensionMismatch is thrown otherwise.
+     */
+    template <typename T>
+    void add(const MtmMatTiled<T>& mat1, const MtmMatTiled<T>& mat2,
+             MtmMatTiled<T>& res) {
+        if (mat1.getDim() != mat2.getDim()) {
+            throw MtmExceptions::DimensionMismatch(mat1.getDim(),
+                                                   mat2.getDim());
+        }
+        if (mat1.getDim() != res.getDim()) {
+            throw MtmExceptions::DimensionMismatch(mat1.getDim(),
+                                                   res.getDim());
+        }
+        checkTiles(mat1, mat2);
+        checkTiles(mat1, res);
+        size_t cols = res.tileCols();
+        size_t steps = res.tileRows()*cols;
+        struct Pair {
+            MtmMat<T> a;
+            MtmMat<T> b;
+        };
+        auto fetch = [&](size_t s) {
+            return Pair{mat1.readTile(s/cols, s % cols),
+                        mat2.readTile(s/cols, s % cols)};
+        };
+        auto store = [&res](size_t i, size_t j, MtmMat<T>& tile_t) {
+            res.writeTile(i, j, std::move(tile_t));
+        };
+        MtmMat<T> done(Dimensions(1, 1));
+        std::future<Pair> next = std::async(std::launch::async, fetch, 0);
+        std::future<void> written;
+        for (size_t s = 0; s < steps; s++) {
+            Pair pair = next.get();
+            if (written.valid()) written.get();
+            //tile s+1 is read only after tile s-1 was written, res may be
+            //one of the operands
+            if (s + 1 < steps) {
+                next = std::async(std::launch::async, fetch, s + 1);
+            }
+            pair.a += pair.b;
+            done = std::move(pair.a);
+            written = std::async(std::launch::async, store, s/cols, s % cols,
+                                 std::ref(done));
+        }
+        written.get();
+    }
+}
+
+#endif //EX3_MTMMATTILED_H
@@ -15,6 +15,7 @@ namespace MtmMath {
     class MtmMatTriag : public MtmMatSq<T> {
     private:
         bool is_upper;
+        static typename MtmMat<T>::Layout triangleLayout(const MtmMat<T>&);
     public:
         /*
          * Triangular Matrix constructor, m is the number of rows and columns
@@ -25,45 +26,42 @@ namespace MtmMath {
         explicit MtmMatTriag(size_t m, const T &val = T(),
                 bool isUpper_t = true);
         MtmMatTriag(const MtmMatTriag& mat);
+        MtmMatTriag(MtmMatTriag&& mat) noexcept;
+        MtmMatTriag& operator=(const MtmMatTriag& mat) = default;
+        MtmMatTriag& operator=(MtmMatTriag&& mat) noexcept = default;
         explicit MtmMatTriag (const MtmMat<T>&);
 
         void resize(Dimensions new_dim, const T& val=T()) override;
         void transpose() override;
         void lockUpper(); //lock upper triangle of the matrix
         void lockLower(); //lock lower triangle of the matrix
+        friend struct MtmFile::Access;
     };
 
                         ////////Constructors////////
 /*
  * Constructor for Triangle matrix. The constructor assigns val to the upper
- * or lower triangle according to is_upper , and "locks" the other triangle to
- * prevent writing to it.
+ * or lower triangle according to is_upper. Only that triangle is stored,
+ * packed, and the other one reads as zero and is "locked" to prevent writing
+ * to it.
  * reading from locked elements will be done with const iterators.
  */
     template<typename T>
     MtmMatTriag<T>::MtmMatTriag(size_t m, const T &val, bool isUpper_t) :
-            MtmMatSq<T>(m, val), is_upper(isUpper_t) {
-        int mat_size = this->getCol();
-        for (int i = 0; i < mat_size; i++) {
-            for (int j = 0; j < mat_size; j++) {
-                if (isUpper_t && i > j) {
-                    this->matrix[i][j] = T();
-                    this->matrix[i].lockCell(j);
-                }
-                if (!isUpper_t && i < j) {
-                    this->matrix[i][j] = T();
-                    this->matrix[i].lockCell(j);
-                }
-            }
-        }
-    }
+            MtmMatSq<T>(m, val, isUpper_t ? MtmMat<T>::PACKED_UPPER :
+                        MtmMat<T>::PACKED_LOWER), is_upper(isUpper_t) {}
 
     /*
-     * copy constructor for triangle matrix
+     * copy constructor for triangle matrix. A matrix that was unpacked by
+     * unlocking cells of its zero half is copied unpacked, with that half
+     * locked again.
      */
     template<typename T>
     MtmMatTriag<T>::MtmMatTriag(const MtmMatTriag& mat):
-    MtmMatSq<T>::MtmMatSq(mat), is_upper(mat.is_upper){
+    MtmMatSq<T>::MtmMatSq(mat,true), is_upper(mat.is_upper){
+        if (this->layout!=MtmMat<T>::FULL) {
+            return;
+        }
         if (is_upper) {
             lockLower();
         }
@@ -72,6 +70,14 @@ namespace MtmMath {
         }
     }
 
+    /*
+     * move constructor for triangle matrix, the locks move along with the
+     * elements
+     */
+    template<typename T>
+    MtmMatTriag<T>::MtmMatTriag(MtmMatTriag&& mat) noexcept:
+    MtmMatSq<T>::MtmMatSq(std::move(mat)), is_upper(mat.is_upper){}
+
     /*
      * Conversion constructor from regular to triangle matrix. If the matrix
      * is not a triangle matrix, MtmExceptions::IllegalInitialization() will
@@ -80,29 +86,39 @@ namespace MtmMath {
      */
    template<typename T>
    MtmMatTriag<T>::MtmMatTriag(const MtmMat<T>& mat) :
-    MtmMatSq<T>((size_t)mat.getRow(),T()), is_upper(true){
+    MtmMatSq<T>((size_t)mat.getRow(),T(),triangleLayout(mat)),
+    is_upper(this->layout==MtmMat<T>::PACKED_UPPER){
+        for (size_t i=0;i<(size_t)this->getRow();i++){
+            T* row=this->rowData(i);
+            for (size_t j=this->colBegin(i);j<this->colEnd(i);j++){
+                row[j]=mat.atUnchecked(i,j);
+            }
+        }
+    }
+
+    /*
+     * Packed layout for a triangular matrix, lower if it is diagonal.
+     * Throws MtmExceptions::IllegalInitialization() if mat is not square or
+     * not triangular.
+     */
+    template<typename T>
+    typename MtmMat<T>::Layout MtmMatTriag<T>::triangleLayout(
+            const MtmMat<T>& mat){
         if (mat.getCol()!=mat.getRow()){
             throw MtmExceptions::IllegalInitialization();
         }
         bool is_upper_t= true;
         bool is_lower_t= true;
-        for (int i=0;i<mat.getRow();i++){
-            for (int j=0;j<mat.getCol();j++){
-                if (j<i&&mat[i][j]!=T()) is_upper_t=false; //checks if Upper
-                if (j>i&&mat[i][j]!=T()) is_lower_t=false; //checks if Lower
-                this->matrix[i][j]=mat[i][j];
+        for (size_t i=0;i<(size_t)mat.getRow();i++){
+            for (size_t j=0;j<(size_t)mat.getCol();j++){
+                const T& x=mat.atUnchecked(i,j);
+                if (j<i&&x!=T()) is_upper_t=false; //checks if Upper
+                if (j>i&&x!=T()) is_lower_t=false; //checks if Lower
             }
         }
         if (!is_upper_t&&!is_lower_t) {throw
         MtmExceptions::IllegalInitialization();}
-        if (is_upper_t&&!is_lower_t) {
-            this->is_upper=true;
-            this->lockLower();
-        }
-        if (is_lower_t) {
-            this->is_upper=false;
-            this->lockUpper();
-        }
+        return is_lower_t ? MtmMat<T>::PACKED_LOWER : MtmMat<T>::PACKED_UPPER;
     }
 
                         ////////Triangle matrix functions////////
@@ -115,18 +131,15 @@ namespace MtmMath {
     void MtmMatTriag<T>::resize(Dimensions new_dim, const T &val)  {
         Dimensions old_dim=this->dim;
         MtmMatSq<T>::resize(new_dim, val);
-        if(old_dim.getRow()>new_dim.getRow()){
-            return;
+        if(this->layout!=MtmMat<T>::FULL||old_dim.getRow()>new_dim.getRow()){
+            return; //a packed matrix has no storage for the zero half
         }
         bool is_upper_t=this->is_upper;
-        int mat_size = this->getCol();
-        for (int i = 0; i < mat_size; i++) {
-            for (int j = 0; j < mat_size; j++) {
-                if (is_upper_t && i > j) {
-                    this->matrix[i][j] = T();
-                }
-                if (!is_upper_t && i < j) {
-                    this->matrix[i][j] = T();
+        size_t mat_size = (size_t)this->getCol();
+        for (size_t i = 0; i < mat_size; i++) {
+            for (size_t j = 0; j < mat_size; j++) {
+                if (is_upper_t ? i > j : i < j) {
+                    this->atUnchecked(i,j) = T();
                 }
             }
         }
@@ -142,6 +155,9 @@ namespace MtmMath {
     void MtmMatTriag<T>::transpose(){
         MtmMat<T>::transpose();
         is_upper = !is_upper;
+        if (this->layout!=MtmMat<T>::FULL) {
+            return;
+        }
         if(is_upper) {
             lockLower();
         }
@@ -158,11 +174,10 @@ namespace MtmMath {
  */
     template <typename T>
     void MtmMatTriag<T>::lockUpper() {
-        for (int i = 0; i < this->getRow(); i++) {
-            for (int j = 0; j < this->getCol(); j++) {
-                if (j > i) {
-                    this->matrix[i].lockCell(j);
-                }
+        size_t n = (size_t)this->getRow();
+        for (size_t i = 0; i < n; i++) {
+            for (size_t j = i + 1; j < n; j++) {
+                this->setLocked(i, j, true);
             }
         }
     }
@@ -174,11 +189,10 @@ namespace MtmMath {
  */
     template <typename T>
     void MtmMatTriag<T>::lockLower(){
-        for (int i = 0; i < this->getRow(); i++) {
-            for (int j = 0; j < this->getCol(); j++) {
-                if (j < i) {
-                    this->matrix[i].lockCell(j);
-                }
+        size_t n = (size_t)this->getRow();
+        for (size_t i = 0; i < n; i++) {
+            for (size_t j = 0; j < i; j++) {
+                this->setLocked(i, j, true);
             }
         }
     }
@@ -0,0 +1,43 @@
+#ifndef EX3_MTMREDUCE_H
+#define EX3_MTMREDUCE_H
+
+#include <type_traits>
+#include <utility>
+
+using std::size_t;
+
+namespace MtmMath {
+    namespace MtmKernels {
+        /*
+         * vecFunc and matFunc split their input into blocks of about this
+         * many elements. The blocks depend only on the dimensions, never on
+         * the number of threads, so a reduction gives the same result on
+         * every run.
+         */
+        const size_t REDUCE_BLOCK = 64*1024;
+
+        /*
+         * A function object is mergeable if it is default constructible and
+         * has a member merge(const Func& other) that makes it the result of
+         * everything it was fed followed by everything other was fed. Parts
+         * of the data can then be reduced on different threads, each by a
+         * new Func, and merged in order.
+         */
+        template <typename Func>
+        class IsMergeable {
+            template <typename F>
+            static auto test(int) -> decltype(std::declval<F&>().merge(
+                    std::declval<const F&>()), std::true_type());
+            template <typename F>
+            static std::false_type test(...);
+        public:
+            static const bool value = decltype(test<Func>(0))::value &&
+                                      std::is_default_constructible<Func>::value;
+        };
+
+        template <typename Func>
+        using MergeTag = std::integral_constant<bool, IsMergeable<Func>::value>;
+    }
+}
+
+#endif //EX3_MTMREDUCE_H
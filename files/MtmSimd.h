@@ -0,0 +1,564 @@
+#ifndef EX3_MTMSIMD_H
+#define EX3_MTMSIMD_H
+
+#include <cstddef>
+#include "Complex.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MTM_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+using std::size_t;
+
+namespace MtmMath {
+    namespace MtmKernels {
+        /*
+         * Instruction sets the element-wise kernels can run on, ordered from
+         * the weakest to the strongest.
+         */
+        enum SimdLevel { SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2, SIMD_AVX512 };
+
+        enum ElementwiseOp { OP_ADD, OP_SUB, OP_MUL };
+
+        /*
+         * Strongest instruction set supported by the running CPU.
+         */
+        inline SimdLevel detectSimdLevel() {
+#ifdef MTM_SIMD_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+            if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+            if (__builtin_cpu_supports("sse2")) return SIMD_SSE2;
+#endif
+            return SIMD_SCALAR;
+        }
+
+        inline SimdLevel& currentSimdLevel() {
+            static SimdLevel level = detectSimdLevel();
+            return level;
+        }
+
+        /*
+         * Instruction set the element-wise kernels dispatch to. It is
+         * detected once, on first use.
+         */
+        inline SimdLevel simdLevel() {
+            return currentSimdLevel();
+        }
+
+        /*
+         * Restricts the kernels to the given instruction set, e.g. to compare
+         * the code paths. Levels the CPU doesn't support are lowered to the
+         * detected one.
+         */
+        inline void setSimdLevel(SimdLevel level) {
+            SimdLevel detected = detectSimdLevel();
+            currentSimdLevel() = level < detected ? level : detected;
+        }
+
+        template <typename T>
+        inline T applyOp(ElementwiseOp op, const T& a, const T& b) {
+            return op == OP_ADD ? a + b : op == OP_SUB ? a - b : a * b;
+        }
+
+        /*
+         * Portable kernels, used for element types without vector support and
+         * for the tails the vector kernels leave.
+         */
+        template <typename T>
+        void binaryScalar(ElementwiseOp op, T* dst, const T* src, size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                dst[i] = applyOp(op, dst[i], src[i]);
+            }
+        }
+
+        template <typename T>
+        void withScalarScalar(ElementwiseOp op, T* dst, const T& val,
+                              size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                dst[i] = applyOp(op, dst[i], val);
+            }
+        }
+
+        template <typename T>
+        void negateScalar(T* dst, const T* src, size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                dst[i] = -src[i];
+            }
+        }
+
+        template <typename T>
+        size_t findNonzeroScalar(const T* src, size_t n) {
+            size_t i = 0;
+            while (i < n && src[i] == T()) {
+                i++;
+            }
+            return i;
+        }
+
+#ifdef MTM_SIMD_X86
+/*
+ * Vector kernels shared by all instruction sets. R is a register traits type
+ * of the enclosing instruction set namespace. The definitions are expanded
+ * inside each target region so they are compiled for that instruction set.
+ */
+#define MTM_SIMD_ELEMENTWISE_KERNELS                                          \
+        template <typename R>                                                 \
+        typename R::reg apply(ElementwiseOp op, typename R::reg a,            \
+                              typename R::reg b) {                            \
+            return op == OP_ADD ? R::add(a, b) : op == OP_SUB ?               \
+                   R::sub(a, b) : R::mul(a, b);                               \
+        }                                                                     \
+                                                                              \
+        template <typename R>                                                 \
+        void binary(ElementwiseOp op, typename R::scalar* dst,                \
+                    const typename R::scalar* src, size_t n) {                \
+            size_t i = 0;                                                     \
+            for (; i + R::WIDTH <= n; i += R::WIDTH) {                        \
+                R::store(dst + i, apply<R>(op, R::load(dst + i),              \
+                                           R::load(src + i)));                \
+            }                                                                 \
+            binaryScalar(op, dst + i, src + i, n - i);                        \
+        }                                                                     \
+                                                                              \
+        template <typename R>                                                 \
+        void withScalar(ElementwiseOp op, typename R::scalar* dst,            \
+                        typename R::scalar val, size_t n) {                   \
+            typename R::reg v = R::set1(val);                                 \
+            size_t i = 0;                                                     \
+            for (; i + R::WIDTH <= n; i += R::WIDTH) {                        \
+                R::store(dst + i, apply<R>(op, R::load(dst + i), v));         \
+            }                                                                 \
+            withScalarScalar(op, dst + i, val, n - i);                        \
+        }                                                                     \
+                                                                              \
+        template <typename R>                                                 \
+        void negate(typename R::scalar* dst, const typename R::scalar* src,   \
+                    size_t n) {                                               \
+            size_t i = 0;                                                     \
+            for (; i + R::WIDTH <= n; i += R::WIDTH) {                        \
+                R::store(dst + i, R::neg(R::load(src + i)));                  \
+            }                                                                 \
+            negateScalar(dst + i, src + i, n - i);                            \
+        }                                                                     \
+                                                                              \
+        template <typename R>                                                 \
+        size_t findNonzero(const typename R::scalar* src, size_t n) {         \
+            size_t i = 0;                                                     \
+            while (i + R::WIDTH <= n && R::allZero(R::load(src + i))) {       \
+                i += R::WIDTH;                                                \
+            }                                                                 \
+            return i + findNonzeroScalar(src + i, n - i);                     \
+        }
+
+#pragma GCC push_options
+#pragma GCC target("sse2")
+        namespace Sse2 {
+            template <typename T> struct Reg;
+
+            template <> struct Reg<double> {
+                typedef double scalar;
+                typedef __m128d reg;
+                enum { WIDTH = 2 };
+                static reg load(const double* p) { return _mm_loadu_pd(p); }
+                static void store(double* p, reg a) { _mm_storeu_pd(p, a); }
+                static reg set1(double v) { return _mm_set1_pd(v); }
+                static reg add(reg a, reg b) { return _mm_add_pd(a, b); }
+                static reg sub(reg a, reg b) { return _mm_sub_pd(a, b); }
+                static reg mul(reg a, reg b) { return _mm_mul_pd(a, b); }
+                static reg neg(reg a) {
+                    return _mm_xor_pd(a, _mm_set1_pd(-0.0));
+                }
+                /*
+                 * Compares like ==, so -0.0 counts as zero and NaN doesn't.
+                 */
+                static bool allZero(reg a) {
+                    return _mm_movemask_pd(_mm_cmpneq_pd(a,
+                                           _mm_setzero_pd())) == 0;
+                }
+            };
+
+            template <> struct Reg<float> {
+                typedef float scalar;
+                typedef __m128 reg;
+                enum { WIDTH = 4 };
+                static reg load(const float* p) { return _mm_loadu_ps(p); }
+                static void store(float* p, reg a) { _mm_storeu_ps(p, a); }
+                static reg set1(float v) { return _mm_set1_ps(v); }
+                static reg add(reg a, reg b) { return _mm_add_ps(a, b); }
+                static reg sub(reg a, reg b) { return _mm_sub_ps(a, b); }
+                static reg mul(reg a, reg b) { return _mm_mul_ps(a, b); }
+                static reg neg(reg a) {
+                    return _mm_xor_ps(a, _mm_set1_ps(-0.0f));
+                }
+                static bool allZero(reg a) {
+                    return _mm_movemask_ps(_mm_cmpneq_ps(a,
+                                           _mm_setzero_ps())) == 0;
+                }
+            };
+
+            template <> struct Reg<int> {
+                typedef int scalar;
+                typedef __m128i reg;
+                enum { WIDTH = 4 };
+                static reg load(const int* p) {
+                    return _mm_loadu_si128(reinterpret_cast<const reg*>(p));
+                }
+                static void store(int* p, reg a) {
+                    _mm_storeu_si128(reinterpret_cast<reg*>(p), a);
+                }
+                static reg set1(int v) { return _mm_set1_epi32(v); }
+                static reg add(reg a, reg b) { return _mm_add_epi32(a, b); }
+                static reg sub(reg a, reg b) { return _mm_sub_epi32(a, b); }
+                /*
+                 * SSE2 has no 32 bit low multiply, the even and odd lanes are
+                 * multiplied separately and interleaved back.
+                 */
+                static reg mul(reg a, reg b) {
+                    reg even = _mm_mul_epu32(a, b);
+                    reg odd = _mm_mul_epu32(_mm_srli_si128(a, 4),
+                                            _mm_srli_si128(b, 4));
+                    return _mm_unpacklo_epi32(
+                            _mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                            _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+                }
+                static reg neg(reg a) {
+                    return _mm_sub_epi32(_mm_setzero_si128(), a);
+                }
+                static bool allZero(reg a) {
+                    return _mm_movemask_epi8(_mm_cmpeq_epi32(a,
+                                             _mm_setzero_si128())) == 0xFFFF;
+                }
+            };
+
+            MTM_SIMD_ELEMENTWISE_KERNELS
+        }
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+        namespace Avx2 {
+            template <typename T> struct Reg;
+
+            template <> struct Reg<double> {
+                typedef double scalar;
+                typedef __m256d reg;
+                enum { WIDTH = 4 };
+                static reg load(const double* p) { return _mm256_loadu_pd(p); }
+                static void store(double* p, reg a) { _mm256_storeu_pd(p, a); }
+                static reg set1(double v) { return _mm256_set1_pd(v); }
+                static reg add(reg a, reg b) { return _mm256_add_pd(a, b); }
+                static reg sub(reg a, reg b) { return _mm256_sub_pd(a, b); }
+                static reg mul(reg a, reg b) { return _mm256_mul_pd(a, b); }
+                static reg neg(reg a) {
+                    return _mm256_xor_pd(a, _mm256_set1_pd(-0.0));
+                }
+                static bool allZero(reg a) {
+                    return _mm256_movemask_pd(_mm256_cmp_pd(a,
+                           _mm256_setzero_pd(), _CMP_NEQ_UQ)) == 0;
+                }
+            };
+
+            template <> struct Reg<float> {
+                typedef float scalar;
+                typedef __m256 reg;
+                enum { WIDTH = 8 };
+                static reg load(const float* p) { return _mm256_loadu_ps(p); }
+                static void store(float* p, reg a) { _mm256_storeu_ps(p, a); }
+                static reg set1(float v) { return _mm256_set1_ps(v); }
+                static reg add(reg a, reg b) { return _mm256_add_ps(a, b); }
+                static reg sub(reg a, reg b) { return _mm256_sub_ps(a, b); }
+                static reg mul(reg a, reg b) { return _mm256_mul_ps(a, b); }
+                static reg neg(reg a) {
+                    return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f));
+                }
+                static bool allZero(reg a) {
+                    return _mm256_movemask_ps(_mm256_cmp_ps(a,
+                           _mm256_setzero_ps(), _CMP_NEQ_UQ)) == 0;
+                }
+            };
+
+            template <> struct Reg<int> {
+                typedef int scalar;
+                typedef __m256i reg;
+                enum { WIDTH = 8 };
+                static reg load(const int* p) {
+                    return _mm256_loadu_si256(reinterpret_cast<const reg*>(p));
+                }
+                static void store(int* p, reg a) {
+                    _mm256_storeu_si256(reinterpret_cast<reg*>(p), a);
+                }
+                static reg set1(int v) { return _mm256_set1_epi32(v); }
+                static reg add(reg a, reg b) { return _mm256_add_epi32(a, b); }
+                static reg sub(reg a, reg b) { return _mm256_sub_epi32(a, b); }
+                static reg mul(reg a, reg b) {
+                    return _mm256_mullo_epi32(a, b);
+                }
+                static reg neg(reg a) {
+                    return _mm256_sub_epi32(_mm256_setzero_si256(), a);
+                }
+                static bool allZero(reg a) {
+                    return _mm256_testz_si256(a, a) != 0;
+                }
+            };
+
+            MTM_SIMD_ELEMENTWISE_KERNELS
+        }
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+        namespace Avx512 {
+            template <typename T> struct Reg;
+
+            template <> struct Reg<double> {
+                typedef double scalar;
+                typedef __m512d reg;
+                enum { WIDTH = 8 };
+                static reg load(const double* p) { return _mm512_loadu_pd(p); }
+                static void store(double* p, reg a) { _mm512_storeu_pd(p, a); }
+                static reg set1(double v) { return _mm512_set1_pd(v); }
+                static reg add(reg a, reg b) { return _mm512_add_pd(a, b); }
+                static reg sub(reg a, reg b) { return _mm512_sub_pd(a, b); }
+                static reg mul(reg a, reg b) { return _mm512_mul_pd(a, b); }
+                static reg neg(reg a) {
+                    return _mm512_castsi512_pd(_mm512_xor_si512(
+                            _mm512_castpd_si512(a),
+                            _mm512_set1_epi64((long long)1 << 63)));
+                }
+                static bool allZero(reg a) {
+                    return _mm512_cmp_pd_mask(a, _mm512_setzero_pd(),
+                                              _CMP_NEQ_UQ) == 0;
+                }
+            };
+
+            template <> struct Reg<float> {
+                typedef float scalar;
+                typedef __m512 reg;
+                enum { WIDTH = 16 };
+                static reg load(const float* p) { return _mm512_loadu_ps(p); }
+                static void store(float* p, reg a) { _mm512_storeu_ps(p, a); }
+                static reg set1(float v) { return _mm512_set1_ps(v); }
+                static reg add(reg a, reg b) { return _mm512_add_ps(a, b); }
+                static reg sub(reg a, reg b) { return _mm512_sub_ps(a, b); }
+                static reg mul(reg a, reg b) { return _mm512_mul_ps(a, b); }
+                static reg neg(reg a) {
+                    return _mm512_castsi512_ps(_mm512_xor_si512(
+                            _mm512_castps_si512(a),
+                            _mm512_set1_epi32((int)0x80000000)));
+                }
+                static bool allZero(reg a) {
+                    return _mm512_cmp_ps_mask(a, _mm512_setzero_ps(),
+                                              _CMP_NEQ_UQ) == 0;
+                }
+            };
+
+            template <> struct Reg<int> {
+                typedef int scalar;
+                typedef __m512i reg;
+                enum { WIDTH = 16 };
+                static reg load(const int* p) { return _mm512_loadu_si512(p); }
+                static void store(int* p, reg a) { _mm512_storeu_si512(p, a); }
+                static reg set1(int v) { return _mm512_set1_epi32(v); }
+                static reg add(reg a, reg b) { return _mm512_add_epi32(a, b); }
+                static reg sub(reg a, reg b) { return _mm512_sub_epi32(a, b); }
+                static reg mul(reg a, reg b) {
+                    return _mm512_mullo_epi32(a, b);
+                }
+                static reg neg(reg a) {
+                    return _mm512_sub_epi32(_mm512_setzero_si512(), a);
+                }
+                static bool allZero(reg a) {
+                    return _mm512_test_epi32_mask(a, a) == 0;
+                }
+            };
+
+            MTM_SIMD_ELEMENTWISE_KERNELS
+        }
+#pragma GCC pop_options
+
+#undef MTM_SIMD_ELEMENTWISE_KERNELS
+#endif
+
+        /*
+         * Element types with vector kernels.
+         */
+        template <typename T> struct HasSimd { enum { value = false }; };
+        template <> struct HasSimd<double> { enum { value = true }; };
+        template <> struct HasSimd<float> { enum { value = true }; };
+        template <> struct HasSimd<int> { enum { value = true }; };
+
+        template <bool> struct SimdTag {};
+
+        template <typename T>
+        void binary(ElementwiseOp op, T* dst, const T* src, size_t n,
+                    SimdTag<false>) {
+            binaryScalar(op, dst, src, n);
+        }
+
+        template <typename T>
+        void withScalar(ElementwiseOp op, T* dst, const T& val, size_t n,
+                        SimdTag<false>) {
+            withScalarScalar(op, dst, val, n);
+        }
+
+        template <typename T>
+        void negate(T* dst, const T* src, size_t n, SimdTag<false>) {
+            negateScalar(dst, src, n);
+        }
+
+        template <typename T>
+        size_t findNonzero(const T* src, size_t n, SimdTag<false>) {
+            return findNonzeroScalar(src, n);
+        }
+
+        template <typename T>
+        void binary(ElementwiseOp op, T* dst, const T* src, size_t n,
+                    SimdTag<true>) {
+            switch (simdLevel()) {
+#ifdef MTM_SIMD_X86
+                case SIMD_AVX512:
+                    Avx512::binary<Avx512::Reg<T> >(op, dst, src, n);
+                    return;
+                case SIMD_AVX2:
+                    Avx2::binary<Avx2::Reg<T> >(op, dst, src, n);
+                    return;
+                case SIMD_SSE2:
+                    Sse2::binary<Sse2::Reg<T> >(op, dst, src, n);
+                    return;
+#endif
+                default:
+                    binaryScalar(op, dst, src, n);
+            }
+        }
+
+        template <typename T>
+        void withScalar(ElementwiseOp op, T* dst, const T& val, size_t n,
+                        SimdTag<true>) {
+            switch (simdLevel()) {
+#ifdef MTM_SIMD_X86
+                case SIMD_AVX512:
+                    Avx512::withScalar<Avx512::Reg<T> >(op, dst, val, n);
+                    return;
+                case SIMD_AVX2:
+                    Avx2::withScalar<Avx2::Reg<T> >(op, dst, val, n);
+                    return;
+                case SIMD_SSE2:
+                    Sse2::withScalar<Sse2::Reg<T> >(op, dst, val, n);
+                    return;
+#endif
+                default:
+                    withScalarScalar(op, dst, val, n);
+            }
+        }
+
+        template <typename T>
+        void negate(T* dst, const T* src, size_t n, SimdTag<true>) {
+            switch (simdLevel()) {
+#ifdef MTM_SIMD_X86
+                case SIMD_AVX512:
+                    Avx512::negate<Avx512::Reg<T> >(dst, src, n);
+                    return;
+                case SIMD_AVX2:
+                    Avx2::negate<Avx2::Reg<T> >(dst, src, n);
+                    return;
+                case SIMD_SSE2:
+                    Sse2::negate<Sse2::Reg<T> >(dst, src, n);
+                    return;
+#endif
+                default:
+                    negateScalar(dst, src, n);
+            }
+        }
+
+        template <typename T>
+        size_t findNonzero(const T* src, size_t n, SimdTag<true>) {
+            switch (simdLevel()) {
+#ifdef MTM_SIMD_X86
+                case SIMD_AVX512:
+                    return Avx512::findNonzero<Avx512::Reg<T> >(src, n);
+                case SIMD_AVX2:
+                    return Avx2::findNonzero<Avx2::Reg<T> >(src, n);
+                case SIMD_SSE2:
+                    return Sse2::findNonzero<Sse2::Reg<T> >(src, n);
+#endif
+                default:
+                    return findNonzeroScalar(src, n);
+            }
+        }
+
+        /*
+         * Element-wise kernels on contiguous arrays of n elements. int, float
+         * and double run on the strongest instruction set the CPU supports,
+         * other types use plain loops.
+         */
+        template <typename T>
+        void addArray(T* dst, const T* src, size_t n) {    //dst+=src
+            binary(OP_ADD, dst, src, n, SimdTag<HasSimd<T>::value>());
+        }
+
+        template <typename T>
+        void subArray(T* dst, const T* src, size_t n) {    //dst-=src
+            binary(OP_SUB, dst, src, n, SimdTag<HasSimd<T>::value>());
+        }
+
+        template <typename T>
+        void addScalar(T* dst, const T& val, size_t n) {   //dst+=val
+            withScalar(OP_ADD, dst, val, n, SimdTag<HasSimd<T>::value>());
+        }
+
+        template <typename T>
+        void subScalar(T* dst, const T& val, size_t n) {   //dst-=val
+            withScalar(OP_SUB, dst, val, n, SimdTag<HasSimd<T>::value>());
+        }
+
+        template <typename T>
+        void mulScalar(T* dst, const T& val, size_t n) {   //dst*=val
+            withScalar(OP_MUL, dst, val, n, SimdTag<HasSimd<T>::value>());
+        }
+
+        template <typename T>
+        void negateArray(T* dst, const T* src, size_t n) { //dst=-src
+            negate(dst, src, n, SimdTag<HasSimd<T>::value>());
+        }
+
+        /*
+         * Index of the first of n elements that is not equal to T(), or n
+         * if they all are.
+         */
+        template <typename T>
+        size_t findNonzero(const T* src, size_t n) {
+            return findNonzero(src, n, SimdTag<HasSimd<T>::value>());
+        }
+
+        /*
+         * Adding, subtracting and negating Complex arrays works on the real
+         * and imaginary parts alike, so they run as arrays of 2n doubles.
+         * Negation is reached through exprKernel (MtmExpr.h).
+         */
+        static_assert(sizeof(Complex) == 2*sizeof(double),
+                      "Complex must be a {re, im} pair of doubles");
+
+        inline void addArray(Complex* dst, const Complex* src, size_t n) {
+            addArray(reinterpret_cast<double*>(dst),
+                     reinterpret_cast<const double*>(src), 2*n);
+        }
+
+        inline void subArray(Complex* dst, const Complex* src, size_t n) {
+            subArray(reinterpret_cast<double*>(dst),
+                     reinterpret_cast<const double*>(src), 2*n);
+        }
+
+        inline void negateArray(Complex* dst, const Complex* src, size_t n) {
+            negateArray(reinterpret_cast<double*>(dst),
+                        reinterpret_cast<const double*>(src), 2*n);
+        }
+
+        inline size_t findNonzero(const Complex* src, size_t n) {
+            return findNonzero(reinterpret_cast<const double*>(src), 2*n)/2;
+        }
+    }
+}
+
+#endif //EX3_MTMSIMD_H
@@ -0,0 +1,162 @@
+#ifndef EX3_MTMSMALLVECTOR_H
+#define EX3_MTMSMALLVECTOR_H
+
+#include <vector>
+#include <new>
+#include <iterator>
+#include <type_traits>
+#include "MtmAllocator.h"
+
+using std::size_t;
+using std::vector;
+
+namespace MtmMath {
+
+    /*
+     * Buffer of elements kept inside the object while there are at most N
+     * of them, and in an AlignedAllocator vector once it grows past that.
+     * Only the operations MtmVec needs are provided, with the same meaning
+     * as for vector. Like AlignedAllocator, elements created without a
+     * value are default initialized.
+     * A buffer that moved to the heap stays there, so shrinking it again
+     * keeps its capacity.
+     */
+    template <typename T, size_t N>
+    class SmallVector {
+        typedef vector<T, AlignedAllocator<T> > Heap;
+        Heap heap;
+        typename std::aligned_storage<N*sizeof(T), alignof(T)>::type local;
+        size_t local_size;
+        bool on_heap;
+
+        T* localData() { return reinterpret_cast<T*>(&local); }
+        const T* localData() const {
+            return reinterpret_cast<const T*>(&local);
+        }
+        void destroyLocal(size_t from) {
+            for (size_t i = from; i < local_size; i++) {
+                localData()[i].~T();
+            }
+            local_size = from < local_size ? from : local_size;
+        }
+        template <typename It>
+        void constructLocal(It first, size_t n) {
+            for (; local_size < n; ++local_size, ++first) {
+                ::new((void*)(localData() + local_size)) T(*first);
+            }
+        }
+        /*
+         * Moves the inline elements into heap, with room for n.
+         */
+        void moveToHeap(size_t n) {
+            Heap grown;
+            grown.reserve(n);
+            grown.insert(grown.end(), std::make_move_iterator(localData()),
+                         std::make_move_iterator(localData() + local_size));
+            destroyLocal(0);
+            heap.swap(grown);
+            on_heap = true;
+        }
+    public:
+        SmallVector() : heap(), local_size(0), on_heap(false) {}
+        SmallVector(const SmallVector& other) : SmallVector() {
+            *this = other;
+        }
+        SmallVector(SmallVector&& other) noexcept : SmallVector() {
+            *this = std::move(other);
+        }
+        ~SmallVector() {
+            destroyLocal(0);
+        }
+
+        SmallVector& operator=(const SmallVector& other) {
+            if (this == &other) return *this;
+            if (on_heap) {
+                heap.assign(other.begin(), other.end());
+            }
+            else if (other.size() <= N) {
+                destroyLocal(0);
+                constructLocal(other.begin(), other.size());
+            }
+            else {
+                Heap copy(other.begin(), other.end());
+                destroyLocal(0);
+                heap.swap(copy);
+                on_heap = true;
+            }
+            return *this;
+        }
+
+        SmallVector& operator=(SmallVector&& other) noexcept {
+            if (this == &other) return *this;
+            destroyLocal(0);
+            if (other.on_heap) {
+                heap = std::move(other.heap);
+                on_heap = true;
+                return *this;
+            }
+            Heap().swap(heap);
+            on_heap = false;
+            constructLocal(std::make_move_iterator(other.localData()),
+                           other.local_size);
+            return *this;
+        }
+
+        void assign(size_t n, const T& val) {
+            if (on_heap) {
+                heap.assign(n, val);
+            }
+            else if (n <= N) {
+                destroyLocal(0);
+                for (; local_size < n; ++local_size) {
+                    ::new((void*)(localData() + local_size)) T(val);
+                }
+            }
+            else {
+                Heap filled(n, val);
+                destroyLocal(0);
+                heap.swap(filled);
+                on_heap = true;
+            }
+        }
+
+        void resize(size_t n) {
+            if (!on_heap && n <= N) {
+                destroyLocal(n);
+                for (; local_size < n; ++local_size) {
+                    ::new((void*)(localData() + local_size)) T;
+                }
+                return;
+            }
+            if (!on_heap) moveToHeap(n);
+            heap.resize(n);
+        }
+
+        void resize(size_t n, const T& val) {
+            if (!on_heap && n <= N) {
+                destroyLocal(n);
+                for (; local_size < n; ++local_size) {
+                    ::new((void*)(localData() + local_size)) T(val);
+                }
+                return;
+            }
+            if (!on_heap) moveToHeap(n);
+            heap.resize(n, val);
+        }
+
+        size_t size() const { return on_heap ? heap.size() : local_size; }
+        T* data() { return on_heap ? heap.data() : localData(); }
+        const T* data() const {
+            return on_heap ? heap.data() : localData();
+        }
+        T* begin() { return data(); }
+        T* end() { return data() + size(); }
+        const T* begin() const { return data(); }
+        const T* end() const { return data() + size(); }
+        T& operator[](size_t i) { return data()[i]; }
+        const T& operator[](size_t i) const { return data()[i]; }
+    };
+
+}
+
+#endif //EX3_MTMSMALLVECTOR_H
@@ -0,0 +1,275 @@
+#ifndef EX3_MTMSTATS_H
+#define EX3_MTMSTATS_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+using std::size_t;
+
+/*
+ * Operation and allocation statistics, compiled in only when MTM_STATS is
+ * defined (cmake -DMTM_STATS=ON). Every counted operation records its calls
+ * and time, and the bytes allocated and freed while it runs are charged to
+ * it (to the innermost one when operations nest). Thrown MtmExceptions are
+ * counted by type. Counters are kept per thread and summed by snapshot().
+ *
+ * Without MTM_STATS the macros below expand to nothing, and snapshot()
+ * returns zeros.
+ */
+#ifdef MTM_STATS
+#define MTM_STATS_OP(op) \
+    MtmMath::MtmStats::OpScope mtm_stats_scope(MtmMath::MtmStats::op)
+#define MTM_STATS_ALLOC(bytes) MtmMath::MtmStats::allocated(bytes)
+#define MTM_STATS_FREE(bytes) MtmMath::MtmStats::freed(bytes)
+#define MTM_STATS_EXCEPTION(type) \
+    MtmMath::MtmStats::thrown(MtmMath::MtmStats::type)
+#else
+#define MTM_STATS_OP(op)
+#define MTM_STATS_ALLOC(bytes)
+#define MTM_STATS_FREE(bytes)
+#define MTM_STATS_EXCEPTION(type)
+#endif
+
+namespace MtmMath {
+    namespace MtmStats {
+        enum Op {
+            OTHER,          //allocations outside any counted operation
+            CONSTRUCT,      //constructors that fill a new object
+            COPY,           //copy construction and copy assignment
+            EVALUATE,       //computing an element-wise expression
+            ADD_ASSIGN,
+            SUB_ASSIGN,
+            SCALE_ASSIGN,
+            MULTIPLY,       //matrix products, dense and sparse
+            TRANSPOSE,
+            MATERIALIZE,    //rewriting a transposed view row by row
+            RESIZE,
+            RESHAPE,
+            REDUCE,         //vecFunc and matFunc
+            NONZERO_SCAN,   //finding the nonzeros for a nonzero_iterator
+            FACTORIZE,      //LU factorization
+            SOLVE,          //solving with a factorization, inverse included
+            OP_COUNT
+        };
+
+        enum Exception {
+            ILLEGAL_INITIALIZATION,
+            OUT_OF_MEMORY,
+            DIMENSION_MISMATCH,
+            CHANGE_MAT_FAIL,
+            ACCESS_ILLEGAL_ELEMENT,
+            FILE_ERROR,
+            SINGULAR_MATRIX,
+            EXCEPTION_COUNT
+        };
+
+        struct OpStats {
+            uint64_t calls;
+            uint64_t nanoseconds; //including nested operations
+            uint64_t allocations;
+            uint64_t bytes_allocated;
+            uint64_t bytes_freed;
+        };
+
+        struct Snapshot {
+            OpStats ops[OP_COUNT];
+            uint64_t exceptions[EXCEPTION_COUNT];
+        };
+
+        inline const char* opName(Op op) {
+            static const char* const names[OP_COUNT] = {
+                "other", "construct", "copy", "evaluate", "add_assign",
+                "sub_assign", "scale_assign", "multiply", "transpose",
+                "materialize", "resize", "reshape", "reduce", "nonzero_scan",
+                "factorize", "solve"
+            };
+            return names[op];
+        }
+
+        inline const char* exceptionName(Exception type) {
+            static const char* const names[EXCEPTION_COUNT] = {
+                "IllegalInitialization", "OutOfMemory", "DimensionMismatch",
+                "ChangeMatFail", "AccessIllegalElement", "FileError",
+                "SingularMatrix"
+            };
+            return names[type];
+        }
+
+        /*
+         * Counters of one thread. Only the owning thread writes them, so an
+         * update is a relaxed load and store, never a locked instruction;
+         * atomics only make reading them from snapshot() well defined.
+         */
+        class ThreadCounters {
+        public:
+            struct Counter {
+                std::atomic<uint64_t> value;
+                Counter() : value(0) {}
+                void add(uint64_t n) {
+                    value.store(value.load(std::memory_order_relaxed) + n,
+                                std::memory_order_relaxed);
+                }
+                uint64_t get() const {
+                    return value.load(std::memory_order_relaxed);
+                }
+            };
+            struct OpCounters {
+                Counter calls, nanoseconds, allocations, bytes_allocated,
+                        bytes_freed;
+            };
+            OpCounters ops[OP_COUNT];
+            Counter exceptions[EXCEPTION_COUNT];
+            Op current; //innermost running operation
+
+            ThreadCounters();
+            ~ThreadCounters();
+            void addTo(Snapshot& snapshot) const;
+        };
+
+        /*
+         * The counters of all running threads, and the sums of the threads
+         * that already exited.
+         */
+        struct Registry {
+            std::mutex mutex;
+            std::vector<ThreadCounters*> threads;
+            Snapshot retired;
+            Snapshot baseline; //subtracted from snapshots, set by reset()
+            Registry() : retired(), baseline() {}
+        };
+
+        /*
+         * Never destroyed: thread pool workers exit, and fold their counters
+         * into it, while static objects are being destroyed.
+         */
+        inline Registry& registry() {
+            static Registry* reg = new Registry();
+            return *reg;
+        }
+
+        inline ThreadCounters& local() {
+            static thread_local ThreadCounters counters;
+            return counters;
+        }
+
+        inline ThreadCounters::ThreadCounters() : current(OTHER) {
+            Registry& reg = registry();
+            std::lock_guard<std::mutex> guard(reg.mutex);
+            reg.threads.push_back(this);
+        }
+
+        inline ThreadCounters::~ThreadCounters() {
+            Registry& reg = registry();
+            std::lock_guard<std::mutex> guard(reg.mutex);
+            addTo(reg.retired);
+            reg.threads.erase(std::find(reg.threads.begin(),
+                                        reg.threads.end(), this));
+        }
+
+        inline void ThreadCounters::addTo(Snapshot& snapshot) const {
+            for (size_t op = 0; op < OP_COUNT; op++) {
+                OpStats& dest = snapshot.ops[op];
+                dest.calls += ops[op].calls.get();
+                dest.nanoseconds += ops[op].nanoseconds.get();
+                dest.allocations += ops[op].allocations.get();
+                dest.bytes_allocated += ops[op].bytes_allocated.get();
+                dest.bytes_freed += ops[op].bytes_freed.get();
+            }
+            for (size_t e = 0; e < EXCEPTION_COUNT; e++) {
+                snapshot.exceptions[e] += exceptions[e].get();
+            }
+        }
+
+        /*
+         * Totals over all threads since the last reset().
+         */
+        inline Snapshot snapshot() {
+            Snapshot res = Snapshot();
+#ifdef MTM_STATS
+            Registry& reg = registry();
+            std::lock_guard<std::mutex> guard(reg.mutex);
+            res = reg.retired;
+            for (ThreadCounters* counters : reg.threads) {
+                counters->addTo(res);
+            }
+            for (size_t op = 0; op < OP_COUNT; op++) {
+                OpStats& dest = res.ops[op];
+                const OpStats& base = reg.baseline.ops[op];
+                dest.calls -= base.calls;
+                dest.nanoseconds -= base.nanoseconds;
+                dest.allocations -= base.allocations;
+                dest.bytes_allocated -= base.bytes_allocated;
+                dest.bytes_freed -= base.bytes_freed;
+            }
+            for (size_t e = 0; e < EXCEPTION_COUNT; e++) {
+                res.exceptions[e] -= reg.baseline.exceptions[e];
+            }
+#endif
+            return res;
+        }
+
+        /*
+         * Starts counting from zero. Other threads are never written to, the
+         * current totals are only remembered and subtracted later.
+         */
+        inline void reset() {
+#ifdef MTM_STATS
+            Registry& reg = registry();
+            Snapshot now = Snapshot();
+            std::lock_guard<std::mutex> guard(reg.mutex);
+            now = reg.retired;
+            for (ThreadCounters* counters : reg.threads) {
+                counters->addTo(now);
+            }
+            reg.baseline = now;
+#endif
+        }
+
+        inline void allocated(size_t bytes) {
+            ThreadCounters& c = local();
+            c.ops[c.current].allocations.add(1);
+            c.ops[c.current].bytes_allocated.add(bytes);
+        }
+
+        inline void freed(size_t bytes) {
+            ThreadCounters& c = local();
+            c.ops[c.current].bytes_freed.add(bytes);
+        }
+
+        inline void thrown(Exception type) {
+            ThreadCounters& c = local();
+            c.exceptions[type].add(1);
+        }
+
+        /*
+         * Counts one call of op and the time until the end of the scope.
+         */
+        class OpScope {
+            ThreadCounters& counters;
+            Op op;
+            Op outer;
+            std::chrono::steady_clock::time_point start;
+        public:
+            explicit OpScope(Op op_t) : counters(local()), op(op_t),
+            outer(counters.current), start(std::chrono::steady_clock::now()) {
+                counters.current = op;
+            }
+            ~OpScope() {
+                uint64_t ns = std::chrono::duration_cast<
+                        std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start).count();
+                counters.ops[op].calls.add(1);
+                counters.ops[op].nanoseconds.add(ns);
+                counters.current = outer;
+            }
+            OpScope(const OpScope&) = delete;
+            OpScope& operator=(const OpScope&) = delete;
+        };
+    }
+}
+
+#endif //EX3_MTMSTATS_H
@@ -0,0 +1,797 @@
+#ifndef EX3_MTMTEXT_H
+#define EX3_MTMTEXT_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <clocale>
+#include <cmath>
+#include <algorithm>
+#include <cfloat>
+#include "MtmExceptions.h"
+#include "MtmThreadPool.h"
+#include "MtmVec.h"
+#include "MtmMat.h"
+#include "Complex.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && LDBL_MANT_DIG == 64
+#define MTM_TEXT_X87 1
+#endif
+
+using std::size_t;
+using std::string;
+using std::vector;
+
+namespace MtmMath {
+    /*
+     * Matrices and vectors as text, one row per line, the elements separated
+     * by commas (CSV) or by spaces and tabs (WHITESPACE). Complex elements
+     * are written re+imi, and read as re+imi, re-imi, re or imi.
+     *
+     *     MtmMat<double> m=MtmText::readMat<double>("m.csv",MtmText::CSV);
+     *     MtmText::write(m,std::cout);
+     *
+     * The input is read in large chunks and the numbers are parsed and
+     * formatted directly in memory, in the same format whatever the locale.
+     * The lines of large inputs are parsed on the thread pool, unless
+     * parallel is false.
+     * Input that doesn't hold a matrix of T throws MtmExceptions::FileError
+     * with the line it was found on; rows of different lengths are an error.
+     */
+    namespace MtmText {
+        enum Format { WHITESPACE, CSV };
+
+        /*
+         * Bytes read from the stream at a time, and the smallest amount of
+         * lines worth splitting between threads.
+         */
+        const size_t CHUNK = 8*1024*1024;
+        const size_t PARALLEL_THRESHOLD = 1024*1024;
+
+        ////////Numbers////////
+
+        /*
+         * Powers of ten that are exact doubles.
+         */
+        inline double exactPow10(int e) {
+            static const double pow10[] = {
+                1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+                1e21, 1e22
+            };
+            return pow10[e];
+        }
+
+        /*
+         * 10^k for 0<=k<=351, in long double. Up to 10^27 the powers are
+         * exact in a 64 bit significand, larger ones are within 1.5 units
+         * in its last place.
+         */
+        inline long double longPow10(int k) {
+            static const long double small[27] = {
+                1e0L, 1e1L, 1e2L, 1e3L, 1e4L, 1e5L, 1e6L, 1e7L, 1e8L, 1e9L,
+                1e10L, 1e11L, 1e12L, 1e13L, 1e14L, 1e15L, 1e16L, 1e17L,
+                1e18L, 1e19L, 1e20L, 1e21L, 1e22L, 1e23L, 1e24L, 1e25L,
+                1e26L
+            };
+            static const long double big[14] = {
+                1e0L, 1e27L, 1e54L, 1e81L, 1e108L, 1e135L, 1e162L, 1e189L,
+                1e216L, 1e243L, 1e270L, 1e297L, 1e324L, 1e351L
+            };
+            return big[k/27]*small[k%27];
+        }
+
+        /*
+         * w*10^e rounded to a double, computed in the 64 bit significand of
+         * the x87 long double. It is rounded a second time to 53 bits, which
+         * is only wrong if a double halfway point is within the error of the
+         * first result (error units in its last place), about one number in
+         * five hundred: those, and results that aren't normal doubles, are
+         * left to the caller (false).
+         */
+        inline bool roundedProduct(uint64_t w, int e, int error, double& out) {
+#ifdef MTM_TEXT_X87
+            if (e < -340 || e > 308) return false;
+            long double y = e >= 0 ? (long double)w*longPow10(e) :
+                            (long double)w/longPow10(-e);
+            if (!(y >= DBL_MIN && y <= DBL_MAX)) return false;
+            error += e >= -27 && e <= 27 ? 1 : 4;
+            uint64_t significand;
+            std::memcpy(&significand, &y, sizeof(significand));
+            uint64_t low = significand & 0x7ff; //the bits rounded off
+            if (low + error >= 0x400 && low <= 0x400 + (uint64_t)error) {
+                return false;
+            }
+            out = (double)y;
+            return true;
+#else
+            (void)w;
+            (void)e;
+            (void)error;
+            (void)out;
+            return false;
+#endif
+        }
+
+        /*
+         * strtod for the numbers the fast paths leave. It reads the locale's
+         * decimal point, so the '.' is swapped for it.
+         */
+        inline double slowParse(const char* begin, const char* end) {
+            string token(begin, end);
+            char point = *std::localeconv()->decimal_point;
+            for (char& c : token) {
+                if (c == '.') c = point;
+            }
+            return std::strtod(token.c_str(), nullptr);
+        }
+
+        /*
+         * mantissa*10^exp10 rounded to a double, exact if no nonzero digit
+         * was dropped from mantissa. If mantissa is below 2^53 and the
+         * power of ten is exact in a double, one correctly rounded
+         * multiplication or division gives it (Clinger's fast path),
+         * otherwise roundedProduct. False if neither can round it correctly.
+         */
+        inline bool decimalToDouble(uint64_t mantissa, int exp10, bool exact,
+                                    double& out) {
+            if (mantissa == 0) {
+                out = 0;
+                return true;
+            }
+            if (exact && mantissa <= ((uint64_t)1 << 53) && exp10 >= -22 &&
+                exp10 <= 22) {
+                double val = (double)mantissa;
+                out = exp10 < 0 ? val/exactPow10(-exp10) :
+                      val*exactPow10(exp10);
+                return true;
+            }
+            return roundedProduct(mantissa, exp10, exact ? 0 : 32, out);
+        }
+
+        /*
+         * Parses a decimal floating point number at p, leaving p after it.
+         * The first 19 significant digits are read into an integer and
+         * converted by decimalToDouble, or by strtod if it can't.
+         * Returns false if there is no number at p.
+         */
+        inline bool parseNumber(const char*& p, const char* end, double& out) {
+            const char* begin = p;
+            const char* s = p;
+            bool negative = false;
+            if (s < end && (*s == '+' || *s == '-')) {
+                negative = *s == '-';
+                ++s;
+            }
+            uint64_t mantissa = 0;
+            int digits = 0;     //significant digits in mantissa
+            int exp10 = 0;
+            bool any = false;
+            bool exact = true;  //no nonzero digit was dropped
+            for (; s < end && (unsigned)(*s - '0') < 10; ++s) {
+                any = true;
+                if (digits < 19) {
+                    mantissa = mantissa*10 + (unsigned)(*s - '0');
+                    digits += mantissa != 0;
+                }
+                else {
+                    exact = exact && *s == '0';
+                    exp10++;
+                }
+            }
+            if (s < end && *s == '.') {
+                for (++s; s < end && (unsigned)(*s - '0') < 10; ++s) {
+                    any = true;
+                    if (digits < 19) {
+                        mantissa = mantissa*10 + (unsigned)(*s - '0');
+                        digits += mantissa != 0;
+                        exp10--;
+                    }
+                    else {
+                        exact = exact && *s == '0';
+                    }
+                }
+            }
+            if (!any) {
+                //inf and nan, rare enough for strtod
+                if (s == end || (*s != 'i' && *s != 'I' && *s != 'n' &&
+                                 *s != 'N')) {
+                    return false;
+                }
+                string token(begin, end);
+                char* after;
+                double val = std::strtod(token.c_str(), &after);
+                if (after == token.c_str()) return false;
+                p = begin + (after - token.c_str());
+                out = val;
+                return true;
+            }
+            if (s < end && (*s == 'e' || *s == 'E')) {
+                const char* e = s + 1;
+                bool exp_negative = false;
+                if (e < end && (*e == '+' || *e == '-')) {
+                    exp_negative = *e == '-';
+                    ++e;
+                }
+                if (e < end && (unsigned)(*e - '0') < 10) {
+                    int value = 0;
+                    for (; e < end && (unsigned)(*e - '0') < 10; ++e) {
+                        if (value < 100000) value = value*10 + (*e - '0');
+                    }
+                    exp10 += exp_negative ? -value : value;
+                    s = e;
+                }
+            }
+            p = s;
+            double val;
+            if (!decimalToDouble(mantissa, exp10, exact, val)) {
+                val = slowParse(negative ? begin + 1 : begin, s);
+            }
+            out = negative ? -val : val;
+            return true;
+        }
+
+        inline bool parseElement(const char*& p, const char* end, double& x) {
+            return parseNumber(p, end, x);
+        }
+
+        inline bool parseElement(const char*& p, const char* end, float& x) {
+            double val;
+            if (!parseNumber(p, end, val)) return false;
+            x = (float)val;
+            return true;
+        }
+
+        inline bool parseElement(const char*& p, const char* end, int& x) {
+            const char* s = p;
+            bool negative = false;
+            if (s < end && (*s == '+' || *s == '-')) {
+                negative = *s == '-';
+                ++s;
+            }
+            const char* digits = s;
+            int64_t val = 0;
+            for (; s < end && (unsigned)(*s - '0') < 10; ++s) {
+                val = val*10 + (*s - '0');
+                if (val > (int64_t)INT32_MAX + 1) return false;
+            }
+            if (s == digits || (!negative && val > INT32_MAX)) return false;
+            x = (int)(negative ? -val : val);
+            p = s;
+            return true;
+        }
+
+        inline bool parseElement(const char*& p, const char* end,
+                                 Complex& x) {
+            double re;
+            if (!parseNumber(p, end, re)) return false;
+            if (p < end && *p == 'i') {
+                ++p;
+                x = Complex(0, re);
+                return true;
+            }
+            if (p < end && (*p == '+' || *p == '-')) {
+                double im;
+                if (!parseNumber(p, end, im) || p == end || *p != 'i') {
+                    return false;
+                }
+                ++p;
+                x = Complex(re, im);
+                return true;
+            }
+            x = Complex(re, 0);
+            return true;
+        }
+
+        /*
+         * Writes the decimal digits of val at out, two at a time, returns
+         * their end.
+         */
+        inline char* formatUnsigned(char* out, uint64_t val) {
+            static const char pairs[] =
+                    "00010203040506070809101112131415161718192021222324"
+                    "25262728293031323334353637383940414243444546474849"
+                    "50515253545556575859606162636465666768697071727374"
+                    "75767778798081828384858687888990919293949596979899";
+            char digits[20];
+            char* p = digits + 20;
+            while (val >= 100) {
+                p -= 2;
+                std::memcpy(p, pairs + 2*(val % 100), 2);
+                val /= 100;
+            }
+            if (val >= 10) {
+                p -= 2;
+                std::memcpy(p, pairs + 2*val, 2);
+            }
+            else {
+                *--p = (char)('0' + val);
+            }
+            size_t n = (size_t)(digits + 20 - p);
+            std::memcpy(out, p, n);
+            return out + n;
+        }
+
+        /*
+         * Writes x at out, returns the end of what was written. out has
+         * room for 64 characters.
+         */
+        inline char* formatElement(char* out, int x) {
+            if (x < 0) *out++ = '-';
+            return formatUnsigned(out, x < 0 ? 0u - (uint64_t)(int64_t)x :
+                                          (uint64_t)x);
+        }
+
+        /*
+         * The n digits of d (no leading zero), the first one worth
+         * 10^exp10, like printf's %g: positional unless the exponent is
+         * below -4 or at least 17, trailing zeros dropped.
+         */
+        inline char* formatDigits(char* out, uint64_t d, int n, int exp10) {
+            while (n > 1 && d % 10 == 0) {
+                d /= 10;
+                n--;
+            }
+            char digits[20];
+            formatUnsigned(digits, d);
+            if (exp10 >= -5 && exp10 < 17) {
+                if (exp10 < 0) {
+                    *out++ = '0';
+                    *out++ = '.';
+                    for (int i = -1; i > exp10; i--) *out++ = '0';
+                    std::memcpy(out, digits, (size_t)n);
+                    return out + n;
+                }
+                for (int i = 0; i <= exp10; i++) {
+                    *out++ = i < n ? digits[i] : '0';
+                }
+                if (n > exp10 + 1) {
+                    *out++ = '.';
+                    std::memcpy(out, digits + exp10 + 1,
+                                (size_t)(n - exp10 - 1));
+                    out += n - exp10 - 1;
+                }
+                return out;
+            }
+            *out++ = digits[0];
+            if (n > 1) {
+                *out++ = '.';
+                std::memcpy(out, digits + 1, (size_t)(n - 1));
+                out += n - 1;
+            }
+            *out++ = 'e';
+            *out++ = exp10 < 0 ? '-' : '+';
+            unsigned e = (unsigned)(exp10 < 0 ? -exp10 : exp10);
+            if (e < 10) *out++ = '0';
+            return formatUnsigned(out, e);
+        }
+
+        /*
+         * Fallback of formatFloating, printf with the locale's decimal
+         * point swapped back.
+         */
+        inline char* printNumber(char* out, int precision, double x) {
+            int n = std::snprintf(out, 32, "%.*g", precision, x);
+            char point = *std::localeconv()->decimal_point;
+            if (point != '.') {
+                for (int i = 0; i < n; i++) {
+                    if (out[i] == point) out[i] = '.';
+                }
+            }
+            return out + n;
+        }
+
+        /*
+         * Writes finite, positive x with the fewest significant digits,
+         * from min_digits to max_digits, that read back as the same double
+         * (float if as_float). The 17 leading digits are found by scaling x
+         * in long double, shorter candidates by rounding them, and every
+         * candidate is checked by converting it back.
+         */
+        inline char* formatFloating(char* out, double x, int min_digits,
+                                    int max_digits, bool as_float) {
+            const uint64_t MIN17 = 10000000000000000ull;
+            int exp10 = (int)std::floor(std::log10(x));
+            uint64_t d17 = 0;
+            for (int tries = 0; tries < 2; tries++) {
+                int k = 16 - exp10;
+                long double scaled = k >= 0 ? (long double)x*longPow10(k) :
+                                     (long double)x/longPow10(-k);
+                d17 = (uint64_t)(scaled + 0.5L);
+                if (d17 >= 10*MIN17) exp10++;
+                else if (d17 < MIN17) exp10--;
+                else break;
+            }
+            if (d17 >= MIN17 && d17 < 10*MIN17) {
+                uint64_t divisor = 1;
+                for (int i = min_digits; i < 17; i++) divisor *= 10;
+                for (int n = min_digits; n <= max_digits; n++) {
+                    uint64_t d = (d17 + divisor/2)/divisor;
+                    int e = exp10;
+                    if (d >= 10*MIN17/divisor) {
+                        d /= 10; //rounded up to a power of ten
+                        e++;
+                    }
+                    double back;
+                    if (!decimalToDouble(d, e - n + 1, true, back)) {
+                        char* end = formatDigits(out, d, n, e);
+                        back = slowParse(out, end);
+                    }
+                    if (as_float ? (float)back == (float)x : back == x) {
+                        return formatDigits(out, d, n, e);
+                    }
+                    divisor /= 10;
+                }
+            }
+            return printNumber(out, max_digits, x);
+        }
+
+        /*
+         * Integers below 2^53 are written as such, other numbers with the
+         * fewest digits that read back as x.
+         */
+        inline char* formatElement(char* out, double x) {
+            if (x > -9007199254740992.0 && x < 9007199254740992.0 &&
+                x == (double)(int64_t)x && !(x == 0 && std::signbit(x))) {
+                if (x < 0) *out++ = '-';
+                int64_t val = (int64_t)x;
+                return formatUnsigned(out, (uint64_t)(val < 0 ? -val : val));
+            }
+            if (!std::isfinite(x)) return printNumber(out, 17, x);
+            if (std::signbit(x)) {
+                *out++ = '-';
+                x = -x;
+            }
+            if (x == 0) {
+                *out++ = '0';
+                return out;
+            }
+            return formatFloating(out, x, 15, 17, false);
+        }
+
+        inline char* formatElement(char* out, float x) {
+            if (!std::isfinite(x)) return printNumber(out, 9, x);
+            if (std::signbit(x)) {
+                *out++ = '-';
+                x = -x;
+            }
+            if (x == 0) {
+                *out++ = '0';
+                return out;
+            }
+            return formatFloating(out, x, 6, 9, true);
+        }
+
+        inline char* formatElement(char* out, const Complex& x) {
+            out = formatElement(out, x.real());
+            if (!std::signbit(x.imag())) *out++ = '+';
+            out = formatElement(out, x.imag());
+            *out++ = 'i';
+            return out;
+        }
+
+        ////////Reading////////
+
+        /*
+         * Elements of whole lines, parsed by one thread.
+         */
+        template <typename T>
+        struct Part {
+            vector<T> values;
+            size_t lines;       //lines read, empty ones included
+            size_t rows;
+            size_t cols;        //elements in each row, 0 before the first
+            size_t first_row;   //line of the first row
+            size_t error_line;  //line in the part, if error isn't nullptr
+            const char* error;
+            Part() : values(), lines(0), rows(0), cols(0), first_row(0),
+            error_line(0), error(nullptr) {}
+        };
+
+        inline bool isBlank(char c) {
+            return c == ' ' || c == '\t' || c == '\r';
+        }
+
+        /*
+         * Parses the lines in [begin,end), each ending with a '\n' except
+         * maybe the last one, into part. Stops at the first error.
+         */
+        template <typename T>
+        void parseLines(const char* begin, const char* end, Format format,
+                        Part<T>& part) {
+            const char* p = begin;
+            while (p < end) {
+                const char* line_end = static_cast<const char*>(
+                        std::memchr(p, '\n', (size_t)(end - p)));
+                if (line_end == nullptr) line_end = end;
+                size_t count = 0;
+                while (p < line_end && isBlank(*p)) ++p;
+                while (p < line_end) {
+                    T x;
+                    if (!parseElement(p, line_end, x)) {
+                        part.error = "invalid element";
+                        part.error_line = part.lines;
+                        return;
+                    }
+                    part.values.push_back(x);
+                    count++;
+                    const char* field_end = p;
+                    while (p < line_end && isBlank(*p)) ++p;
+                    if (p == line_end) break;
+                    if (format == CSV) {
+                        if (*p != ',') {
+                            part.error = "expected ','";
+                            part.error_line = part.lines;
+                            return;
+                        }
+                        ++p;
+                        while (p < line_end && isBlank(*p)) ++p;
+                        if (p == line_end) {
+                            part.error = "missing element after ','";
+                            part.error_line = part.lines;
+                            return;
+                        }
+                    }
+                    else if (p == field_end) {
+                        part.error = "invalid element";
+                        part.error_line = part.lines;
+                        return;
+                    }
+                }
+                if (count != 0) {
+                    if (part.cols == 0) {
+                        part.cols = count;
+                        part.first_row = part.lines;
+                    }
+                    if (count != part.cols) {
+                        part.error = "rows have different lengths";
+                        part.error_line = part.lines;
+                        return;
+                    }
+                    part.rows++;
+                }
+                part.lines++;
+                p = line_end + 1;
+            }
+        }
+
+        /*
+         * All the elements of a text input, row by row.
+         */
+        template <typename T>
+        struct Table {
+            vector<T> values;
+            size_t rows;
+            size_t cols;
+            size_t lines;
+            Table() : values(), rows(0), cols(0), lines(0) {}
+        };
+
+        /*
+         * Parses the complete lines [begin,end) and appends them to table,
+         * split between the threads if there are enough of them.
+         */
+        template <typename T>
+        void parseChunk(const char* begin, const char* end, Format format,
+                        bool parallel, Table<T>& table, const string& name) {
+            size_t size = (size_t)(end - begin);
+            size_t threads = threadPool().size();
+            size_t parts_count = (!parallel || threads == 1 ||
+                                  size < PARALLEL_THRESHOLD) ? 1 : threads;
+            vector<const char*> bounds(parts_count + 1, end);
+            bounds[0] = begin;
+            for (size_t i = 1; i < parts_count; i++) {
+                const char* cut = std::max(bounds[i - 1],
+                                           begin + size*i/parts_count);
+                const char* line_end = static_cast<const char*>(
+                        std::memchr(cut, '\n', (size_t)(end - cut)));
+                bounds[i] = line_end == nullptr ? end : line_end + 1;
+            }
+            vector<Part<T> > parts(parts_count);
+            threadPool().parallelFor(0, parts_count, [&](size_t i) {
+                parts[i].values.reserve((size_t)(bounds[i + 1] - bounds[i])/8);
+                parseLines(bounds[i], bounds[i + 1], format, parts[i]);
+            });
+            for (const Part<T>& part : parts) {
+                if (part.error != nullptr) {
+                    throw MtmExceptions::FileError(name, "line " +
+                            to_string(table.lines + part.error_line + 1) +
+                            ": " + part.error);
+                }
+                if (part.cols != 0) {
+                    if (table.cols == 0) table.cols = part.cols;
+                    if (part.cols != table.cols) {
+                        throw MtmExceptions::FileError(name, "line " +
+                                to_string(table.lines + part.first_row + 1) +
+                                ": rows have different lengths");
+                    }
+                }
+                table.values.insert(table.values.end(), part.values.begin(),
+                                    part.values.end());
+                table.rows += part.rows;
+                table.lines += part.lines;
+            }
+        }
+
+        /*
+         * Reads the stream CHUNK bytes at a time, parsing the complete lines
+         * of each chunk while keeping the last, unfinished one for the next.
+         */
+        template <typename T>
+        Table<T> readTable(std::istream& is, Format format, bool parallel,
+                           const string& name) {
+            Table<T> table;
+            vector<char> buffer;
+            size_t kept = 0;
+            try {
+                buffer.resize(CHUNK);
+                while (is) {
+                    if (buffer.size() - kept < CHUNK/2) {
+                        buffer.resize(buffer.size()*2); //a very long line
+                    }
+                    is.read(buffer.data() + kept,
+                            (std::streamsize)(buffer.size() - kept));
+                    size_t filled = kept + (size_t)is.gcount();
+                    const char* begin = buffer.data();
+                    const char* end = begin + filled;
+                    const char* last = begin;
+                    if (is) {
+                        for (const char* p = end; p > begin; --p) {
+                            if (p[-1] == '\n') {
+                                last = p;
+                                break;
+                            }
+                        }
+                    }
+                    else {
+                        last = end;
+                    }
+                    parseChunk(begin, last, format, parallel, table, name);
+                    kept = (size_t)(end - last);
+                    std::memmove(buffer.data(), last, kept);
+                }
+            }
+            catch (std::bad_alloc& e) {throw MtmExceptions::OutOfMemory();}
+            if (is.bad()) throw MtmExceptions::FileError(name, "read failed");
+            if (table.rows == 0) throw MtmExceptions::IllegalInitialization();
+            return table;
+        }
+
+        template <typename T>
+        MtmMat<T> toMat(const Table<T>& table) {
+            MtmMat<T> mat(Dimensions(table.rows, table.cols));
+            for (size_t i = 0; i < table.rows; i++) {
+                std::copy(table.values.begin() + i*table.cols,
+                          table.values.begin() + (i + 1)*table.cols,
+                          mat.rowPtr(i));
+            }
+            return mat;
+        }
+
+        /*
+         * A single row or column, MtmExceptions::FileError otherwise.
+         */
+        template <typename T>
+        MtmVec<T> toVec(const Table<T>& table, const string& name) {
+            if (table.rows != 1 && table.cols != 1) {
+                throw MtmExceptions::FileError(name, "not a vector");
+            }
+            MtmVec<T> vec(table.values.size());
+            std::copy(table.values.begin(), table.values.end(),
+                      vec.dataPtr());
+            if (table.rows == 1 && table.cols != 1) vec.transpose();
+            return vec;
+        }
+
+        template <typename T>
+        MtmMat<T> readMat(std::istream& is, Format format = WHITESPACE,
+                          bool parallel = true) {
+            return toMat(readTable<T>(is, format, parallel, "input"));
+        }
+
+        template <typename T>
+        MtmMat<T> readMat(const string& path, Format format = WHITESPACE,
+                          bool parallel = true) {
+            std::ifstream file(path, std::ios::binary);
+            if (!file) throw MtmExceptions::FileError(path, "can't open");
+            return toMat(readTable<T>(file, format, parallel, path));
+        }
+
+        /*
+         * A file with one line is read as a row vector, a file with one
+         * element per line as a column vector.
+         */
+        template <typename T>
+        MtmVec<T> readVec(std::istream& is, Format format = WHITESPACE,
+                          bool parallel = true) {
+            return toVec(readTable<T>(is, format, parallel, "input"),
+                         "input");
+        }
+
+        template <typename T>
+        MtmVec<T> readVec(const string& path, Format format = WHITESPACE,
+                          bool parallel = true) {
+            std::ifstream file(path, std::ios::binary);
+            if (!file) throw MtmExceptions::FileError(path, "can't open");
+            return toVec(readTable<T>(file, format, parallel, path), path);
+        }
+
+        ////////Writing////////
+
+        /*
+         * Formats rows x cols elements, at(i,j) giving element (i,j), into
+         * a buffer written to the stream whenever it fills up.
+         */
+        template <typename T, typename At>
+        void writeTable(std::ostream& os, size_t rows, size_t cols,
+                        Format format, const At& at, const string& name) {
+            const size_t FLUSH = 64*1024;
+            vector<char> buffer(FLUSH + 128);
+            char* out = buffer.data();
+            char separator = format == CSV ? ',' : ' ';
+            for (size_t i = 0; i < rows; i++) {
+                for (size_t j = 0; j < cols; j++) {
+                    if (j != 0) *out++ = separator;
+                    out = formatElement(out, at(i, j));
+                    if ((size_t)(out - buffer.data()) >= FLUSH) {
+                        os.write(buffer.data(), out - buffer.data());
+                        out = buffer.data();
+                    }
+                }
+                *out++ = '\n';
+            }
+            os.write(buffer.data(), out - buffer.data());
+            if (!os) throw MtmExceptions::FileError(name, "write failed");
+        }
+
+        template <typename T>
+        void write(const MtmMat<T>& mat, std::ostream& os,
+                   Format format = WHITESPACE) {
+            writeTable<T>(os, (size_t)mat.getRow(), (size_t)mat.getCol(),
+                          format, [&](size_t i, size_t j) -> const T& {
+                return mat.atUnchecked(i, j);
+            }, "output");
+        }
+
+        template <typename T>
+        void write(const MtmMat<T>& mat, const string& path,
+                   Format format = WHITESPACE) {
+            std::ofstream file(path, std::ios::binary);
+            if (!file) throw MtmExceptions::FileError(path, "can't open");
+            writeTable<T>(file, (size_t)mat.getRow(), (size_t)mat.getCol(),
+                          format, [&](size_t i, size_t j) -> const T& {
+                return mat.atUnchecked(i, j);
+            }, path);
+        }
+
+        /*
+         * A row vector is written on one line, a column vector one element
+         * per line.
+         */
+        template <typename T>
+        void write(const MtmVec<T>& vec, std::ostream& os,
+                   Format format = WHITESPACE) {
+            writeTable<T>(os, (size_t)vec.getRow(), (size_t)vec.getCol(),
+                          format, [&](size_t i, size_t j) -> const T& {
+                return vec.atUnchecked(i + j);
+            }, "output");
+        }
+
+        template <typename T>
+        void write(const MtmVec<T>& vec, const string& path,
+                   Format format = WHITESPACE) {
+            std::ofstream file(path, std::ios::binary);
+            if (!file) throw MtmExceptions::FileError(path, "can't open");
+            writeTable<T>(file, (size_t)vec.getRow(), (size_t)vec.getCol(),
+                          format, [&](size_t i, size_t j) -> const T& {
+                return vec.atUnchecked(i + j);
+            }, path);
+        }
+    }
+}
+
+#endif //EX3_MTMTEXT_H
@@ -0,0 +1,245 @@
+#ifndef EX3_MTMTHREADPOOL_H
+#define EX3_MTMTHREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <memory>
+
+using std::size_t;
+using std::vector;
+
+namespace MtmMath {
+
+    /*
+     * Persistent pool of worker threads used by the parallel kernels.
+     * Every worker owns a task deque; it pops its own tasks from the back
+     * and, when it runs dry, steals from the front of the other deques.
+     * The thread calling parallelFor works on the batch too, so a pool of
+     * n threads runs n-1 workers and nested calls cannot deadlock.
+     */
+    class ThreadPool {
+    public:
+        explicit ThreadPool(size_t threads);
+        ~ThreadPool();
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+        /*
+         * Number of threads taking part in a parallelFor, caller included.
+         */
+        size_t size() const;
+        /*
+         * Restarts the pool with the given number of threads (0 picks the
+         * hardware concurrency). Must not be called while a parallelFor is
+         * running.
+         */
+        void resize(size_t threads);
+        /*
+         * Calls f(i) for every i in [begin,end) and returns once all calls
+         * finished. The first exception thrown by a call is rethrown here.
+         */
+        void parallelFor(size_t begin, size_t end,
+                         const std::function<void(size_t)>& f);
+
+    private:
+        typedef std::function<void()> Task;
+        struct Queue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+        struct Batch {
+            std::atomic<size_t> remaining;
+            std::mutex mutex;
+            std::condition_variable done;
+            std::exception_ptr error;
+        };
+
+        vector<std::unique_ptr<Queue> > queues;
+        vector<std::thread> workers;
+        std::mutex wake_mutex;
+        std::condition_variable wake;
+        std::atomic<size_t> queued;
+        bool stopping;
+        std::atomic<size_t> next_queue;
+
+        void start(size_t threads);
+        void stop();
+        void workerLoop(size_t id);
+        bool popTask(size_t id, Task& task);
+        static size_t& workerId();
+    };
+
+    /*
+     * Index of the queue owned by the calling worker thread, (size_t)-1 for
+     * threads outside the pool. Those share the last queue, which has no
+     * worker of its own.
+     */
+    inline size_t& ThreadPool::workerId() {
+        static thread_local size_t id = (size_t)-1;
+        return id;
+    }
+
+    inline ThreadPool::ThreadPool(size_t threads) :
+    queues(), workers(), wake_mutex(), wake(), queued(0), stopping(false),
+    next_queue(0) {
+        start(threads);
+    }
+
+    inline ThreadPool::~ThreadPool() {
+        stop();
+    }
+
+    inline size_t ThreadPool::size() const {
+        return workers.size() + 1;
+    }
+
+    inline void ThreadPool::resize(size_t threads) {
+        stop();
+        start(threads);
+    }
+
+    inline void ThreadPool::start(size_t threads) {
+        if (threads == 0) {
+            threads = std::thread::hardware_concurrency();
+            if (threads == 0) threads = 1;
+        }
+        stopping = false;
+        queues.clear();
+        for (size_t i = 0; i < threads; i++) {
+            queues.push_back(std::unique_ptr<Queue>(new Queue()));
+        }
+        for (size_t i = 0; i + 1 < threads; i++) {
+            workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+        }
+    }
+
+    inline void ThreadPool::stop() {
+        {
+            std::lock_guard<std::mutex> guard(wake_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+        workers.clear();
+    }
+
+    /*
+     * Takes a task from queue id, or steals one from the other queues.
+     */
+    inline bool ThreadPool::popTask(size_t id, Task& task) {
+        size_t n = queues.size();
+        if (id < n) {
+            Queue& own = *queues[id];
+            std::lock_guard<std::mutex> guard(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                --queued;
+                return true;
+            }
+        }
+        for (size_t k = 1; k <= n; k++) {
+            Queue& victim = *queues[(id + k) % n];
+            std::lock_guard<std::mutex> guard(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                --queued;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    inline void ThreadPool::workerLoop(size_t id) {
+        workerId() = id;
+        Task task;
+        while (true) {
+            if (popTask(id, task)) {
+                task();
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(wake_mutex);
+            wake.wait(guard, [this] { return stopping || queued > 0; });
+            if (stopping && queued == 0) return;
+        }
+    }
+
+    inline void ThreadPool::parallelFor(size_t begin, size_t end,
+                                        const std::function<void(size_t)>& f) {
+        if (begin >= end) return;
+        if (workers.empty() || end - begin == 1) {
+            for (size_t i = begin; i < end; i++) {
+                f(i);
+            }
+            return;
+        }
+        Batch batch;
+        batch.remaining = end - begin;
+        size_t n = queues.size();
+        for (size_t i = begin; i < end; i++) {
+            Task task = [&batch, &f, i] {
+                try {
+                    f(i);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> guard(batch.mutex);
+                    if (!batch.error) batch.error = std::current_exception();
+                }
+                std::lock_guard<std::mutex> guard(batch.mutex);
+                if (--batch.remaining == 0) batch.done.notify_all();
+            };
+            Queue& queue = *queues[next_queue++ % n];
+            std::lock_guard<std::mutex> guard(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+            ++queued;
+        }
+        {
+            std::lock_guard<std::mutex> guard(wake_mutex);
+        }
+        wake.notify_all();
+        size_t id = workerId() < n ? workerId() : n - 1;
+        Task task;
+        while (batch.remaining > 0) {
+            if (popTask(id, task)) {
+                task();
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(batch.mutex);
+            batch.done.wait(guard, [&batch] { return batch.remaining == 0; });
+        }
+        std::lock_guard<std::mutex> guard(batch.mutex);
+        if (batch.error) std::rethrow_exception(batch.error);
+    }
+
+    /*
+     * The pool shared by all MtmMath kernels. It is created on first use
+     * with one thread per hardware thread.
+     */
+    inline ThreadPool& threadPool() {
+        static ThreadPool pool(0);
+        return pool;
+    }
+
+    /*
+     * Sets how many threads the MtmMath kernels use, 0 picks the hardware
+     * concurrency and 1 makes every kernel serial.
+     */
+    inline void setNumThreads(size_t threads) {
+        threadPool().resize(threads);
+    }
+
+    inline size_t getNumThreads() {
+        return threadPool().size();
+    }
+
+}
+
+#endif //EX3_MTMTHREADPOOL_H
@@ -0,0 +1,95 @@
+#ifndef EX3_MTMTRANSPOSE_H
+#define EX3_MTMTRANSPOSE_H
+
+#include <algorithm>
+
+using std::size_t;
+
+namespace MtmMath {
+    namespace MtmKernels {
+        /*
+         * Blocks with both sides at most this long are moved directly, the
+         * rows and columns they touch fit in L1 together.
+         */
+        const size_t TRANSPOSE_TILE = 32;
+
+        /*
+         * dst=transpose of the rows x cols block src. Both are row major
+         * with leading dimensions lds and ldd. The longer side is halved
+         * until the blocks are small, so every cache level is used well
+         * without knowing its size.
+         */
+        template <typename T>
+        void transposeCopy(const T* src, size_t lds, T* dst, size_t ldd,
+                           size_t rows, size_t cols) {
+            if (rows <= TRANSPOSE_TILE && cols <= TRANSPOSE_TILE) {
+                for (size_t i = 0; i < rows; i++) {
+                    for (size_t j = 0; j < cols; j++) {
+                        dst[j*ldd + i] = src[i*lds + j];
+                    }
+                }
+                return;
+            }
+            if (rows >= cols) {
+                size_t h = rows/2;
+                transposeCopy(src, lds, dst, ldd, h, cols);
+                transposeCopy(src + h*lds, lds, dst + h, ldd, rows - h, cols);
+            }
+            else {
+                size_t h = cols/2;
+                transposeCopy(src, lds, dst, ldd, rows, h);
+                transposeCopy(src + h, lds, dst + h*ldd, ldd, rows, cols - h);
+            }
+        }
+
+        /*
+         * Swaps the rows x cols block a with the transpose of the
+         * cols x rows block b, both within one matrix of leading
+         * dimension ld.
+         */
+        template <typename T>
+        void transposeSwap(T* a, T* b, size_t ld, size_t rows, size_t cols) {
+            if (rows <= TRANSPOSE_TILE && cols <= TRANSPOSE_TILE) {
+                for (size_t i = 0; i < rows; i++) {
+                    for (size_t j = 0; j < cols; j++) {
+                        std::swap(a[i*ld + j], b[j*ld + i]);
+                    }
+                }
+                return;
+            }
+            if (rows >= cols) {
+                size_t h = rows/2;
+                transposeSwap(a, b, ld, h, cols);
+                transposeSwap(a + h*ld, b + h, ld, rows - h, cols);
+            }
+            else {
+                size_t h = cols/2;
+                transposeSwap(a, b, ld, rows, h);
+                transposeSwap(a + h, b + h*ld, ld, rows, cols - h);
+            }
+        }
+
+        /*
+         * Transposes the n x n block a in place: the diagonal quadrants
+         * are transposed recursively and the two others swapped across
+         * the diagonal.
+         */
+        template <typename T>
+        void transposeInPlace(T* a, size_t ld, size_t n) {
+            if (n <= TRANSPOSE_TILE) {
+                for (size_t i = 0; i < n; i++) {
+                    for (size_t j = i + 1; j < n; j++) {
+                        std::swap(a[i*ld + j], a[j*ld + i]);
+                    }
+                }
+                return;
+            }
+            size_t h = n/2;
+            transposeInPlace(a, ld, h);
+            transposeInPlace(a + h*ld + h, ld, n - h);
+            transposeSwap(a + h, a + h*ld, ld, h, n - h);
+        }
+    }
+}
+
+#endif //EX3_MTMTRANSPOSE_H
@@ -2,9 +2,16 @@
 #define EX3_MTMVEC_H
 
 #include <vector>
+#include <algorithm>
 #include "MtmExceptions.h"
 #include "Auxilaries.h"
 #include "Complex.h"
+#include "MtmSimd.h"
+#include "MtmExpr.h"
+#include "MtmAllocator.h"
+#include "MtmSmallVector.h"
+#include "MtmThreadPool.h"
+#include "MtmReduce.h"
 #include <iostream>
 #include <assert.h>
 
@@ -13,35 +20,70 @@ using std::size_t;
 
 namespace MtmMath {
     template<typename T>
-    class MtmVec {
+    class MtmVec : public MtmExpr<MtmVec<T> > {
     private:
-        vector<T> data;
+        /*
+         * Vectors of up to INLINE_SIZE elements are stored inside the
+         * object, longer ones on the heap.
+         */
+        static const size_t INLINE_SIZE = 8;
+        SmallVector<T, INLINE_SIZE> data;
         bool is_col_vec;
         Dimensions dim;
-        vector<bool> lock;
+        vector<bool> lock; //true marks a locked cell, empty if none locked
+        template <typename Func>
+        void reduce(Func& f, std::false_type) const;
+        template <typename Func>
+        void reduce(Func& f, std::true_type) const;
     public:
+        typedef T value_type;
         /*
          * Vector constructor, m is the number of elements in it and val is the
          * initial value for the matrix elements
          */
         explicit MtmVec(size_t m, const T &val = T());
         MtmVec(const MtmVec &v);
+        MtmVec(MtmVec&& v) noexcept;
+        /*
+         * Evaluates an element-wise expression of vectors (see MtmExpr.h) in
+         * a single pass.
+         */
+        template <typename E>
+        MtmVec(const MtmExpr<E>& expr, typename std::enable_if<
+               ExprTraits<E>::is_vec && !ExprTraits<E>::is_leaf>::type* =
+               nullptr);
         ~MtmVec() = default;
         /*
          * Vector operators:
+         * +, - and * with vectors or scalars are element-wise expressions,
+         * declared in MtmExpr.h.
          */
         MtmVec& operator=(const MtmVec&);
+        MtmVec& operator=(MtmVec&&) noexcept;
+        template <typename E>
+        typename std::enable_if<ExprTraits<E>::is_vec &&
+                                !ExprTraits<E>::is_leaf, MtmVec&>::type
+        operator=(const MtmExpr<E>& expr);
         MtmVec& operator+=(const MtmVec&);
         MtmVec& operator-=(const MtmVec&);
         MtmVec& operator*=(const T &val);
-        MtmVec operator-() const;
         T& operator[](int pos);
         const T& operator[](int pos) const;
+        /*
+         * Unchecked access for hot loops: pos must be in range, and cell
+         * locks are ignored. dataPtr() points to the size() elements.
+         */
+        T& atUnchecked(size_t pos);
+        const T& atUnchecked(size_t pos) const;
+        T* dataPtr();
+        const T* dataPtr() const;
         /*
          * Function that get function object f and uses it's () operator on
          * each element in the vectors.
          * It outputs the function object's * operator after iterating on all
          * the vector's elements
+         * A mergeable Func (see MtmReduce.h) reduces long vectors in
+         * parallel.
          */
         template<typename Func>
         T vecFunc(Func &f) const;
@@ -101,23 +143,58 @@ namespace MtmMath {
         iterator end();
         nonzero_iterator nzbegin();
         nonzero_iterator nzend();
+
+        template <typename U>
+        friend const U& exprAt(const MtmVec<U>& vec, size_t row, size_t col);
+        template <typename U>
+        friend class MtmMatSparse;
     };
 
                         ////////Constructors////////
     template<typename T>
     MtmVec<T>::MtmVec(size_t m, const T &val) try:
-            data(vector<T>(m,val)), is_col_vec(true) , dim(Dimensions(m,1)) ,
-            lock(m,true) {
+            data(), is_col_vec(true) , dim(Dimensions(m,1)) ,
+            lock() {
                 if (m==0) throw MtmExceptions::IllegalInitialization();
+                MTM_STATS_OP(CONSTRUCT);
+                data.assign(m,val);
             }
      catch (std::bad_alloc& e) {throw MtmExceptions::OutOfMemory();}
 
     template<typename T>
     MtmVec<T>::MtmVec(const MtmVec<T>& v) try:
-           data(vector<T>(v.data)), is_col_vec(v.is_col_vec) , dim(v.dim) ,
-           lock((size_t)v.size(),true) {}
+           data(), is_col_vec(v.is_col_vec) , dim(v.dim) ,
+           lock() {
+               MTM_STATS_OP(COPY);
+               data=v.data;
+           }
            catch (std::bad_alloc& e) {throw MtmExceptions::OutOfMemory();}
 
+    /*
+     * Move constructor, takes over the elements (and the cell locks) of v.
+     */
+    template<typename T>
+    MtmVec<T>::MtmVec(MtmVec<T>&& v) noexcept:
+           data(std::move(v.data)), is_col_vec(v.is_col_vec) , dim(v.dim) ,
+           lock(std::move(v.lock)) {}
+
+    template <typename T>
+    template <typename E>
+    MtmVec<T>::MtmVec(const MtmExpr<E>& expr, typename std::enable_if<
+                      ExprTraits<E>::is_vec && !ExprTraits<E>::is_leaf>::type*)
+    try: data(), is_col_vec(expr.self().isColVector()),
+    dim(expr.self().getDim()), lock() {
+        MTM_STATS_OP(EVALUATE);
+        const E& e=expr.self();
+        size_t size=is_col_vec ? dim.getRow() : dim.getCol();
+        data.resize(size);
+        if (exprKernel(data.data(),size,e)) return;
+        for (size_t i=0;i<size;i++){
+            data[i]=is_col_vec ? e.at(i,0) : e.at(0,i);
+        }
+    }
+    catch (std::bad_alloc& e) {throw MtmExceptions::OutOfMemory();}
+
                         ////////Operators////////
 
     template <typename T>
@@ -125,6 +202,7 @@ namespace MtmMath {
         if (this==&v) {
             return *this;
         }
+    MTM_STATS_OP(COPY);
     try {
         data = v.data;
         lock = v.lock;
@@ -135,16 +213,55 @@ namespace MtmMath {
     return *this;
     }
 
+    template <typename T>
+    MtmVec<T>& MtmVec<T>::operator=(MtmVec<T>&& v) noexcept{
+        if (this==&v) {
+            return *this;
+        }
+        data=std::move(v.data);
+        lock=std::move(v.lock);
+        is_col_vec=v.is_col_vec;
+        dim=v.dim;
+        return *this;
+    }
+
+    /*
+     * Assigning an expression of the same length writes it in place, which
+     * is safe even if the expression reads this vector: every element only
+     * depends on the elements at the same position.
+     */
+    template <typename T>
+    template <typename E>
+    typename std::enable_if<ExprTraits<E>::is_vec &&
+                            !ExprTraits<E>::is_leaf, MtmVec<T>&>::type
+    MtmVec<T>::operator=(const MtmExpr<E>& expr){
+        const E& e=expr.self();
+        if (e.getDim()!=dim||e.isColVector()!=is_col_vec){
+            return *this=MtmVec<T>(expr);
+        }
+        MTM_STATS_OP(EVALUATE);
+        if (!exprKernel(data.data(),data.size(),e)){
+            for (size_t i=0;i<data.size();i++){
+                data[i]=is_col_vec ? e.at(i,0) : e.at(0,i);
+            }
+        }
+        lock.clear(); //like assigning a new vector
+        return *this;
+    }
+
     /*
      * operator [] gives access to the data stored in the pos given to the
      * function. if the pos is out of the vector's range an
      * AccessIllegalElement() exception will be thrown. If the pos is locked,
      * AccessIllegalElement() exception will be thrown.
+     * A negative pos wraps around to a huge pos_unsigned, so one comparison
+     * covers both ends of the range.
      */
     template <typename T>
     T& MtmVec<T>::operator[](int pos) {
         size_t pos_unsigned=(size_t)pos;
-        if (pos<0||pos_unsigned>=data.size()||!lock[pos_unsigned]){
+        if (pos_unsigned>=data.size()||
+            (!lock.empty()&&lock[pos_unsigned])){
             throw MtmExceptions::AccessIllegalElement();
         }
         assert(pos>=0 && pos<(int)data.size());
@@ -154,107 +271,162 @@ namespace MtmMath {
     template <typename T>
     const T& MtmVec<T>::operator[](int pos) const {
        size_t pos_unsigned=(size_t)pos;
-       if (pos<0||pos_unsigned>=data.size()){
+       if (pos_unsigned>=data.size()){
             throw MtmExceptions::AccessIllegalElement();
         }
         assert(pos>=0 && pos<(int)data.size());
         return data[pos_unsigned];
     }
 
+    template <typename T>
+    T& MtmVec<T>::atUnchecked(size_t pos) {
+        assert(pos<data.size());
+        return data[pos];
+    }
+
+    template <typename T>
+    const T& MtmVec<T>::atUnchecked(size_t pos) const {
+        assert(pos<data.size());
+        return data[pos];
+    }
+
+    template <typename T>
+    T* MtmVec<T>::dataPtr() {
+        return data.data();
+    }
+
+    template <typename T>
+    const T* MtmVec<T>::dataPtr() const {
+        return data.data();
+    }
+
     template <typename T>
     MtmVec<T>& MtmVec<T>::operator+=(const MtmVec& v1) {
+        MTM_STATS_OP(ADD_ASSIGN);
         if (dim!=v1.dim||is_col_vec!=v1.is_col_vec){
             throw MtmExceptions::DimensionMismatch(dim,v1.dim);
         }
-        for (int i=0;i<(int)data.size();i++){
-            data[i]+=v1.data[i];
-        }
+        MtmKernels::addArray(data.data(),v1.data.data(),data.size());
         return *this;
     }
 
     template <typename T>
     MtmVec<T>& MtmVec<T>::operator-=(const MtmVec& v1){
+        MTM_STATS_OP(SUB_ASSIGN);
         if (dim!=v1.dim||is_col_vec!=v1.is_col_vec){
             throw MtmExceptions::DimensionMismatch(dim,v1.dim);
         }
-        for (int i=0;i<(int)data.size();i++){
-            data[i]-=v1.data[i];
-        }
+        MtmKernels::subArray(data.data(),v1.data.data(),data.size());
         return *this;
     }
 
     template <typename T>
-    MtmVec<T> operator+(const MtmVec<T>& v1,const MtmVec<T>& v2){
-        return MtmVec<T>(v1)+=v2;
+    MtmVec<T>& MtmVec<T>::operator*=(const T &val) {
+        MTM_STATS_OP(SCALE_ASSIGN);
+        MtmKernels::mulScalar(data.data(),val,data.size());
+        return *this;
+    }
+
+                ////////Operators on expiring vectors////////
+
+    /*
+     * When a vector operand of an element-wise operator is about to be
+     * destroyed and the result is a vector, it is computed into that
+     * operand's storage and returned instead of building a new vector.
+     */
+    template <typename T, typename R>
+    typename std::enable_if<ExprTraits<R>::is_vec, MtmVec<T> >::type
+    operator+(MtmVec<T>&& vec, const MtmExpr<R>& expr){
+        vec=vec+expr;
+        return std::move(vec);
+    }
+
+    template <typename T, typename L>
+    typename std::enable_if<ExprTraits<L>::is_vec, MtmVec<T> >::type
+    operator+(const MtmExpr<L>& expr, MtmVec<T>&& vec){
+        vec=expr+vec;
+        return std::move(vec);
     }
 
     template <typename T>
-    MtmVec<T> operator+(const MtmVec<T>& v1,const T& val){
-        MtmVec<T> res = v1;
-        for (typename MtmVec<T>::iterator it=res.begin();it!=res.end();++it){
-            *it+=val;
-        }
-        return res;
+    MtmVec<T> operator+(MtmVec<T>&& v1, MtmVec<T>&& v2){
+        v1=v1+v2;
+        return std::move(v1);
     }
 
     template <typename T>
-    MtmVec<T> operator+(const T& val,const MtmVec<T>& v1){
-         return v1+val;
+    MtmVec<T> operator+(MtmVec<T>&& vec,
+                        const typename MtmVec<T>::value_type& val){
+        vec=vec+val;
+        return std::move(vec);
     }
 
     template <typename T>
-    MtmVec<T> operator-(const MtmVec<T>& v1,const MtmVec<T>& v2){
-        return MtmVec<T>(v1)-=v2;
+    MtmVec<T> operator+(const typename MtmVec<T>::value_type& val,
+                        MtmVec<T>&& vec){
+        vec=val+vec;
+        return std::move(vec);
+    }
+
+    template <typename T, typename R>
+    typename std::enable_if<ExprTraits<R>::is_vec, MtmVec<T> >::type
+    operator-(MtmVec<T>&& vec, const MtmExpr<R>& expr){
+        vec=vec-expr;
+        return std::move(vec);
+    }
+
+    template <typename T, typename L>
+    typename std::enable_if<ExprTraits<L>::is_vec, MtmVec<T> >::type
+    operator-(const MtmExpr<L>& expr, MtmVec<T>&& vec){
+        vec=expr-vec;
+        return std::move(vec);
     }
 
     template <typename T>
-    MtmVec<T> operator-(const MtmVec<T>& v1,const T& val){
-        MtmVec<T> res=v1;
-        for (typename MtmVec<T>::iterator it=res.begin();it!=res.end();++it){
-            *it-=val;
-        }
-        return res;
+    MtmVec<T> operator-(MtmVec<T>&& v1, MtmVec<T>&& v2){
+        v1=v1-v2;
+        return std::move(v1);
     }
 
     template <typename T>
-    MtmVec<T> operator-(const T& val,const MtmVec<T>& v1){
-            MtmVec<T> res = -v1;
-            return val + res;
+    MtmVec<T> operator-(MtmVec<T>&& vec,
+                        const typename MtmVec<T>::value_type& val){
+        vec=vec-val;
+        return std::move(vec);
     }
 
     template <typename T>
-    MtmVec<T> MtmVec<T>::operator-() const {
-        MtmVec<T> res_vec(data.size(),T());
-        for (int i = 0; i < (int)data.size(); i++) {
-            res_vec.data[i] = -data[i];
-        }
-        res_vec.is_col_vec = is_col_vec;
-        res_vec.dim = dim;
-        return res_vec;
+    MtmVec<T> operator-(const typename MtmVec<T>::value_type& val,
+                        MtmVec<T>&& vec){
+        vec=val-vec;
+        return std::move(vec);
     }
 
     template <typename T>
-    MtmVec<T>& MtmVec<T>::operator*=(const T &val) {
-        for(int i=0;i<(int)data.size();i++){
-            data[i]*=val;
-        }
-        return *this;
+    MtmVec<T> operator-(MtmVec<T>&& vec){
+        vec=-vec;
+        return std::move(vec);
     }
 
     template <typename T>
-    MtmVec<T> operator*(const MtmVec<T>& v1,const T& val){
-        return MtmVec<T>(v1)*=val;
+    MtmVec<T> operator*(MtmVec<T>&& vec,
+                        const typename MtmVec<T>::value_type& val){
+        vec=vec*val;
+        return std::move(vec);
     }
 
     template <typename T>
-    MtmVec<T> operator*(const T& val,const MtmVec<T>& v1){
-        return MtmVec<T>(v1)*=val;
+    MtmVec<T> operator*(const typename MtmVec<T>::value_type& val,
+                        MtmVec<T>&& vec){
+        vec=val*vec;
+        return std::move(vec);
     }
 
                     ////////Vector functions////////
 
     template <typename T>
     void MtmVec<T>::resize(Dimensions new_dim, const T &val){
+        MTM_STATS_OP(RESIZE);
         if ((is_col_vec&&new_dim.getCol()!=1) || (!is_col_vec&&new_dim.getRow
         ()!=1) || new_dim.getRow()==0 || new_dim.getCol()==0){
             throw MtmExceptions::ChangeMatFail(dim,new_dim);
@@ -262,10 +434,11 @@ namespace MtmMath {
         try {
             if (is_col_vec) {
                 data.resize(new_dim.getRow(), val);
-                lock.resize(new_dim.getRow(),true); //handle triangle matrices
             } else {
                 data.resize(new_dim.getCol(), val);
-                lock.resize(new_dim.getCol(),true); //handle triangle matrices
+            }
+            if (!lock.empty()){ //new cells are unlocked
+                lock.resize(data.size(),false);
             }
             dim = new_dim;
         }
@@ -277,14 +450,53 @@ namespace MtmMath {
     template <typename T>
     template<typename Func>
     T MtmVec<T>::vecFunc(Func &f) const {
-        for (int i=0;i<(int)data.size();i++){
+        MTM_STATS_OP(REDUCE);
+        reduce(f,MtmKernels::MergeTag<Func>());
+        return *f;
+    }
+
+    template <typename T>
+    template <typename Func>
+    void MtmVec<T>::reduce(Func& f, std::false_type) const{
+        for (size_t i=0;i<data.size();i++){
             f(data[i]);
         }
-        return *f;
+    }
+
+    /*
+     * Every block of REDUCE_BLOCK elements is reduced by a new Func on the
+     * thread pool, and the blocks are merged into f in order.
+     */
+    template <typename T>
+    template <typename Func>
+    void MtmVec<T>::reduce(Func& f, std::true_type) const{
+        const size_t block=MtmKernels::REDUCE_BLOCK;
+        size_t n=data.size();
+        size_t blocks=(n+block-1)/block;
+        if (blocks<2){
+            reduce(f,std::false_type());
+            return;
+        }
+        vector<Func> parts;
+        try {
+            parts.resize(blocks);
+        }
+        catch (std::bad_alloc& e) {throw MtmExceptions::OutOfMemory();}
+        threadPool().parallelFor(0,blocks,[&](size_t b){
+            Func& g=parts[b];
+            size_t end=std::min(n,(b+1)*block);
+            for (size_t i=b*block;i<end;i++){
+                g(data[i]);
+            }
+        });
+        for (size_t b=0;b<blocks;b++){
+            f.merge(parts[b]);
+        }
     }
 
     template <typename T>
     void MtmVec<T>::transpose(){
+        MTM_STATS_OP(TRANSPOSE);
         is_col_vec=!is_col_vec;
         dim.transpose();
     }
@@ -318,19 +530,27 @@ namespace MtmMath {
 
     template <typename T>
     bool MtmVec<T>::isCellLocked(int pos) const{
-    return !lock[(size_t)pos];
+    return !lock.empty() && lock[(size_t)pos];
     }
 
     /*
      * Functions for marking a cell in the vector as locked. the pos
      * represents the index in the vector that will be locked, i.e will throw
      * exception when trying to writing to the element stored in this index.
+     * The lock map is only allocated once the first cell is locked, so
+     * vectors that never lock a cell don't pay for it.
      */
     template <typename T>
     void MtmVec<T>::lockCell(int pos){
         size_t pos_unsigned=(size_t)pos;
         assert(pos>=0 && pos_unsigned<data.size());
-        lock[pos_unsigned]=false;
+        if (lock.empty()){
+            try {
+                lock.assign(data.size(),false);
+            }
+            catch (std::bad_alloc& e) {throw MtmExceptions::OutOfMemory();}
+        }
+        lock[pos_unsigned]=true;
     }
 
     /*
@@ -342,7 +562,23 @@ namespace MtmMath {
     void MtmVec<T>::unlockCell(int pos){
         size_t pos_unsigned=(size_t)pos;
         assert(pos>=0 && pos_unsigned<data.size());
-        lock[pos_unsigned]=true;
+        if (!lock.empty()){
+            lock[pos_unsigned]=false;
+        }
+    }
+
+    /*
+     * Element access used by expression nodes, a vector is addressed as a
+     * single row or a single column.
+     */
+    template <typename T>
+    const T& exprAt(const MtmVec<T>& vec, size_t row, size_t col){
+        return vec.data[row+col];
+    }
+
+    template <typename T>
+    const T* exprData(const MtmVec<T>& vec){
+        return vec.dataPtr();
     }
 
                         ////////Iterators////////
@@ -389,15 +625,19 @@ namespace MtmMath {
 
     template <typename T>
     void MtmVec<T>::nonzero_iterator::operator++() {
-        this->i++;
-        for (int i=this->i; i<this->vec->size();i++) {
-            if ((*this->vec)[i] == T()) {
-                this->i++;
-            }
-            else {
-                return;
-            }
+        const MtmVec<T>& v=*this->vec;
+        size_t n=v.data.size();
+        size_t pos=std::min((size_t)this->i+1,n);
+        //every cell passed is read through operator[], so reaching a locked
+        //one throws AccessIllegalElement
+        size_t locked=v.lock.empty() ? n :
+                      std::find(v.lock.begin()+pos,v.lock.end(),true)-
+                      v.lock.begin();
+        pos+=MtmKernels::findNonzero(v.data.data()+pos,locked-pos);
+        if (pos==locked&&locked<n){
+            throw MtmExceptions::AccessIllegalElement();
         }
+        this->i=(int)pos;
     }
 
 
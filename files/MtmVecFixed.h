@@ -0,0 +1,94 @@
+#ifndef EX3_MTMVECFIXED_H
+#define EX3_MTMVECFIXED_H
+
+#include "MtmExceptions.h"
+#include "MtmVec.h"
+#include "MtmMatFixed.h"
+
+using std::size_t;
+
+namespace MtmMath {
+    /*
+     * Column vector of N elements whose size is part of its type, a N x 1
+     * MtmMatFixed: the arithmetic, the iterators and the products with
+     * fixed size matrices are the matrix ones, with vectors as results.
+     * v[i] is element i.
+     */
+    template <typename T, size_t N>
+    class MtmVecFixed : public MtmMatFixed<T, N, 1> {
+    public:
+        typedef MtmMatFixed<T, N, 1> Base;
+        constexpr MtmVecFixed() : Base() {}
+        explicit constexpr MtmVecFixed(const T& val) : Base(val) {}
+        /*
+         * The N elements.
+         */
+        template <typename... U, typename = typename std::enable_if<
+                  sizeof...(U) == N && (N > 1)>::type>
+        constexpr MtmVecFixed(const U&... values) : Base(values...) {}
+        constexpr MtmVecFixed(const Base& mat) : Base(mat) {}
+        /*
+         * Copy of a MtmVec of N elements, row or column, MtmExceptions::
+         * DimensionMismatch is thrown otherwise.
+         */
+        explicit MtmVecFixed(const MtmVec<T>& vec);
+        /*
+         * Column MtmVec with the same elements.
+         */
+        explicit operator MtmVec<T>() const;
+
+        T& operator[](size_t pos) & { return this->elems[pos]; }
+        constexpr const T& operator[](size_t pos) const & {
+            return this->elems[pos];
+        }
+        constexpr int size() const { return (int)N; }
+        constexpr const Base& base() const { return *this; }
+
+        friend constexpr MtmVecFixed operator+(const MtmVecFixed& a,
+                                               const MtmVecFixed& b) {
+            return a.base() + b.base();
+        }
+        friend constexpr MtmVecFixed operator-(const MtmVecFixed& a,
+                                               const MtmVecFixed& b) {
+            return a.base() - b.base();
+        }
+        friend constexpr MtmVecFixed operator-(const MtmVecFixed& a) {
+            return -a.base();
+        }
+        friend constexpr MtmVecFixed operator*(const MtmVecFixed& a,
+                                               const T& val) {
+            return a.base()*val;
+        }
+        friend constexpr MtmVecFixed operator*(const T& val,
+                                               const MtmVecFixed& a) {
+            return val*a.base();
+        }
+    };
+
+    /*
+     * Matrix times column vector.
+     */
+    template <typename T, size_t R, size_t C>
+    constexpr MtmVecFixed<T, R> operator*(const MtmMatFixed<T, R, C>& mat,
+                                          const MtmVecFixed<T, C>& vec) {
+        return mat*vec.base();
+    }
+
+    template <typename T, size_t N>
+    MtmVecFixed<T, N>::MtmVecFixed(const MtmVec<T>& vec) : Base() {
+        if ((size_t)vec.size() != N) {
+            throw MtmExceptions::DimensionMismatch(Dimensions(N, 1),
+                                                   vec.getDim());
+        }
+        std::copy(vec.dataPtr(), vec.dataPtr() + N, this->elems);
+    }
+
+    template <typename T, size_t N>
+    MtmVecFixed<T, N>::operator MtmVec<T>() const {
+        MtmVec<T> vec(N);
+        std::copy(this->elems, this->elems + N, vec.dataPtr());
+        return vec;
+    }
+}
+
+#endif //EX3_MTMVECFIXED_H
@@ -4,9 +4,22 @@
 #include "MtmMat.h"
 #include "MtmMatSq.h"
 #include "MtmMatTriag.h"
+#include "MtmMatSparse.h"
+#include "MtmMatFixed.h"
+#include "MtmVecFixed.h"
+#include "MtmMatFile.h"
+#include "MtmText.h"
+#include "MtmMatTiled.h"
+#include "MtmLU.h"
+#include <sstream>
+#include <fstream>
 #include "Complex.h"
+#include "MtmStats.h"
 
 #include <assert.h>
+#include <cstdio>
+#include <cmath>
+#include <thread>
 using namespace MtmMath;
 using std::cout;
 using std::endl;
@@ -60,6 +73,47 @@ void constructors() {
     MtmMat<int> m1(Dimensions(3,3),0);
     MtmMatSq<int> m2(3,1);
     MtmMatTriag<int> m3(3,1,true);
+    const MtmMatTriag<int>& m3_c=m3; //locked cells are read through const
+    assert(m3_c[2][0]==0 and m3_c[0][2]==1); //only the upper half is stored
+    MtmMat<int> p=m3*m3;
+    assert(p[0][2]==3 and p[2][0]==0);
+    m3.transpose();
+    assert(m3_c[2][0]==1 and m3_c[0][2]==0);
+    MtmMat<int> r(Dimensions(2,3),0);
+    r[0][2]=4;
+    r.transpose();
+    assert(r.getDim()==Dimensions(3,2) and r[2][0]==4 and r[0][1]==0);
+    MtmVec<int> grow(3,1); //short vectors are stored inline
+    grow.resize(Dimensions(12,1),2);
+    assert(grow[2]==1 and grow[11]==2);
+}
+
+/*
+ * Products of small whole numbers are exact, so the micro kernels of every
+ * instruction set must agree with the portable one.
+ */
+template <typename T>
+void productKernels(const T& unit) {
+    MtmMat<T> a(Dimensions(70,50),T()), b(Dimensions(50,90),T());
+    for (int i=0;i<70;i++){
+        for (int j=0;j<50;j++){
+            a[i][j]=T((i*3+j)%7-3)*unit;
+        }
+    }
+    for (int i=0;i<50;i++){
+        for (int j=0;j<90;j++){
+            b[i][j]=T((i+j*5)%9-4)*unit;
+        }
+    }
+    MtmKernels::setSimdLevel(MtmKernels::SIMD_SCALAR);
+    MtmMat<T> ref=a*b;
+    MtmKernels::setSimdLevel(MtmKernels::SIMD_AVX512); //the CPU's best
+    MtmMat<T> res=a*b;
+    for (int i=0;i<70;i++){
+        for (int j=0;j<90;j++){
+            assert(res[i][j]==ref[i][j]);
+        }
+    }
 }
 
 void dataTypes() {
@@ -67,6 +121,18 @@ void dataTypes() {
     MtmVec<double > v2(5,3);
     MtmVec<float> v3(5,3);
     MtmVec<Complex> v4(5,Complex(3,4));
+    constexpr Complex i_unit(0,1);
+    static_assert(i_unit*i_unit==Complex(-1),"Complex arithmetic is constexpr");
+    MtmMat<Complex> c(Dimensions(40,40),Complex(1,1));
+    MtmMat<Complex> c2=c*c; //packed, real and imaginary parts split
+    assert(c2[39][0]==Complex(0,80));
+    v4-=v4;
+    assert(v4[4]==Complex());
+    MtmMat<Complex> neg=-c2;    //the double kernels over 2n elements
+    assert(neg[39][0]==Complex(0,-80));
+    productKernels(1.0);
+    productKernels(1.0f);
+    productKernels(Complex(1,2));
 }
 
 void FuncExample() {
@@ -91,6 +157,42 @@ void FuncExample() {
     assert (v.vecFunc(f)==7);
     MtmVec<int> res(m.matFunc(f));
     assert(res[0]==2 and res[1]==3 and res[2]==6);
+    MtmMatTriag<int> t(3,-4,false);
+    MtmVec<int> res_t(t.matFunc(f)); //the zero half is reduced as zeros
+    assert(res_t[0]==4 and res_t[2]==4);
+
+    class sum {
+        int total;
+    public:
+        sum() : total(0) {}
+        void operator()(int x) { total+=x; }
+        int operator*() { return total; }
+        void merge(const sum& other) { total+=other.total; } //parallel parts
+    };
+    MtmVec<int> ones(200000,1);
+    sum s;
+    assert(ones.vecFunc(s)==200000);
+
+    class countCalls {      //shares one counter and has no merge
+    public:
+        static size_t& calls() { static size_t n=0; return n; }
+        static std::thread::id& caller() {
+            static std::thread::id id;
+            return id;
+        }
+        void operator()(int) {
+            if (std::this_thread::get_id()==caller()) calls()++;
+        }
+        int operator*() { return 0; }
+    };
+    size_t threads=getNumThreads();
+    setNumThreads(4);       //still reduced on this thread only, no race
+    MtmMat<int> wide(Dimensions(300,400),1);
+    countCalls c;
+    countCalls::caller()=std::this_thread::get_id();
+    wide.matFunc(c);
+    assert(countCalls::calls()==300*400);
+    setNumThreads(threads);
 }
 
 void iterators() {
@@ -112,9 +214,396 @@ void iterators() {
         ++i;
     }
 
+    MtmMatTriag<int> t(3,1,false); //the zero upper half isn't scanned
+    t[2][1]=0;
+    int res_t_rows[]={0,1,2,1,2};
+    i=0;
+    for (MtmMatTriag<int>::nonzero_iterator it=t.nzbegin();it!=t.nzend();++it){
+        assert (res_t_rows[i]==it.getRow() and it.getCol()<=it.getRow());
+        ++i;
+    }
+    assert(i==5);
+
+    MtmVec<int> v(6,0);
+    v[4]=7;
+    MtmVec<int>::nonzero_iterator vit=v.nzbegin();
+    assert(*vit==7);
+    ++vit;
+    assert(!(vit!=v.nzend()));
+    v.lockCell(5);
+    vit=v.nzbegin();
+    try {
+        ++vit;              //passing a locked cell reads it
+        assert(false);
+    }
+    catch (MtmExceptions::AccessIllegalElement&) {}
+
+    MtmMat<int> wide(Dimensions(2,600),0);
+    wide[1][0]=1;
+    MtmMat<int>::nonzero_iterator wit=wide.nzbegin();
+    wide[0][500]=2;         //ahead of the iterator, so it is visited
+    ++wit;
+    assert(*wit==2 and wit.getCol()==500);
 }
 
+void expressions() {
+    MtmMat<int> a(Dimensions(2,2),1);
+    MtmMat<int> b(Dimensions(2,2),2);
+    MtmVec<int> v(2,3);
+    MtmMat<int> c=a+b-2*a;  //evaluated in one pass, no temporaries
+    assert(c[0][0]==1 and c[1][1]==1);
+    c=c*3-(-a);             //in place
+    assert(c[1][0]==4);
+    MtmVec<int> w=v+v*2;
+    assert(w[1]==9);
+    MtmVec<int> u(1,1);
+    u.transpose();          //1x1 either way, but still a row
+    MtmVec<int> u2=u+u;
+    u+=u2;
+    assert(!u2.isColVector() and u[0]==3);
+    try {
+        w=MtmVec<int>(1,1)+u;
+        assert(false);
+    }
+    catch (MtmExceptions::DimensionMismatch&) {}
+    MtmMat<int> p=(a+b)*a;  //matrix products are computed right away
+    assert(p[0][1]==6);
+    MtmMat<int> q=a*b+a;    //reuses the buffer of the product
+    assert(q[0][0]==5);
+    MtmMat<int> r=std::move(q);
+    assert(r[1][1]==5 and r.getDim()==Dimensions(2,2));
+    MtmMat<int> x(Dimensions(2,3),1);
+    x[1][2]=3;
+    MtmMat<int> xt=x;
+    xt.transpose();         //a view of x's rows, nothing is moved
+    MtmMat<int> g=xt*x;     //multiplied from the stored rows
+    assert(xt[2][1]==3 and g[2][2]==10 and g[0][2]==4);
+}
+
+void sparse() {
+    MtmMat<int> m(Dimensions(3,4),0);
+    m[0][1]=2; m[2][3]=5;
+    MtmMatSparse<int> s(m);  //only the two nonzeros are stored
+    assert(s.nonZeros()==2 and s.at(2,3)==5 and s.at(1,1)==0);
+    MtmVec<int> v(4,1);
+    MtmVec<int> sv=s*v;
+    assert(sv[0]==2 and sv[1]==0 and sv[2]==5);
+    MtmMat<int> d(Dimensions(4,2),1);
+    MtmMat<int> sd=s*d;
+    assert(sd[2][1]==5);
+    MtmMatSparse<int> st=s;
+    st.transpose();
+    MtmMatSparse<int> ss=s*st;
+    assert(ss.nonZeros()==2 and ss.at(0,0)==4 and ss.at(2,2)==25);
+}
+
+void fixedSize() {
+    constexpr MtmMatFixed<int,2,2> rot(0,-1,1,0);
+    constexpr MtmVecFixed<int,2> v(3,4);
+    static_assert((rot*v)[0]==-4 and (rot*rot)(1,1)==-1,"constexpr");
+    MtmVecFixed<int,2> w=rot*v+v;
+    assert(w[0]==-1 and w[1]==7);
+    MtmMat<int> m(rot);      //to and from the dynamic classes
+    m+=m;
+    MtmMatFixed<int,2,2> back(m);
+    assert(back==2*rot);
+    int i=0;
+    for (MtmMatFixed<int,2,2>::nonzero_iterator it=back.nzbegin();
+         it!=back.nzend();++it) {
+        ++i;
+    }
+    assert(i==2);
+}
+
+void unchecked() {
+    const MtmMatTriag<int> t(3,2,true);
+    assert(t.atUnchecked(2,0)==0); //no range or lock checks
+    MtmMat<int> m(Dimensions(2,3),0);
+    m.atUnchecked(1,2)=5;
+    int* row=m.rowPtr(1);
+    row[0]=4;
+    assert(m[1][0]==4 and m[1][2]==5);
+    MtmVec<int> v(3,1);
+    v.lockCell(0);
+    v.atUnchecked(0)=2; //locks are ignored
+    assert(v.dataPtr()[0]==2);
+    m.reshape(Dimensions(3,2));
+    assert(m[1][0]==4 and m[1][1]==0 and m[2][1]==5); //column major order
+    m=MtmMatTriag<int>(40,1,true);  //m keeps the packed triangle
+    try {
+        m.reshape(Dimensions(20,80)); //its zero half is locked
+        assert(false);
+    }
+    catch (MtmExceptions::AccessIllegalElement&) {}
+}
+
+void arena() {
+    MtmMat<int> kept(Dimensions(2,2),0);
+    MtmVec<int> moved(1,0);
+    {
+        ScopedArena arena;  //the temporaries below don't touch the heap
+        MtmMat<int> a(Dimensions(2,2),1);
+        kept=a*a+a;
+        MtmVec<int> v(3,2);
+        moved=std::move(v); //may outlive the scope
+    }
+    assert(kept[1][1]==3 and moved[2]==2);
+}
+
+void statistics() {
+    MtmStats::reset();
+    MtmMat<int> a(Dimensions(8,8),1);
+    MtmMat<int> p=a*a;
+    p+=a;
+    try {
+        p.reshape(Dimensions(3,3));
+    }
+    catch (MtmExceptions::ChangeMatFail&) {}
+    MtmStats::Snapshot s=MtmStats::snapshot();
+#ifdef MTM_STATS
+    assert(s.ops[MtmStats::MULTIPLY].calls==1);
+    assert(s.ops[MtmStats::ADD_ASSIGN].calls==1);
+    assert(s.ops[MtmStats::CONSTRUCT].bytes_allocated>=64*sizeof(int));
+    assert(s.exceptions[MtmStats::CHANGE_MAT_FAIL]==1);
+#else
+    assert(s.ops[MtmStats::MULTIPLY].calls==0); //compiled out
+#endif
+}
+
+void matrixFile() {
+    MtmMat<double> m(Dimensions(2,3),1.5);
+    m[1][2]=4;
+    m.transpose();            //saved as the view it is
+    MtmFile::save(m,"mtm_test.mtm");
+    MtmFile::Mapped<MtmMat<double> > view=
+            MtmFile::load<MtmMat<double> >("mtm_test.mtm");
+    assert(view->getRow()==3 and (*view)[2][1]==4 and (*view)[0][0]==1.5);
+    MtmMat<double> copy(*view);
+    copy[2][1]=5;             //the file isn't written
+    assert((*view)[2][1]==4);
+    MtmFile::save(copy,"mtm_test.mtm"); //over the file view maps
+    assert((*view)[2][1]==4 and
+           (*MtmFile::load<MtmMat<double> >("mtm_test.mtm"))[2][1]==5);
+    MtmMatTriag<int> t(3,2,false);
+    MtmFile::save(t,"mtm_test.mtm");
+    auto tv=MtmFile::load<MtmMatTriag<int> >("mtm_test.mtm");
+    assert((*tv)[2][0]==2 and (*tv)[0][2]==0 and (*tv)[0].isCellLocked(2));
+    try {
+        MtmFile::load<MtmMatTriag<double> >("mtm_test.mtm");
+        assert(false);
+    }
+    catch (MtmExceptions::FileError&) {} //saved with int elements
+    std::remove("mtm_test.mtm");
+}
 
+void textIO() {
+    std::istringstream csv("1, 2.5,3\n\n-4e2,0.1,7\r\n");
+    MtmMat<double> m=MtmText::readMat<double>(csv,MtmText::CSV);
+    assert(m.getRow()==2 and m[0][1]==2.5 and m[1][0]==-400 and m[1][1]==0.1);
+    std::ostringstream out;
+    MtmText::write(m,out);
+    assert(out.str()=="1 2.5 3\n-400 0.1 7\n");
+    std::istringstream cin_("1+2i -3.5-1e-3i 2i\n");
+    MtmVec<Complex> v=MtmText::readVec<Complex>(cin_);
+    assert(v.getRow()==1 and v[1]==Complex(-3.5,-0.001));
+    assert(v[2]==Complex(0,2));
+    std::istringstream ragged("1 2\n3\n");
+    try {
+        MtmText::readMat<int>(ragged);
+        assert(false);
+    }
+    catch (MtmExceptions::FileError&) {}
+}
+
+void tiled() {
+    MtmMat<int> m(Dimensions(5,3),0);
+    m[4][2]=3;
+    m[0][1]=2;
+    MtmMatTiled<int> a("mtm_a.tiles",m,2);  //tiles of 2x2, the last ones
+    MtmMatTiled<int> b("mtm_b.tiles",Dimensions(3,4),2,1); //cut short
+    MtmMatTiled<int> c("mtm_c.tiles",Dimensions(5,4),2);
+    try {
+        multiply(a,b,c,6*4*sizeof(int));    //less than seven tiles
+        assert(false);
+    }
+    catch (MtmExceptions::OutOfMemory&) {}
+    multiply(a,b,c,8*4*sizeof(int));        //no budget to keep a row
+    MtmMat<int> p=c.toMat();
+    assert(p[4][3]==3 and p[0][0]==2 and p[2][2]==0);
+    MtmMatTiled<int> d("mtm_d.tiles",Dimensions(5,4),2);
+    multiply(a,b,d);                        //keeps rows, read ahead
+    assert(d.toMat()[4][3]==3 and d.toMat()[0][0]==2);
+    add(c,c,c);
+    assert(MtmMatTiled<int>::open("mtm_c.tiles").readTile(2,1)[0][1]==6);
+    MtmMatTiled<int> e("mtm_e.tiles",Dimensions(4,4),2,1);
+    MtmMatTiled<int> e_again=MtmMatTiled<int>::open("mtm_e.tiles");
+    try {
+        multiply(e,e,e_again);              //would read what it writes
+        assert(false);
+    }
+    catch (MtmExceptions::FileError&) {}
+    {
+        std::fstream header("mtm_e.tiles",std::ios::in|std::ios::out|
+                                          std::ios::binary);
+        uint64_t rows=(uint64_t)1<<62, cols=4, tile=1;
+        header.seekp(24);                   //rows, cols and tile size
+        header.write((const char*)&rows,8).write((const char*)&cols,8)
+              .write((const char*)&tile,8);
+    }
+    try {
+        MtmMatTiled<int>::open("mtm_e.tiles"); //offsets overflow to 0
+        assert(false);
+    }
+    catch (MtmExceptions::FileError&) {}
+    std::remove("mtm_a.tiles");
+    std::remove("mtm_b.tiles");
+    std::remove("mtm_c.tiles");
+    std::remove("mtm_d.tiles");
+    std::remove("mtm_e.tiles");
+}
+
+void linearAlgebra() {
+    MtmMatSq<double> a(3,0);
+    a[0][1]=2; a[0][2]=1;                   //a zero first pivot
+    a[1][0]=1; a[1][1]=1;
+    a[2][0]=3; a[2][2]=2;
+    MtmLU<double> lu(a);
+    assert(std::fabs(lu.det()+7)<1e-12 and !lu.isSingular());
+    MtmVec<double> b(3);
+    b[0]=3; b[1]=2; b[2]=5;
+    b.transpose();
+    MtmVec<double> x=lu.solve(b);           //shaped like b
+    assert(!x.isColVector() and std::fabs(x[0]-1)<1e-12 and
+           std::fabs(x[1]-1)<1e-12 and std::fabs(x[2]-1)<1e-12);
+    MtmMat<double> id=multiply(a,inverse(a));
+    assert(std::fabs(id[2][2]-1)<1e-12 and std::fabs(id[0][2])<1e-12);
+    MtmMatSq<Complex> c(1,Complex(0,2));
+    assert(det(c)==Complex(0,2) and solve(c,MtmVec<Complex>(1,2))[0]==
+           Complex(0,-1));
+    a[2][0]=2; a[2][1]=2; a[2][2]=0;        //twice row 1
+    assert(det(a)==0);
+    try {
+        solve(a,MtmMat<double>(Dimensions(3,2),1));
+        assert(false);
+    }
+    catch (MtmExceptions::SingularMatrix& e) {}
+
+    //several LU_BLOCKs, pivoting on every row; with 4 threads the trailing
+    //updates and the block solves of the inverse pass GEMM_PARALLEL_THRESHOLD
+    const size_t n=256;
+    size_t threads=getNumThreads();
+    setNumThreads(4);
+    MtmMatSq<double> big(n);
+    MtmMat<double> rhs(Dimensions(n,70));   //solved block by block too
+    for (size_t i=0;i<n;i++){
+        for (size_t j=0;j<n;j++){
+            big[i][j]=(double)((i*7+j*13)%17)-8+(i+j==n-1 ? 40 : 0);
+        }
+        for (size_t j=0;j<70;j++){
+            rhs[i][j]=(double)((i+2*j)%5);
+        }
+    }
+    MtmLU<double> big_lu(big);
+    MtmMat<double> res=multiply(big,big_lu.solve(rhs));
+    MtmMat<double> prod=multiply(big,big_lu.inverse());
+    for (size_t i=0;i<n;i++){
+        for (size_t j=0;j<70;j++){
+            assert(std::fabs(res[i][j]-rhs[i][j])<1e-9);
+        }
+        for (size_t j=0;j<n;j++){
+            assert(std::fabs(prod[i][j]-(i==j ? 1 : 0))<1e-9);
+        }
+    }
+    setNumThreads(threads);
+}
+
+/*
+ * The parallel paths run only with more than one thread, which a one core
+ * machine doesn't get by default.
+ */
+void threads() {
+    size_t threads=getNumThreads();
+    MtmMat<double> a(Dimensions(200,200),0), b(Dimensions(200,200),0);
+    for (size_t i=0;i<200;i++){
+        for (size_t j=0;j<200;j++){
+            a[i][j]=(double)((i*7+j*3)%11)-5;
+            b[i][j]=(double)((i+j*5)%13)-6;
+        }
+    }
+    setNumThreads(1);
+    MtmMat<double> serial=a*b;
+    setNumThreads(4);       //over GEMM_PARALLEL_THRESHOLD, split in tiles
+    assert(getNumThreads()==4);
+    MtmMat<double> parallel=a*b;
+    for (size_t i=0;i<200;i++){
+        for (size_t j=0;j<200;j++){
+            assert(parallel[i][j]==serial[i][j]);
+        }
+    }
+    try {
+        threadPool().parallelFor(0,64,[](size_t i){
+            if (i==37) throw MtmExceptions::OutOfMemory();
+        });
+        assert(false);
+    }
+    catch (MtmExceptions::OutOfMemory&) {} //rethrown on the caller
+
+    MtmMat<int> half(Dimensions(400,400),0);
+    for (size_t i=0;i<400;i++){
+        for (size_t j=(i%2);j<400;j+=2){
+            half[i][j]=(int)((i*j)%7)-3;
+        }
+    }
+    MtmMatSparse<int> sp(half); //80000 nonzeros, split in ranges of rows
+    MtmMat<int> dense_prod=half*half;
+    MtmMatSparse<int> sp_prod=sp*sp;
+    MtmMat<int> mixed=sp*half;
+    MtmVec<int> ones(400,1);
+    MtmVec<int> row_sums=sp*ones;
+    for (size_t i=0;i<400;i++){
+        int sum=0;
+        for (size_t j=0;j<400;j++){
+            assert(sp_prod.at(i,j)==dense_prod[i][j]);
+            assert(mixed[i][j]==dense_prod[i][j]);
+            sum+=half[i][j];
+        }
+        assert(row_sums[i]==sum);
+    }
+
+    class sum {
+        int total;
+    public:
+        sum() : total(0) {}
+        void operator()(int x) { total+=x; }
+        int operator*() { return total; }
+        void merge(const sum& other) { total+=other.total; }
+    };
+    MtmMat<int> tall(Dimensions(40000,4),1); //blocks of rows, merged
+    tall[39999][3]=5;
+    sum f;
+    MtmVec<int> col_sums=tall.matFunc(f);
+    assert(col_sums[0]==40000 and col_sums[3]==40004);
+
+    std::ostringstream text;    //over 1 MiB, parsed in one part per thread
+    for (int i=0;i<900;i++){
+        for (int j=0;j<400;j++){
+            text<<(i*31+j)%200-100<<(j==399 ? "\n" : " ");
+        }
+    }
+    std::istringstream text_in(text.str());
+    MtmMat<int> parsed=MtmText::readMat<int>(text_in);
+    assert(parsed.getRow()==900 and parsed.getCol()==400);
+    assert(parsed[0][1]==-99 and parsed[899][399]==(899*31+399)%200-100);
+    std::istringstream bad_in(text.str()+"1 x\n");
+    try {
+        MtmText::readMat<int>(bad_in);
+        assert(false);
+    }
+    catch (MtmExceptions::FileError& e) { //counted over all the parts
+        assert(std::string(e.what()).find("line 901:")!=std::string::npos);
+    }
+    setNumThreads(threads);
+}
 
 int main() {
     exceptionsTest();
@@ -122,5 +611,16 @@ int main() {
     dataTypes();
     FuncExample();
     iterators();
+    expressions();
+    sparse();
+    unchecked();
+    fixedSize();
+    arena();
+    statistics();
+    matrixFile();
+    textIO();
+    tiled();
+    linearAlgebra();
+    threads();
 }
 
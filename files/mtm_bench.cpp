@@ -0,0 +1,475 @@
+/*
+ * mtm_bench- times the MtmMath operations on every element type (int, float,
+ * double, Complex), every class (MtmVec, MtmMat, MtmMatSq, MtmMatTriag) and
+ * sizes from 4 to 8192, and writes the results as JSON.
+ *
+ * usage: mtm_bench [--out file] [--min-size n] [--max-size n]
+ *                  [--max-mul-size n] [--min-time seconds]
+ *                  [--mem-limit MiB] [--filter text]
+ *
+ * Every result holds the number of timed runs, the seconds per run, and
+ * per run the allocations and bytes allocated (counted by replacing the
+ * global operator new). gflops and bytes_per_second are nominal: they count
+ * the element operations and memory traffic of a plain dense implementation
+ * (2n^3 for a product, one pass per operand for element-wise work), so they
+ * compare classes and releases on the same scale. Cases whose operands
+ * would need more than --mem-limit are skipped.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "MtmVec.h"
+#include "MtmMat.h"
+#include "MtmMatSq.h"
+#include "MtmMatTriag.h"
+#include "Complex.h"
+
+using namespace MtmMath;
+using std::string;
+using std::vector;
+
+                        ////////Allocation counting////////
+
+namespace {
+    std::atomic<size_t> allocations(0);
+    std::atomic<size_t> allocated_bytes(0);
+}
+
+void* operator new(size_t size) {
+    allocations++;
+    allocated_bytes+=size;
+    void* p=std::malloc(size ? size : 1);
+    if (p==nullptr) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return ::operator new(size);
+}
+
+//kept out of line, inlined next to operator new GCC takes free for a mismatch
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+                        ////////Settings and results////////
+
+namespace {
+    struct Settings {
+        string out;
+        size_t min_size=4;
+        size_t max_size=8192;
+        size_t max_mul_size=1024; //products grow as n^3
+        double min_time=0.05;
+        size_t mem_limit=2048; //MiB
+        string filter;
+    };
+
+    struct Result {
+        string op, cls, type;
+        size_t size;
+        size_t runs;
+        double seconds; //per run
+        double flops;   //per run
+        double bytes;   //per run
+        double allocs;  //per run
+        double alloc_bytes;
+    };
+
+    Settings settings;
+    vector<Result> results;
+
+    /*
+     * Keeps the compiler from dropping a result it can see is unused.
+     */
+    template <typename X>
+    void keep(const X& x) {
+        __asm__ __volatile__("" : : "g"(&x) : "memory");
+    }
+
+    template <typename T> const char* typeName();
+    template <> const char* typeName<int>() { return "int"; }
+    template <> const char* typeName<float>() { return "float"; }
+    template <> const char* typeName<double>() { return "double"; }
+    template <> const char* typeName<Complex>() { return "Complex"; }
+
+    template <typename T> T value(size_t k) { return T(k%7+1); }
+    template <> Complex value<Complex>(size_t k) {
+        return Complex(k%7+1,k%3);
+    }
+
+    /*
+     * Calls op until min_time has passed (at least once) and records the
+     * time and allocations per call.
+     */
+    template <typename Op>
+    void measure(const string& op_name, const string& cls, const string& type,
+                 size_t n, double flops, double bytes, Op op) {
+        string name=cls+"/"+type+"/"+op_name;
+        if (!settings.filter.empty() &&
+            name.find(settings.filter)==string::npos) {
+            return;
+        }
+        typedef std::chrono::steady_clock Clock;
+        size_t allocs_before=allocations;
+        size_t bytes_before=allocated_bytes;
+        size_t runs=0;
+        Clock::time_point start=Clock::now();
+        double elapsed=0;
+        do {
+            op();
+            runs++;
+            elapsed=std::chrono::duration<double>(Clock::now()-start).count();
+        } while (elapsed<settings.min_time);
+        Result r;
+        r.op=op_name;
+        r.cls=cls;
+        r.type=type;
+        r.size=n;
+        r.runs=runs;
+        r.seconds=elapsed/runs;
+        r.flops=flops;
+        r.bytes=bytes;
+        r.allocs=(double)(allocations-allocs_before)/runs;
+        r.alloc_bytes=(double)(allocated_bytes-bytes_before)/runs;
+        results.push_back(r);
+        std::cerr<<name<<" n="<<n<<": "<<r.seconds*1e3<<" ms"<<std::endl;
+    }
+
+                        ////////Classes////////
+
+    /*
+     * How every class is built and which operations it supports. Result is
+     * what element-wise arithmetic on it is assigned to. A triangle has no
+     * plain iteration: writable iterators throw on its locked half. Only a
+     * packed triangle moves its elements on transpose; the other classes
+     * flip a flag, so their transpose reports no memory traffic.
+     */
+    template <typename T>
+    struct VecKind {
+        typedef MtmVec<T> Type;
+        typedef MtmVec<T> Result;
+        static const char* name() { return "MtmVec"; }
+        static size_t elements(size_t n) { return n; }
+        static Type make(size_t n, const T& val) { return Type(n,val); }
+        static Dimensions resized(size_t n) { return Dimensions(n,1); }
+        static const bool iterable=true;
+        static const bool view_transpose=true;
+    };
+
+    template <typename T>
+    struct MatKind {
+        typedef MtmMat<T> Type;
+        typedef MtmMat<T> Result;
+        static const char* name() { return "MtmMat"; }
+        static size_t elements(size_t n) { return n*n; }
+        static Type make(size_t n, const T& val) {
+            return Type(Dimensions(n,n),val);
+        }
+        static Dimensions resized(size_t n) { return Dimensions(n,n); }
+        static const bool iterable=true;
+        static const bool view_transpose=true;
+    };
+
+    template <typename T>
+    struct SqKind {
+        typedef MtmMatSq<T> Type;
+        typedef MtmMat<T> Result;
+        static const char* name() { return "MtmMatSq"; }
+        static size_t elements(size_t n) { return n*n; }
+        static Type make(size_t n, const T& val) { return Type(n,val); }
+        static Dimensions resized(size_t n) { return Dimensions(n,n); }
+        static const bool iterable=true;
+        static const bool view_transpose=true;
+    };
+
+    template <typename T>
+    struct TriagKind {
+        typedef MtmMatTriag<T> Type;
+        typedef MtmMat<T> Result;
+        static const char* name() { return "MtmMatTriag"; }
+        static size_t elements(size_t n) { return n*n; }
+        static Type make(size_t n, const T& val) {
+            return Type(n,val,true);
+        }
+        static Dimensions resized(size_t n) { return Dimensions(n,n); }
+        static const bool iterable=false;
+        static const bool view_transpose=false;
+    };
+
+    template <typename T>
+    class Sum {
+        T total;
+    public:
+        Sum() : total() {}
+        void operator()(const T& x) { total+=x; }
+        T operator*() { return total; }
+    };
+
+    /*
+     * Writes element number cell, counting row by row.
+     */
+    template <typename T>
+    void writeCell(MtmVec<T>& v, size_t cell, const T& val) {
+        v[(int)cell]=val;
+    }
+
+    template <typename T>
+    void writeCell(MtmMat<T>& m, size_t cell, const T& val) {
+        m[(int)(cell/m.getCol())][(int)(cell%m.getCol())]=val;
+    }
+
+    /*
+     * Operations every class has.
+     */
+    template <typename K, typename T>
+    void commonOps(size_t n) {
+        typedef typename K::Type M;
+        typedef typename K::Result R;
+        string cls=K::name(), type=typeName<T>();
+        double count=(double)K::elements(n);
+        double s=sizeof(T);
+        M a=K::make(n,value<T>(1));
+        M b=K::make(n,value<T>(2));
+        measure("construct",cls,type,n,0,count*s,[&](){
+            M x=K::make(n,value<T>(3));
+            keep(x);
+        });
+        measure("copy",cls,type,n,0,2*count*s,[&](){
+            M x(a);
+            keep(x);
+        });
+        measure("add",cls,type,n,count,3*count*s,[&](){
+            R c=a+b;
+            keep(c);
+        });
+        measure("sub",cls,type,n,count,3*count*s,[&](){
+            R c=a-b;
+            keep(c);
+        });
+        measure("scalar_mul",cls,type,n,count,2*count*s,[&](){
+            R c=a*value<T>(3);
+            keep(c);
+        });
+        measure("scalar_add",cls,type,n,count,2*count*s,[&](){
+            R c=a+value<T>(3);
+            keep(c);
+        });
+        measure("scalar_sub",cls,type,n,count,2*count*s,[&](){
+            R c=a-value<T>(3);
+            keep(c);
+        });
+        measure("negate",cls,type,n,count,2*count*s,[&](){
+            R c=-a;
+            keep(c);
+        });
+        //a scratch copy, so a keeps its orientation for the later cases
+        M t(a);
+        measure("transpose",cls,type,n,0,
+                K::view_transpose ? 0 : 2*count*s,[&](){
+            t.transpose();
+            keep(t);
+        });
+        measure("resize",cls,type,n,0,2*count*s,[&](){
+            //two resizes per run: to n+1 and back
+            b.resize(K::resized(n+1),value<T>(4));
+            b.resize(K::resized(n),value<T>(4));
+            keep(b);
+        });
+        if (K::iterable){
+            measure("iterate",cls,type,n,0,count*s,[&](){
+                T total=T();
+                for (typename M::iterator it=a.begin();it!=a.end();++it){
+                    total+=*it;
+                }
+                keep(total);
+            });
+        }
+        M sparse=K::make(n,T());
+        size_t cells=K::elements(n);
+        for (size_t k=0;k<cells/100+1;k++){ //about 1% nonzero
+            size_t cell=k*7919%cells;
+            try {
+                writeCell(sparse,cell,value<T>(k));
+            }
+            catch (MtmExceptions::AccessIllegalElement&) {} //locked half
+        }
+        measure("nonzero_iterate",cls,type,n,0,count*s,[&](){
+            T total=T();
+            for (typename M::nonzero_iterator it=sparse.nzbegin();
+                 it!=sparse.nzend();++it){
+                total+=*it;
+            }
+            keep(total);
+        });
+    }
+
+    /*
+     * Operations of matrices only.
+     */
+    template <typename K, typename T>
+    void matrixOps(size_t n) {
+        typedef typename K::Type M;
+        string cls=K::name(), type=typeName<T>();
+        double count=(double)K::elements(n);
+        double s=sizeof(T);
+        M a=K::make(n,value<T>(1));
+        M b=K::make(n,value<T>(2));
+        if (n<=settings.max_mul_size){
+            measure("mul",cls,type,n,2.0*n*n*n,3*count*s,[&](){
+                MtmMat<T> c=a*b;
+                keep(c);
+            });
+        }
+        measure("matFunc",cls,type,n,count,count*s,[&](){
+            Sum<T> f;
+            MtmVec<T> res=a.matFunc(f);
+            keep(res);
+        });
+    }
+
+    template <typename T>
+    void vectorOps(size_t n) {
+        string type=typeName<T>();
+        MtmVec<T> a(n,value<T>(1));
+        measure("vecFunc","MtmVec",type,n,n,n*sizeof(T),[&](){
+            Sum<T> f;
+            T res=a.vecFunc(f);
+            keep(res);
+        });
+    }
+
+    template <typename T>
+    void reshapeOp(size_t n) {
+        string type=typeName<T>();
+        MtmMat<T> a(Dimensions(n,n),value<T>(1));
+        double count=(double)n*n;
+        measure("reshape","MtmMat",type,n,0,2*count*sizeof(T),[&](){
+            //two reshapes per run: to n/2 x 2n and back
+            a.reshape(Dimensions(n/2,2*n));
+            a.reshape(Dimensions(n,n));
+            keep(a);
+        });
+    }
+
+    /*
+     * Largest number of elements any case of a size keeps alive at once:
+     * two operands, the sparse operand and a result or copy.
+     */
+    bool fits(size_t elements, size_t element_size) {
+        double bytes=4.0*elements*element_size;
+        return bytes<=settings.mem_limit*1024.0*1024.0;
+    }
+
+    const size_t sizes[]={4,16,64,256,1024,4096,8192};
+
+    template <typename T>
+    void benchType() {
+        for (size_t n : sizes){
+            if (n<settings.min_size||n>settings.max_size) continue;
+            commonOps<VecKind<T>,T>(n);
+            vectorOps<T>(n);
+            if (!fits(n*n,sizeof(T))){
+                std::cerr<<"skipping "<<typeName<T>()<<" matrices of size "
+                         <<n<<" (over --mem-limit)"<<std::endl;
+                continue;
+            }
+            commonOps<MatKind<T>,T>(n);
+            matrixOps<MatKind<T>,T>(n);
+            reshapeOp<T>(n);
+            commonOps<SqKind<T>,T>(n);
+            matrixOps<SqKind<T>,T>(n);
+            commonOps<TriagKind<T>,T>(n);
+            matrixOps<TriagKind<T>,T>(n);
+        }
+    }
+
+                        ////////Output////////
+
+    const char* simdName() {
+        switch (MtmKernels::simdLevel()) {
+            case MtmKernels::SIMD_AVX512: return "avx512";
+            case MtmKernels::SIMD_AVX2: return "avx2";
+            case MtmKernels::SIMD_SSE2: return "sse2";
+            default: return "scalar";
+        }
+    }
+
+    void writeJson(std::ostream& os) {
+        os<<"{\n  \"benchmark\": \"mtm_bench\",\n"
+          <<"  \"threads\": "<<getNumThreads()<<",\n"
+          <<"  \"simd\": \""<<simdName()<<"\",\n"
+          <<"  \"results\": [";
+        for (size_t i=0;i<results.size();i++){
+            const Result& r=results[i];
+            os<<(i ? ",\n" : "\n")
+              <<"    {\"op\": \""<<r.op<<"\", \"class\": \""<<r.cls
+              <<"\", \"type\": \""<<r.type<<"\", \"size\": "<<r.size
+              <<", \"runs\": "<<r.runs
+              <<", \"seconds\": "<<r.seconds
+              <<", \"gflops\": "<<(r.flops/r.seconds/1e9)
+              <<", \"bytes_per_second\": "<<(r.bytes/r.seconds)
+              <<", \"allocations\": "<<r.allocs
+              <<", \"bytes_allocated\": "<<r.alloc_bytes<<"}";
+        }
+        os<<"\n  ]\n}\n";
+    }
+
+    bool parseArgs(int argc, char** argv) {
+        for (int i=1;i<argc;i++){
+            string arg=argv[i];
+            if (i+1>=argc) return false;
+            string val=argv[++i];
+            if (arg=="--out") settings.out=val;
+            else if (arg=="--min-size") settings.min_size=std::stoul(val);
+            else if (arg=="--max-size") settings.max_size=std::stoul(val);
+            else if (arg=="--max-mul-size") {
+                settings.max_mul_size=std::stoul(val);
+            }
+            else if (arg=="--min-time") settings.min_time=std::stod(val);
+            else if (arg=="--mem-limit") settings.mem_limit=std::stoul(val);
+            else if (arg=="--filter") settings.filter=val;
+            else return false;
+        }
+        return settings.min_size<=settings.max_size;
+    }
+}
+
+int main(int argc, char** argv) {
+    try {
+        if (!parseArgs(argc,argv)) {
+            std::cerr<<"usage: mtm_bench [--out file] [--min-size n] "
+                       "[--max-size n] [--max-mul-size n] [--min-time s] "
+                       "[--mem-limit MiB] [--filter text]"<<std::endl;
+            return 2;
+        }
+    }
+    catch (std::exception& e) {
+        std::cerr<<"mtm_bench: bad argument"<<std::endl;
+        return 2;
+    }
+    benchType<int>();
+    benchType<float>();
+    benchType<double>();
+    benchType<Complex>();
+    if (settings.out.empty()) {
+        writeJson(std::cout);
+        return 0;
+    }
+    std::ofstream file(settings.out);
+    writeJson(file);
+    return file ? 0 : 1;
+}